@@ -0,0 +1,194 @@
+#!/bin/sh -e
+
+# Time tcpslice on synthetic pcap files written by pcapgen, in a few
+# representative scenarios, and report for each one the best of a few runs:
+# the wall and CPU time, the throughput in MB and packets read per second,
+# the latency until the first packet of the range is found (the open and
+# find_packet phases of -S) and the number of probes and seeks of the search.
+#
+# Then, if given malloccount.so, count the calls to the allocator of the
+# session trackers over the first half of a file of long connections and
+# over all of it, which should be the same: once as many sessions are open
+# as there will be at a time, nothing is allocated for a packet or for a
+# session, so the packets of the second half must not add any.  Exit with
+# an error if they do.
+#
+# Usage: bench.sh [-k] [-d dir] [-n packets] [-m files] [-r runs]
+#                 [tcpslice [pcapgen [malloccount.so]]]
+#
+# The files are written to dir, by default a new temporary directory that
+# is removed at the end unless -k is given.  As pcapgen always writes the
+# same files for the same options, they are only written again if the
+# options change.
+
+usage() {
+    echo "Usage: $0 [-k] [-d dir] [-n packets] [-m files] [-r runs] [tcpslice [pcapgen [malloccount.so]]]" >&2
+    exit 1
+}
+
+KEEP=no
+DIR=
+PACKETS=1000000
+FILES=1000
+RUNS=3
+while getopts kd:n:m:r: opt; do
+    case $opt in
+    k) KEEP=yes ;;
+    d) DIR=$OPTARG ;;
+    n) PACKETS=$OPTARG ;;
+    m) FILES=$OPTARG ;;
+    r) RUNS=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+[ $# -le 3 ] || usage
+TCPSLICE=${1:-./tcpslice}
+PCAPGEN=${2:-./pcapgen}
+MALLOCCOUNT=${3:-}
+# LD_PRELOAD takes a path from the directory of the program.
+case $MALLOCCOUNT in
+''|/*) ;;
+*) MALLOCCOUNT=`pwd`/$MALLOCCOUNT ;;
+esac
+
+if [ -z "$DIR" ]; then
+    DIR=`mktemp -d -t tcpslice_bench.XXXXXXXX`
+    [ "$KEEP" = yes ] || trap 'rm -rf "$DIR"' EXIT
+else
+    mkdir -p "$DIR"
+    KEEP=yes
+fi
+
+# generate name options...: write the files of a scenario, unless they are
+# already there with the same options.
+generate() {
+    name=$1
+    shift
+    if [ "`cat "$DIR/$name.options" 2>/dev/null`" != "$*" ]; then
+        rm -f "$DIR/$name".pcap*
+        echo "Writing $name: pcapgen $*" >&2
+        "$PCAPGEN" "$@" -w "$DIR/$name.pcap"
+        echo "$*" >"$DIR/$name.options"
+    fi
+}
+
+# The rate is such that a file of the whole stream spans 100 seconds.
+RATE=`expr "$PACKETS" / 100`
+[ "$RATE" -gt 0 ] || RATE=1
+generate single -c "$PACKETS" -r "$RATE" -b 8 -d imix
+generate merge -c "$PACKETS" -r "$RATE" -b 8 -d imix -m "$FILES" -o 0.5
+generate dedup -c "$PACKETS" -r "$RATE" -b 8 -d imix -m 4 -o 1 -D 0.1 -O 0.001
+generate sessions -c "$PACKETS" -r "$RATE" -C 256 -l 100 -d uniform:64:1514
+
+# run name tcpslice-options...: run a scenario and print its line.
+run() {
+    name=$1
+    shift
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        rm -rf "$DIR/out"
+        mkdir "$DIR/out"
+        "$TCPSLICE" -S text "$@" >/dev/null 2>"$DIR/$name.$i.stats"
+        i=`expr $i + 1`
+    done
+    # Keep the run of least wall time.
+    cat "$DIR/$name".*.stats | awk -v name="$name" '
+        $1 == "open" || $1 == "find_packet" { latency += $2 }
+        $1 == "file" {
+            for (f = 1; f < NF; f++) {
+                if ($(f + 1) == "bytes" && $(f + 2) == "read,") bytes += $f
+                if ($(f + 1) == "packets" && $(f + 2) == "read,") packets += $f
+                if ($(f + 1) == "seeks,") seeks += $f
+                if ($(f + 1) == "probes,") probes += $f
+            }
+        }
+        $1 == "total" { wall = $2; cpu = $3 }
+        $1 == "peak" {
+            if (best == "" || wall < best) {
+                best = wall
+                line = sprintf("%-10s %9.3f %9.3f %9.1f %11.0f %10.3f %8d %8d",
+                    name, wall, cpu, wall > 0 ? bytes / wall / 1e6 : 0,
+                    wall > 0 ? packets / wall : 0, latency * 1000,
+                    probes, seeks)
+            }
+            latency = bytes = packets = seeks = probes = 0
+        }
+        END { print line }'
+    rm -f "$DIR/$name".*.stats
+}
+
+printf '%-10s %9s %9s %9s %11s %10s %8s %8s\n' scenario 'wall s' 'cpu s' \
+    'MB/s' 'packets/s' 'latency ms' probes seeks
+# 1% of a single file, from its middle.
+run slice -w "$DIR/out/slice.pcap" +50 +1 "$DIR/single.pcap"
+# All the packets of files that each overlap half of the next one.
+run merge -w "$DIR/out/merge.pcap" "$DIR"/merge.pcap.*
+# Files that all span the same time, with 10% duplicates, removed or not.
+run dedup -w "$DIR/out/dedup.pcap" "$DIR"/dedup.pcap.*
+run nodedup -D -w "$DIR/out/dedup.pcap" "$DIR"/dedup.pcap.*
+# A file per TCP connection, of 10% of a file of long connections.
+run sessions -s tcp -f "$DIR/out/%s-%d.pcap" -w "$DIR/out/sessions.pcap" \
+    +45 +10 "$DIR/sessions.pcap"
+# The first and last time of each file.
+run report -r "$DIR"/merge.pcap.*
+
+# allocs name tcpslice-options...: run once with malloccount.so and set
+# ALLOCS to its calls to the allocator and PACKETS to the packets it read.
+allocs() {
+    name=$1
+    shift
+    rm -f "$DIR/$name.allocs"
+    LD_PRELOAD=$MALLOCCOUNT MALLOCCOUNT_FILE="$DIR/$name.allocs" \
+        "$TCPSLICE" -S text "$@" >/dev/null 2>"$DIR/$name.stats"
+    ALLOCS=`cat "$DIR/$name.allocs" 2>/dev/null || true`
+    PACKETS=`awk '$1 == "packets:" { print $2 }' "$DIR/$name.stats"`
+    rm -f "$DIR/$name.allocs" "$DIR/$name.stats"
+}
+
+# steady tracker tcpslice-options...: print the calls to the allocator over
+# the first half of the file of long connections, reading at most a second
+# past it, and over all of it, and how many the packets of the rest made
+# each.
+steady() {
+    tracker=$1
+    shift
+    allocs "$tracker.half" "$@" -a 1 -w "$DIR/out/steady.pcap" +0 +50 \
+        "$DIR/sessions.pcap"
+    half_allocs=$ALLOCS
+    half_packets=$PACKETS
+    allocs "$tracker" "$@" -a 1 -w "$DIR/out/steady.pcap" \
+        "$DIR/sessions.pcap"
+    if [ -z "$half_allocs" ] || [ -z "$ALLOCS" ]; then
+        echo "$tracker: malloccount.so did not count anything" >&2
+        FAILED=yes
+        return
+    fi
+    awk -v tracker="$tracker" -v ha="$half_allocs" -v hp="$half_packets" \
+        -v a="$ALLOCS" -v p="$PACKETS" 'BEGIN {
+        printf "%-10s %12d %9d %12d %9d %13.6f\n", tracker, hp, ha, p, a,
+            (p > hp ? (a - ha) / (p - hp) : 0)
+        exit (a > ha)
+    }' || FAILED=yes
+}
+
+if [ -n "$MALLOCCOUNT" ]; then
+    FAILED=no
+    echo
+    printf '%-10s %12s %9s %12s %9s %13s\n' tracker 'half packets' allocs \
+        'all packets' allocs 'allocs/packet'
+    steady default -s tcp
+    steady native -n -s tcp
+    steady threads -n -j 4 -s tcp
+    if [ "$FAILED" = yes ]; then
+        echo "Tracking sessions allocates memory for packets." >&2
+        rm -rf "$DIR/out"
+        exit 1
+    fi
+fi
+rm -rf "$DIR/out"
+
+if [ "$KEEP" = yes ]; then
+    echo "The files are in $DIR." >&2
+fi
+# vi: set tabstop=4 softtabstop=0 expandtab shiftwidth=4 smarttab autoindent :
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * malloccount - count the memory allocations of a program
+ *
+ * Loaded with LD_PRELOAD, this counts the calls to malloc(), calloc(),
+ * realloc() and posix_memalign() made by the program and the libraries
+ * it uses, and at exit writes their number to the file named by
+ * $MALLOCCOUNT_FILE, if set.  bench.sh uses it to check that tracking
+ * sessions allocates nothing for each packet once in a steady state.
+ */
+
+#define _GNU_SOURCE	/* for RTLD_NEXT */
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void (*real_free)(void *);
+
+static uint64_t count;
+
+/* What dlsym() allocates before the real functions are known, never
+ * freed.
+ */
+static char bootstrap[4096] __attribute__((aligned(16)));
+static size_t bootstrap_len;
+static int initializing;
+
+/* Through memcpy(), as ISO C has no cast from void * to a function. */
+#define LOOKUP(fn, name) do { \
+		void *sym = dlsym(RTLD_NEXT, name); \
+		memcpy(&(fn), &sym, sizeof(fn)); \
+	} while (0)
+
+static void
+init(void)
+{
+	initializing = 1;
+	LOOKUP(real_malloc, "malloc");
+	LOOKUP(real_calloc, "calloc");
+	LOOKUP(real_realloc, "realloc");
+	LOOKUP(real_posix_memalign, "posix_memalign");
+	LOOKUP(real_free, "free");
+	initializing = 0;
+	if (real_malloc == NULL || real_calloc == NULL ||
+	    real_realloc == NULL || real_posix_memalign == NULL ||
+	    real_free == NULL)
+		abort();
+}
+
+static void *
+bootstrap_alloc(const size_t size)
+{
+	void *p;
+
+	if (size > sizeof(bootstrap) - bootstrap_len)
+		return NULL;
+	p = bootstrap + bootstrap_len;
+	bootstrap_len += (size + 15) & ~(size_t)15;
+	return p;
+}
+
+static int
+is_bootstrap(const void *p)
+{
+	return (const char *)p >= bootstrap &&
+	    (const char *)p < bootstrap + sizeof(bootstrap);
+}
+
+void *
+malloc(size_t size)
+{
+	if (real_malloc == NULL) {
+		if (initializing)
+			return bootstrap_alloc(size);
+		init();
+	}
+	__sync_fetch_and_add(&count, 1);
+	return real_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	if (real_calloc == NULL) {
+		/* The bootstrap buffer is still zeroed. */
+		if (initializing)
+			return size && n > SIZE_MAX / size ? NULL :
+			    bootstrap_alloc(n * size);
+		init();
+	}
+	__sync_fetch_and_add(&count, 1);
+	return real_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size)
+{
+	size_t left;
+	void *q;
+
+	if (real_realloc == NULL)
+		init();
+	__sync_fetch_and_add(&count, 1);
+	if (is_bootstrap(p)) {
+		/* Its size is not known, but no more than what follows it. */
+		left = (size_t)(bootstrap + sizeof(bootstrap) - (char *)p);
+		if ((q = real_malloc(size)) != NULL)
+			memcpy(q, p, size < left ? size : left);
+		return q;
+	}
+	return real_realloc(p, size);
+}
+
+int
+posix_memalign(void **p, size_t alignment, size_t size)
+{
+	if (real_posix_memalign == NULL)
+		init();
+	__sync_fetch_and_add(&count, 1);
+	return real_posix_memalign(p, alignment, size);
+}
+
+void
+free(void *p)
+{
+	if (p == NULL || is_bootstrap(p))
+		return;
+	if (real_free == NULL)
+		init();
+	real_free(p);
+}
+
+/* Without stdio, which would allocate. */
+static void __attribute__((destructor))
+report(void)
+{
+	const char *name = getenv("MALLOCCOUNT_FILE");
+	char buf[32];
+	int fd, len;
+
+	if (name == NULL)
+		return;
+	len = snprintf(buf, sizeof(buf), "%llu\n", (unsigned long long)count);
+	if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		return;
+	(void)write(fd, buf, (size_t)len);
+	(void)close(fd);
+}
@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pcapgen - write synthetic pcap files for benchmarking tcpslice
+ *
+ * The packets are those of TCP connections over IPv4 and Ethernet, each
+ * with its handshake, its data and its closing, so that tcpslice -s tcp
+ * has sessions to track.  Everything is drawn from a pseudo-random
+ * generator with a fixed seed, so that the same options always write the
+ * same files, byte for byte.
+ *
+ * The packets come out as one stream in time order, at the given rate,
+ * in bursts of the given mean length.  With several files each one gets
+ * a window of that stream, and consecutive windows overlap by the given
+ * fraction: with no overlap the files follow each other, like the files
+ * of a rotating capture, and with full overlap they all span the whole
+ * stream, like captures taken on several interfaces at once.  A packet in
+ * the overlap of several windows goes to one of them, and a duplicate of
+ * it, if it gets one, to another file.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ETHER_HDR_LEN	14
+#define IP_HDR_LEN	20
+#define TCP_HDR_LEN	20
+#define HDR_LEN		(ETHER_HDR_LEN + IP_HDR_LEN + TCP_HDR_LEN)
+#define MIN_FRAME_LEN	60	/* without the FCS */
+#define MAX_FRAME_LEN	65535
+
+#define TH_FIN		0x01
+#define TH_SYN		0x02
+#define TH_PUSH		0x08
+#define TH_ACK		0x10
+
+enum size_dist {
+	SIZE_FIXED,
+	SIZE_UNIFORM,
+	SIZE_IMIX
+};
+
+/* A connection, from its SYN to the acknowledgment of its last FIN. */
+struct conn {
+	uint32_t	client;
+	uint32_t	server;
+	uint16_t	client_port;
+	uint16_t	server_port;
+	uint32_t	seq[2];		/* next to send, client first */
+	u_int		step;		/* packets sent so far */
+	u_int		data;		/* data packets to send */
+};
+
+/* An output file, with the packet held back in case the next one has to
+ * be written before it.
+ */
+struct out {
+	FILE		*f;
+	u_char		*held;		/* record header and data */
+	size_t		held_len;	/* 0 if none */
+	size_t		held_size;
+	uint64_t	packets;
+};
+
+static uint64_t rng_state;
+
+static int swap;			/* the byte order of the headers */
+static uint32_t snaplen = MAX_FRAME_LEN;
+static enum size_dist size_dist = SIZE_IMIX;
+static u_int size_min = MIN_FRAME_LEN;
+static u_int size_max = 1514;
+
+static void
+error(const char *fmt, const char *arg)
+{
+	(void)fprintf(stderr, "pcapgen: ");
+	(void)fprintf(stderr, fmt, arg);
+	(void)fputc('\n', stderr);
+	exit(1);
+}
+
+/* xorshift64*: fast, and the same everywhere. */
+static uint64_t
+rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* In [0, 1). */
+static double
+rng_double(void)
+{
+	return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* In [0, n). */
+static u_int
+rng_below(const u_int n)
+{
+	return (u_int)(rng_double() * n);
+}
+
+
+static void
+put16(u_char *p, const uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static void
+put32(u_char *p, const uint32_t v)
+{
+	put16(p, v >> 16);
+	put16(p + 2, v & 0xffff);
+}
+
+/* A 32-bit field of a pcap header, in the byte order asked for. */
+static uint32_t
+hdr32(const uint32_t v)
+{
+	if (!swap)
+		return v;
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) |
+	    (v << 24);
+}
+
+static uint16_t
+hdr16(const uint16_t v)
+{
+	return swap ? (uint16_t)((v >> 8) | (v << 8)) : v;
+}
+
+static void
+parse_size_dist(const char *arg)
+{
+	char *end;
+
+	if (strcmp(arg, "imix") == 0) {
+		size_dist = SIZE_IMIX;
+		return;
+	}
+	if (strncmp(arg, "fixed:", 6) == 0) {
+		size_dist = SIZE_FIXED;
+		size_min = size_max = (u_int)strtoul(arg + 6, &end, 10);
+	} else if (strncmp(arg, "uniform:", 8) == 0) {
+		size_dist = SIZE_UNIFORM;
+		size_min = (u_int)strtoul(arg + 8, &end, 10);
+		if (*end != ':')
+			error("invalid packet size distribution '%s'", arg);
+		size_max = (u_int)strtoul(end + 1, &end, 10);
+	} else
+		error("invalid packet size distribution '%s'", arg);
+	if (*end != '\0' || size_min < HDR_LEN + 1 || size_max < size_min ||
+	    size_max > MAX_FRAME_LEN)
+		error("invalid packet size distribution '%s'", arg);
+}
+
+/* The length of the frame of a data packet. */
+static u_int
+data_frame_len(void)
+{
+	u_int r;
+
+	switch (size_dist) {
+	case SIZE_FIXED:
+		return size_min;
+	case SIZE_UNIFORM:
+		return size_min + rng_below(size_max - size_min + 1);
+	case SIZE_IMIX:
+	default:
+		/* The "simple IMIX": 7 small, 4 medium and 1 large. */
+		r = rng_below(12);
+		return r < 7 ? 64 : r < 11 ? 594 : 1514;
+	}
+}
+
+static void
+conn_start(struct conn *c, const uint32_t id, const u_int data)
+{
+	c->client = 0x0a000000 | (id & 0xffffff);		/* 10/8 */
+	c->server = 0xc0a80000 | rng_below(256);		/* 192.168.0/24 */
+	c->client_port = (uint16_t)(1024 + id % 64512);
+	c->server_port = rng_below(2) ? 443 : 80;
+	c->seq[0] = (uint32_t)rng();
+	c->seq[1] = (uint32_t)rng();
+	c->step = 0;
+	c->data = data;
+}
+
+/* Build the next packet of a connection into buf, and return the length
+ * of its frame, or 0 if the connection is over.  The handshake comes
+ * first, then the data in either direction, then a FIN from each end,
+ * each acknowledged.
+ */
+static u_int
+conn_packet(struct conn *c, u_char *buf, const uint64_t number)
+{
+	u_int len = MIN_FRAME_LEN, payload = 0, from, flags, step = c->step++;
+	u_char *ip = buf + ETHER_HDR_LEN, *tcp = ip + IP_HDR_LEN;
+	uint32_t seq, ack;
+
+	if (step == 0) {
+		from = 0;
+		flags = TH_SYN;
+	} else if (step == 1) {
+		from = 1;
+		flags = TH_SYN | TH_ACK;
+	} else if (step == 2) {
+		from = 0;
+		flags = TH_ACK;
+	} else if (step < 3 + c->data) {
+		from = rng_below(2);
+		flags = TH_PUSH | TH_ACK;
+		len = data_frame_len();
+		payload = len - HDR_LEN;
+	} else if (step < 3 + c->data + 4) {
+		/* FIN, its ACK, the other FIN and its ACK. */
+		static const u_int closing_from[4] = { 0, 1, 1, 0 };
+
+		from = closing_from[step - 3 - c->data];
+		flags = (step - 3 - c->data) % 2 ? TH_ACK : TH_FIN | TH_ACK;
+	} else
+		return 0;
+
+	seq = c->seq[from];
+	ack = c->seq[1 - from];
+	if (flags & (TH_SYN | TH_FIN))
+		c->seq[from]++;
+	c->seq[from] += payload;
+
+	memset(buf, 0, HDR_LEN);
+	/* Ethernet */
+	memcpy(buf, "\x00\x00\x5e\x00\x00", 5);
+	buf[5] = from ? 1 : 2;
+	memcpy(buf + 6, "\x00\x00\x5e\x00\x00", 5);
+	buf[11] = from ? 2 : 1;
+	put16(buf + 12, 0x0800);
+	/* IPv4 */
+	ip[0] = 0x45;
+	put16(ip + 2, (uint16_t)(IP_HDR_LEN + TCP_HDR_LEN + payload));
+	put16(ip + 4, (uint16_t)number);
+	ip[8] = 64;
+	ip[9] = 6;
+	put32(ip + 12, from ? c->server : c->client);
+	put32(ip + 16, from ? c->client : c->server);
+	/* TCP */
+	put16(tcp, from ? c->server_port : c->client_port);
+	put16(tcp + 2, from ? c->client_port : c->server_port);
+	put32(tcp + 4, seq);
+	put32(tcp + 8, step == 0 ? 0 : ack);
+	tcp[12] = 5 << 4;
+	tcp[13] = (u_char)flags;
+	put16(tcp + 14, 65535);
+	/* The number of the packet starts its data, so that two packets
+	 * are never the same unless one is a duplicate of the other.
+	 */
+	if (payload >= 8) {
+		put32(tcp + TCP_HDR_LEN, (uint32_t)(number >> 32));
+		put32(tcp + TCP_HDR_LEN + 4, (uint32_t)number);
+		memset(tcp + TCP_HDR_LEN + 8, 0, payload - 8);
+	} else if (payload > 0)
+		memset(tcp + TCP_HDR_LEN, (u_char)number, payload);
+	if (len > HDR_LEN + payload)
+		memset(buf + HDR_LEN + payload, 0, len - HDR_LEN - payload);
+	return len;
+}
+
+static void
+write_out(struct out *o, const u_char *rec, const size_t len)
+{
+	if (fwrite(rec, len, 1, o->f) != 1)
+		error("%s", "write failed");
+	++o->packets;
+}
+
+/* Write a packet to a file, or hold it back, so that the next one can be
+ * written before it if it has to be out of order.
+ */
+static void
+put_packet(struct out *o, const uint64_t usec, const u_char *buf,
+	   const u_int len, const int reorder)
+{
+	uint32_t caplen = len < snaplen ? len : snaplen;
+	u_char rec[16];
+	uint32_t v;
+
+	v = hdr32((uint32_t)(usec / 1000000));
+	memcpy(rec, &v, 4);
+	v = hdr32((uint32_t)(usec % 1000000));
+	memcpy(rec + 4, &v, 4);
+	v = hdr32(caplen);
+	memcpy(rec + 8, &v, 4);
+	v = hdr32(len);
+	memcpy(rec + 12, &v, 4);
+
+	if (reorder && o->held_len) {
+		write_out(o, rec, sizeof(rec));
+		--o->packets;
+		if (caplen && fwrite(buf, caplen, 1, o->f) != 1)
+			error("%s", "write failed");
+		write_out(o, o->held, o->held_len);
+		o->held_len = 0;
+		return;
+	}
+	if (o->held_len)
+		write_out(o, o->held, o->held_len);
+	if (sizeof(rec) + caplen > o->held_size) {
+		o->held_size = sizeof(rec) + caplen;
+		o->held = (u_char *)realloc(o->held, o->held_size);
+		if (o->held == NULL)
+			error("%s", "out of memory");
+	}
+	memcpy(o->held, rec, sizeof(rec));
+	memcpy(o->held + sizeof(rec), buf, caplen);
+	o->held_len = sizeof(rec) + caplen;
+}
+
+static void
+open_out(struct out *o, const char *name)
+{
+	struct {
+		uint32_t magic;
+		uint16_t version_major;
+		uint16_t version_minor;
+		uint32_t thiszone;
+		uint32_t sigfigs;
+		uint32_t snaplen;
+		uint32_t linktype;
+	} hdr;
+
+	memset(o, 0, sizeof(*o));
+	o->f = fopen(name, "wb");
+	if (o->f == NULL)
+		error("cannot create '%s'", name);
+	hdr.magic = hdr32(0xa1b2c3d4);
+	hdr.version_major = hdr16(2);
+	hdr.version_minor = hdr16(4);
+	hdr.thiszone = 0;
+	hdr.sigfigs = 0;
+	hdr.snaplen = hdr32(snaplen);
+	hdr.linktype = hdr32(1);	/* DLT_EN10MB */
+	if (fwrite(&hdr, 24, 1, o->f) != 1)
+		error("cannot write '%s'", name);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr,
+"Usage: pcapgen [-v] [-c packets] [-d sizes] [-s snaplen] [-E order]\n"
+"               [-r rate] [-b burst] [-C connections] [-l length]\n"
+"               [-m files] [-o overlap] [-D duplicates] [-O reordered]\n"
+"               [-S seed] [-T start] -w file\n");
+	exit(1);
+}
+
+static double
+parse_ratio(const char *arg)
+{
+	char *end;
+	double r = strtod(arg, &end);
+
+	if (*end != '\0' || r < 0 || r > 1)
+		error("invalid ratio '%s', not between 0 and 1", arg);
+	return r;
+}
+
+static u_long
+parse_count(const char *arg)
+{
+	char *end;
+	u_long n = strtoul(arg, &end, 10);
+
+	if (*end != '\0' || n == 0)
+		error("invalid number '%s'", arg);
+	return n;
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t count = 100000, start = 1000000000, seed = 1;
+	double rate = 10000, burst = 1, overlap = 0, dups = 0, reorder = 0;
+	u_long nconns = 64, length = 20, nfiles = 1, i;
+	const char *name = NULL;
+	int op, verbose = 0;
+	struct conn *conns;
+	struct out *outs;
+	uint64_t n, usec, in_burst = 0, bytes = 0, duplicated = 0;
+	double window, step, t;
+	u_char *buf;
+	char *fname;
+
+	while ((op = getopt(argc, argv, "b:C:c:D:d:E:l:m:O:o:r:S:s:T:vw:")) != -1)
+		switch (op) {
+		case 'b':
+			burst = (double)parse_count(optarg);
+			break;
+		case 'C':
+			nconns = parse_count(optarg);
+			break;
+		case 'c':
+			count = parse_count(optarg);
+			break;
+		case 'D':
+			dups = parse_ratio(optarg);
+			break;
+		case 'd':
+			parse_size_dist(optarg);
+			break;
+		case 'E':
+			if (strcmp(optarg, "big") == 0)
+				op = 1;
+			else if (strcmp(optarg, "little") == 0)
+				op = 0;
+			else if (strcmp(optarg, "host") == 0)
+				break;
+			else
+				error("invalid byte order '%s'", optarg);
+			/* Swap if the host is of the other order. */
+			{
+				const uint16_t one = 1;
+
+				swap = (*(const u_char *)&one == 1) == op;
+			}
+			break;
+		case 'l':
+			length = parse_count(optarg);
+			break;
+		case 'm':
+			nfiles = parse_count(optarg);
+			break;
+		case 'O':
+			reorder = parse_ratio(optarg);
+			break;
+		case 'o':
+			overlap = parse_ratio(optarg);
+			break;
+		case 'r':
+			rate = (double)parse_count(optarg);
+			break;
+		case 'S':
+			seed = parse_count(optarg);
+			break;
+		case 's':
+			snaplen = (uint32_t)parse_count(optarg);
+			if (snaplen > MAX_FRAME_LEN)
+				error("invalid snaplen '%s'", optarg);
+			break;
+		case 'T':
+			start = parse_count(optarg);
+			break;
+		case 'v':
+			++verbose;
+			break;
+		case 'w':
+			name = optarg;
+			break;
+		default:
+			usage();
+		}
+	if (name == NULL || optind != argc)
+		usage();
+
+	/* xorshift must not start at 0. */
+	rng_state = seed * 0x9e3779b97f4a7c15ULL;
+	if (rng_state == 0)
+		rng_state = 1;
+
+	buf = (u_char *)malloc(MAX_FRAME_LEN);
+	conns = (struct conn *)calloc(nconns, sizeof(*conns));
+	outs = (struct out *)calloc(nfiles, sizeof(*outs));
+	fname = (char *)malloc(strlen(name) + 24);
+	if (buf == NULL || conns == NULL || outs == NULL || fname == NULL)
+		error("%s", "out of memory");
+	for (i = 0; i < nfiles; i++) {
+		if (nfiles == 1)
+			strcpy(fname, name);
+		else
+			sprintf(fname, "%s.%lu", name, i);
+		open_out(&outs[i], fname);
+	}
+	for (i = 0; i < nconns; i++)
+		conn_start(&conns[i], (uint32_t)i, 1 + rng_below(2 * length));
+
+	/* The windows of the files: each one spans "window" packets of the
+	 * stream and starts "step" packets after the previous one.
+	 */
+	window = (double)count / ((nfiles - 1) * (1 - overlap) + 1);
+	step = window * (1 - overlap);
+
+	usec = start * 1000000;
+	for (n = 0; n < count; n++) {
+		struct conn *c = &conns[rng_below(nconns)];
+		u_long lo, hi, file, other;
+		u_int len;
+
+		while ((len = conn_packet(c, buf, n)) == 0)
+			conn_start(c, (uint32_t)(nconns + n),
+			    1 + rng_below(2 * length));
+
+		/* Bursts of back-to-back packets, 1 microsecond apart, and
+		 * gaps between them such that the mean rate is the one given.
+		 */
+		if (in_burst == 0) {
+			usec += (uint64_t)(rng_double() * 2 * burst * 1e6 / rate);
+			in_burst = 1 + rng_below((u_int)(2 * burst - 1));
+		} else
+			usec += 1;
+		--in_burst;
+
+		t = (double)n;
+		if (step > 0) {
+			lo = t < window ? 0 : (u_long)((t - window) / step) + 1;
+			hi = (u_long)(t / step);
+		} else {
+			lo = 0;
+			hi = nfiles - 1;
+		}
+		if (hi > nfiles - 1)
+			hi = nfiles - 1;
+		if (lo > hi)
+			lo = hi;
+		file = lo + rng_below((u_int)(hi - lo + 1));
+		put_packet(&outs[file], usec, buf, len,
+		    reorder > 0 && rng_double() < reorder);
+		bytes += len;
+
+		/* A duplicate goes to another file of the window if there is
+		 * one, or else to a neighbouring file.
+		 */
+		if (nfiles > 1 && dups > 0 && rng_double() < dups) {
+			if (hi > lo) {
+				other = lo + rng_below((u_int)(hi - lo));
+				if (other >= file)
+					++other;
+			} else
+				other = file + 1 < nfiles ? file + 1 : file - 1;
+			put_packet(&outs[other], usec, buf, len, 0);
+			++duplicated;
+		}
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		if (outs[i].held_len)
+			write_out(&outs[i], outs[i].held, outs[i].held_len);
+		if (fclose(outs[i].f) != 0)
+			error("%s", "write failed");
+		free(outs[i].held);
+	}
+	if (verbose)
+		(void)fprintf(stderr, "%llu packets, %llu bytes, %llu duplicates "
+		    "in %lu files, %.6f seconds\n", (unsigned long long)count,
+		    (unsigned long long)bytes, (unsigned long long)duplicated,
+		    nfiles, (double)(usec - start * 1000000) / 1e6);
+	free(fname);
+	free(outs);
+	free(conns);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * searchbench - time the search kernels of search.c and check them
+ *
+ * For each kind of file below, a fixture file is written, with the
+ * offset and time of each of its packets noted down, and then
+ *  - find_header() is run on windows of it read into memory, at random
+ *    offsets, and its result compared with that of ref_find_header(), a
+ *    plain restatement of its rules, and with the true packet offsets
+ *  - sf_find_end() is run on it, and its result compared with the last
+ *    packet
+ *  - sf_find_packet() is run for random times, and the position it
+ *    leaves the file at compared with that of the first packet at or
+ *    after the time.
+ * The report gives the time per buffer offset examined by find_header(),
+ * how often it finds a clash, and the probes sf_find_packet() takes to
+ * converge.  Besides typical files, the kinds of files are the worst cases
+ * of the search: uneven rates, tiny packets, packets of the largest
+ * snapshot length, files shorter than a search buffer, and payloads that
+ * look like packet headers.  With the
+ * latter, wrong headers are expected: only the other kinds have to find
+ * the right ones.  The exit status is 1 if find_header() differs from the
+ * reference, or if any search of the other kinds goes wrong.
+ *
+ * search.c is included, so that its static functions can be called.
+ */
+
+#include "search.c"
+
+#define FIXTURE_START	1000000000	/* the time of the first packet */
+
+struct fixture_kind {
+	const char	*name;
+	int		packets;
+	int		snaplen;
+	int		min_caplen;
+	int		max_caplen;
+	int		swapped;	/* headers of the other byte order */
+	int		bursty;		/* long gaps between some packets */
+	int		mimic;		/* payloads that look like headers */
+	int		adversarial;	/* wrong results expected */
+};
+
+static const struct fixture_kind kinds[] = {
+	{ "typical",	50000,	1514,	60,	1514,	0, 0, 0, 0 },
+	{ "swapped",	50000,	1514,	60,	1514,	1, 0, 0, 0 },
+	{ "bursty",	50000,	1514,	60,	1514,	0, 1, 0, 0 },
+	{ "bigsnap",	50000,	262144,	60,	1514,	0, 0, 0, 0 },
+	{ "tiny",	200000,	96,	1,	16,	0, 0, 0, 0 },
+	{ "maxsnap",	400,	65535,	65535,	65535,	0, 0, 0, 0 },
+	{ "short",	3,	65535,	60,	1514,	0, 0, 0, 0 },
+	{ "mimic",	50000,	1514,	200,	1514,	0, 0, 1, 1 },
+};
+
+struct fixture {
+	const struct fixture_kind *kind;
+	u_char		*data;		/* the whole file */
+	int64_t		len;
+	int64_t		*offsets;	/* of the packets */
+	struct timeval	*times;
+	int		count;
+};
+
+struct result {
+	struct tcpslice_time find_header;
+	uint64_t	examined;
+	uint64_t	status[4];	/* by HEADER_* */
+	uint64_t	ref_mismatches;
+	uint64_t	false_headers;
+	struct tcpslice_time find_end;
+	uint64_t	end_wrong;
+	struct tcpslice_time find_packet;
+	uint64_t	probes;
+	uint64_t	max_probes;
+	uint64_t	packet_errors;
+	uint64_t	packet_wrong;
+};
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t
+rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int
+rng_between(const int min, const int max)
+{
+	return min + (int)(rng() % (uint64_t)(max - min + 1));
+}
+
+static void
+put_hdr(u_char *buf, const int swapped, const struct timeval *tv,
+	const uint32_t caplen, const uint32_t len)
+{
+	uint32_t v[4];
+
+	v[0] = (uint32_t)tv->tv_sec;
+	v[1] = (uint32_t)tv->tv_usec;
+	v[2] = caplen;
+	v[3] = len;
+	if (swapped) {
+		v[0] = SWAPLONG(v[0]);
+		v[1] = SWAPLONG(v[1]);
+		v[2] = SWAPLONG(v[2]);
+		v[3] = SWAPLONG(v[3]);
+	}
+	memcpy(buf, v, sizeof(v));
+}
+
+/* Fill the payload of a packet with two fake headers in a row, with times
+ * close to that of the packet, so that each packet holds a "definite"
+ * header that is not one.
+ */
+static void
+put_mimic(u_char *payload, const int caplen, const int swapped,
+	  const struct timeval *tv)
+{
+	struct timeval fake = *tv;
+	int off, fake_len;
+
+	if (caplen < 4 * (int)PACKET_HDR_LEN + 16)
+		return;
+	off = rng_between(0, caplen - 4 * (int)PACKET_HDR_LEN - 16);
+	fake_len = rng_between(1, 16);
+	fake.tv_usec = rng_between(0, 999999);
+	put_hdr(payload + off, swapped, &fake, fake_len, fake_len);
+	off += PACKET_HDR_LEN + fake_len;
+	put_hdr(payload + off, swapped, &fake, fake_len, fake_len);
+}
+
+static void
+fixture_make(struct fixture *fx, const struct fixture_kind *kind,
+	     const char *filename)
+{
+	struct timeval tv;
+	int64_t size, pos;
+	uint32_t v;
+	int i, caplen;
+	FILE *f;
+
+	fx->kind = kind;
+	fx->count = kind->packets;
+	fx->offsets = (int64_t *)malloc(fx->count * sizeof(*fx->offsets));
+	fx->times = (struct timeval *)malloc(fx->count * sizeof(*fx->times));
+	size = PCAP_FILE_HDR_LEN +
+	    (int64_t)fx->count * (PACKET_HDR_LEN + kind->max_caplen);
+	fx->data = (u_char *)calloc(1, size);
+	if (!fx->offsets || !fx->times || !fx->data)
+		error("out of memory");
+
+	v = 0xa1b2c3d4;
+	memcpy(fx->data, &v, 4);
+	v = 2 | (4 << 16);	/* version 2.4, in host order */
+	memcpy(fx->data + 4, &v, 4);
+	v = kind->snaplen;
+	memcpy(fx->data + 16, &v, 4);
+	v = 1;			/* DLT_EN10MB */
+	memcpy(fx->data + 20, &v, 4);
+	if (kind->swapped)
+		for (i = 0; i < 6; i++) {
+			/* 2 and 4 are 16-bit, but swap the 32-bit word. */
+			if (i == 1) {
+				fx->data[4] = 0;
+				fx->data[5] = 2;
+				fx->data[6] = 0;
+				fx->data[7] = 4;
+				continue;
+			}
+			memcpy(&v, fx->data + 4 * i, 4);
+			v = SWAPLONG(v);
+			memcpy(fx->data + 4 * i, &v, 4);
+		}
+
+	tv.tv_sec = FIXTURE_START;
+	tv.tv_usec = 0;
+	pos = PCAP_FILE_HDR_LEN;
+	for (i = 0; i < fx->count; i++) {
+		/* With bursts, a gap of up to 10 minutes every 1000 packets
+		 * or so, which throws off the interpolation of the search.
+		 */
+		if (kind->bursty && rng() % 1000 == 0)
+			tv.tv_sec += rng_between(1, 600);
+		tv.tv_usec += rng_between(0, 2000);
+		if (tv.tv_usec >= 1000000) {
+			tv.tv_sec += tv.tv_usec / 1000000;
+			tv.tv_usec %= 1000000;
+		}
+		caplen = rng_between(kind->min_caplen, kind->max_caplen);
+		if (caplen > kind->snaplen)
+			caplen = kind->snaplen;
+		fx->offsets[i] = pos;
+		fx->times[i] = tv;
+		put_hdr(fx->data + pos, kind->swapped, &tv, caplen, caplen);
+		if (kind->mimic)
+			put_mimic(fx->data + pos + PACKET_HDR_LEN, caplen,
+			    kind->swapped, &tv);
+		pos += PACKET_HDR_LEN + caplen;
+	}
+	fx->len = pos;
+
+	f = fopen(filename, "wb");
+	if (!f || fwrite(fx->data, fx->len, 1, f) != 1 || fclose(f) != 0)
+		error("cannot write '%s'", filename);
+}
+
+static void
+fixture_free(struct fixture *fx)
+{
+	free(fx->data);
+	free(fx->offsets);
+	free(fx->times);
+}
+
+/* The index of the packet at an offset, or -1 if none starts there. */
+static int
+fixture_packet_at(const struct fixture *fx, const int64_t pos)
+{
+	int lo = 0, hi = fx->count - 1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (fx->offsets[mid] == pos)
+			return mid;
+		if (fx->offsets[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+/* What find_header() should return, found by trying each buffer position
+ * as a header by itself and then applying the rules of find_header():
+ * the first definite header wins, unless another one starts before its
+ * packet ends; without definite header, a single perhaps header wins.
+ */
+static int
+ref_find_header(pcap_t *p, u_char *buf, const int buf_len,
+		const time_t first_time, const time_t last_time, int *hdrpos)
+{
+	struct pcap_pkthdr hdr, hdr2;
+	int i, definite = -1, perhaps = -1, perhaps_count = 0;
+	int limit = buf_len - (int)PACKET_HDR_LEN;
+
+	for (i = 0; i < limit; i++) {
+		extract_header(p, buf + i, &hdr);
+		if (!reasonable_header(&hdr, first_time, last_time))
+			continue;
+		if ((int64_t)i + 2 * (int64_t)PACKET_HDR_LEN + hdr.caplen <
+		    buf_len) {
+			extract_header(p, buf + i + PACKET_HDR_LEN + hdr.caplen,
+			    &hdr2);
+			if (!reasonable_header(&hdr2, hdr.ts.tv_sec,
+			    hdr.ts.tv_sec + MAX_REASONABLE_HDR_SEPARATION))
+				continue;
+			if (definite >= 0)
+				return HEADER_CLASH;
+			definite = i;
+			/* Up to the successor of the header. */
+			limit = i + (int)hdr.caplen;
+		} else if (definite < 0) {
+			if (perhaps < 0)
+				perhaps = i;
+			++perhaps_count;
+		}
+	}
+	if (definite >= 0) {
+		*hdrpos = definite;
+		return HEADER_DEFINITELY;
+	}
+	if (perhaps_count > 1)
+		return HEADER_CLASH;
+	if (perhaps_count == 1) {
+		*hdrpos = perhaps;
+		return HEADER_PERHAPS;
+	}
+	return HEADER_NONE;
+}
+
+static void
+bench_find_header(const struct fixture *fx, pcap_t *p, struct result *r)
+{
+	const int snaplen = fx->kind->snaplen;
+	const int windows = 2000;
+	struct stats_clock clock;
+	struct pcap_pkthdr hdr;
+	u_char *buf, *hdrpos;
+	int64_t start;
+	int i, len, status, ref, ref_pos;
+
+	len = (int)MAX_BYTES_FOR_DEFINITE_HEADER;
+	if (len > fx->len - PCAP_FILE_HDR_LEN)
+		len = (int)(fx->len - PCAP_FILE_HDR_LEN);
+	/* A copy, so that reading past the window would be caught by
+	 * memory checkers.
+	 */
+	buf = (u_char *)malloc(len);
+	if (!buf)
+		error("out of memory");
+	for (i = 0; i < windows; i++) {
+		start = PCAP_FILE_HDR_LEN +
+		    (int64_t)(rng() % (uint64_t)(fx->len - PCAP_FILE_HDR_LEN -
+		    len + 1));
+		memcpy(buf, fx->data + start, len);
+
+		stats_clock_start(&clock);
+		status = find_header(p, buf, len, fx->times[0].tv_sec,
+		    fx->times[fx->count - 1].tv_sec, &hdrpos, &hdr,
+		    &r->examined);
+		stats_clock_stop(&clock, &r->find_header);
+		++r->status[status];
+
+		ref = ref_find_header(p, buf, len, fx->times[0].tv_sec,
+		    fx->times[fx->count - 1].tv_sec, &ref_pos);
+		if (ref != status ||
+		    ((status == HEADER_DEFINITELY || status == HEADER_PERHAPS) &&
+		     hdrpos - buf != ref_pos))
+			++r->ref_mismatches;
+		if (status == HEADER_DEFINITELY &&
+		    fixture_packet_at(fx, start + (hdrpos - buf)) < 0)
+			++r->false_headers;
+	}
+	free(buf);
+}
+
+static void
+bench_find_end(const struct fixture *fx, pcap_t *p, struct result *r)
+{
+	const int snaplen = fx->kind->snaplen;
+	const int runs = 200;
+	struct tcpslice_file_stats st;
+	struct stats_clock clock;
+	struct timeval last;
+	int i, ok;
+
+	memset(&st, 0, sizeof(st));
+	for (i = 0; i < runs; i++) {
+		stats_clock_start(&clock);
+		ok = sf_find_end(p, snaplen, &fx->times[0], &last, &st);
+		stats_clock_stop(&clock, &r->find_end);
+		if (!ok || last.tv_sec != fx->times[fx->count - 1].tv_sec ||
+		    last.tv_usec != fx->times[fx->count - 1].tv_usec ||
+		    ftell64(pcap_file(p)) != fx->offsets[fx->count - 1])
+			++r->end_wrong;
+	}
+}
+
+static void
+bench_find_packet(const struct fixture *fx, pcap_t *p, struct result *r)
+{
+	const int snaplen = fx->kind->snaplen;
+	const int searches = 500;
+	struct tcpslice_file_stats st;
+	struct stats_clock clock;
+	struct timeval first, last, desired;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	int64_t span, pos;
+	int i, lo, hi, status;
+
+	first = fx->times[0];
+	last = fx->times[fx->count - 1];
+	span = (last.tv_sec - first.tv_sec) * 1000000 +
+	    (last.tv_usec - first.tv_usec);
+	for (i = 0; i < searches; i++) {
+		int64_t at = span > 0 ? (int64_t)(rng() % (uint64_t)span) : 0;
+
+		desired.tv_sec = first.tv_sec + (first.tv_usec + at) / 1000000;
+		desired.tv_usec = (first.tv_usec + at) % 1000000;
+		/* The first packet at or after the time, by bisection. */
+		lo = 0;
+		hi = fx->count - 1;
+		while (lo < hi) {
+			int mid = lo + (hi - lo) / 2;
+
+			if (sf_timestamp_less_than(&fx->times[mid], &desired))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (fseek64(pcap_file(p), fx->offsets[0], SEEK_SET) < 0)
+			error("cannot seek");
+		memset(&st, 0, sizeof(st));
+		stats_clock_start(&clock);
+		status = sf_find_packet(p, snaplen, &first, fx->offsets[0],
+		    &last, fx->offsets[fx->count - 1], &desired, errbuf, &st);
+		stats_clock_stop(&clock, &r->find_packet);
+		r->probes += st.probes;
+		if (st.probes > r->max_probes)
+			r->max_probes = st.probes;
+		if (status < 0) {
+			++r->packet_errors;
+			clearerr(pcap_file(p));
+			continue;
+		}
+		pos = ftell64(pcap_file(p));
+		if (status != 1 || pos != fx->offsets[lo])
+			++r->packet_wrong;
+	}
+}
+
+static void
+report(const struct fixture_kind *kind, const struct result *r)
+{
+	uint64_t calls = r->find_header.count;
+
+	printf("%-8s %8.2f %9.1f %6.1f%% %6.1f%% %6" PRIu64 " %9.1f %6" PRIu64
+	    " %9.1f %7.2f %5" PRIu64 " %6" PRIu64 "\n",
+	    kind->name,
+	    r->examined ? r->find_header.wall * 1e9 / r->examined : 0,
+	    calls ? (double)r->examined / calls : 0,
+	    calls ? 100.0 * r->status[HEADER_CLASH] / calls : 0,
+	    calls ? 100.0 * r->false_headers / calls : 0,
+	    r->ref_mismatches,
+	    r->find_end.count ? r->find_end.wall * 1e6 / r->find_end.count : 0,
+	    r->end_wrong,
+	    r->find_packet.count ?
+		r->find_packet.wall * 1e6 / r->find_packet.count : 0,
+	    r->find_packet.count ?
+		(double)r->probes / r->find_packet.count : 0,
+	    r->max_probes,
+	    r->packet_errors + r->packet_wrong);
+}
+
+int
+main(int argc, char **argv)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	const char *dir = argc > 1 ? argv[1] : ".";
+	char *filename;
+	struct fixture fx;
+	struct result r;
+	size_t i;
+	pcap_t *p;
+	int failed = 0;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: searchbench [directory]\n");
+		return 1;
+	}
+	filename = (char *)malloc(strlen(dir) + 32);
+	if (!filename)
+		error("out of memory");
+
+	printf("%-8s %8s %9s %7s %7s %6s %9s %6s %9s %7s %5s %6s\n",
+	    "", "header", "offsets", "clash", "false", "ref", "end", "end",
+	    "packet", "probes", "max", "packet");
+	printf("%-8s %8s %9s %7s %7s %6s %9s %6s %9s %7s %5s %6s\n",
+	    "kind", "ns/off", "per call", "", "", "diffs", "us/call", "wrong",
+	    "us/call", "mean", "", "wrong");
+	for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		sprintf(filename, "%s/searchbench-%s.pcap", dir, kinds[i].name);
+		fixture_make(&fx, &kinds[i], filename);
+		p = pcap_open_offline(filename, errbuf);
+		if (!p)
+			error("%s", errbuf);
+		memset(&r, 0, sizeof(r));
+		bench_find_header(&fx, p, &r);
+		bench_find_end(&fx, p, &r);
+		bench_find_packet(&fx, p, &r);
+		report(&kinds[i], &r);
+		if (r.ref_mismatches ||
+		    (!kinds[i].adversarial && (r.false_headers || r.end_wrong ||
+		     r.packet_errors || r.packet_wrong)))
+			failed = 1;
+		pcap_close(p);
+		unlink(filename);
+		fixture_free(&fx);
+	}
+	free(filename);
+	return failed;
+}
@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cache.c - remember where the first and last packets of a file are
+ *
+ * Finding the last packet of a file with sf_find_end() costs a seek and
+ * a read of a few packets' worth of data per file, which adds up when a
+ * long-running process slices the same large set of files over and over.
+ * The entries below are keyed by the canonical path of a file and are
+ * only trusted as long as the device, inode, size and modification time
+ * of the file are the same as when the entry was made.  They can be saved
+ * to a file and loaded back by a later run (-c), and looked up and stored
+ * from several threads at once (the reports of -R, -r and -t).
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+/* Number of hash buckets, must be a power of 2. */
+#define CACHE_BUCKETS 4096
+
+/* First line of a saved cache, to change with the format of the lines. */
+#define CACHE_FILE_MAGIC "tcpslice cache 1"
+
+/* Places in a file whose packets are sampled to estimate how many it has. */
+#define ESTIMATE_SAMPLES 4
+
+struct cache_entry {
+	char		*path;		/* canonical path of the file */
+	dev_t		dev;		/* identity and version of the file */
+	ino_t		ino;
+	off_t		size;
+	time_t		mtime;
+	struct file_meta meta;
+	struct cache_entry *next;	/* next entry in the same bucket */
+};
+
+static struct cache_entry *cache_table[CACHE_BUCKETS];
+static unsigned int cache_entries = 0;
+static int cache_changed = 0;		/* since loaded from a file */
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define cache_lock()	pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()	pthread_mutex_unlock(&cache_mutex)
+#else
+#define cache_lock()
+#define cache_unlock()
+#endif
+
+/* FNV-1a, good enough for path names. */
+static unsigned int
+cache_hash(const char *path)
+{
+	uint32_t h = 2166136261U;
+
+	while (*path) {
+		h ^= (u_char)*path++;
+		h *= 16777619U;
+	}
+	return h & (CACHE_BUCKETS - 1);
+}
+
+static struct cache_entry *
+cache_find(const char *path)
+{
+	struct cache_entry *e;
+
+	for (e = cache_table[cache_hash(path)]; e != NULL; e = e->next)
+		if (! strcmp(e->path, path))
+			return e;
+	return NULL;
+}
+
+static int
+cache_entry_current(const struct cache_entry *e, const struct stat *sb)
+{
+	return e->dev == sb->st_dev &&
+	       e->ino == sb->st_ino &&
+	       e->size == sb->st_size &&
+	       e->mtime == sb->st_mtime;
+}
+
+/* Look up the metadata of the given file.  Return 1 and fill in "meta" if
+ * there is an entry for it and the file has not changed since, 0 otherwise.
+ */
+int
+cache_lookup(const char *filename, struct file_meta *meta)
+{
+	char path[PATH_MAX];
+	struct stat sb;
+	struct cache_entry *e;
+	unsigned int entries;
+	int found = 0;
+
+	/* Don't pay for realpath() and stat() if nothing was ever cached. */
+	cache_lock();
+	entries = cache_entries;
+	cache_unlock();
+	if (! entries)
+		return 0;
+
+	if (realpath(filename, path) == NULL || stat(path, &sb) < 0)
+		return 0;
+
+	cache_lock();
+	e = cache_find(path);
+	if (e != NULL && cache_entry_current(e, &sb)) {
+		*meta = e->meta;
+		found = 1;
+	}
+	cache_unlock();
+	return found;
+}
+
+/* Make or update the entry of a canonical path, the cache lock held. */
+static void
+cache_set(const char *path, const struct stat *sb,
+	  const struct file_meta *meta)
+{
+	struct cache_entry *e;
+	unsigned int h;
+
+	if ((e = cache_find(path)) == NULL) {
+		/* The cache is only an optimization, do without. */
+		e = (struct cache_entry *) calloc(1, sizeof(struct cache_entry));
+		if (e == NULL)
+			return;
+		if ((e->path = strdup(path)) == NULL) {
+			free(e);
+			return;
+		}
+		h = cache_hash(path);
+		e->next = cache_table[h];
+		cache_table[h] = e;
+		++cache_entries;
+	}
+	e->dev = sb->st_dev;
+	e->ino = sb->st_ino;
+	e->size = sb->st_size;
+	e->mtime = sb->st_mtime;
+	e->meta = *meta;
+	cache_changed = 1;
+}
+
+/* Remember the metadata of the given file, "sb" being the result of a
+ * stat() done *before* the metadata was computed, so that a file that
+ * grew meanwhile is not taken for unchanged next time.
+ */
+void
+cache_store(const char *filename, const struct stat *sb,
+	    const struct file_meta *meta)
+{
+	char path[PATH_MAX];
+
+	if (realpath(filename, path) == NULL)
+		return;
+
+	cache_lock();
+	cache_set(path, sb, meta);
+	cache_unlock();
+}
+
+/* Compute the metadata of a savefile that can seek, just opened, the same
+ * way tcpslice_open() does, plus an estimate of its number of packets.
+ * Return 1 on success, 0 if the file has no packet or its end cannot be
+ * found.  The file is left at no particular position.
+ */
+int
+file_meta_read(pcap_t *p, struct file_meta *meta)
+{
+	struct pcap_pkthdr hdr;
+
+	meta->start_pos = ftell64(pcap_file(p));
+	if (meta->start_pos < 0 || pcap_next(p, &hdr) == NULL)
+		return 0;
+	TIMEVAL_FROM_PKTHDR_TS(meta->start_time, hdr.ts);
+
+	if (! sf_find_end(p, pcap_snapshot(p), &meta->start_time,
+			  &meta->stop_time, NULL) ||
+	    (meta->stop_pos = ftell64(pcap_file(p))) < 0)
+		return 0;
+
+	meta->packets = sf_estimate_packets(p, pcap_snapshot(p),
+					    &meta->start_time, meta->start_pos,
+					    meta->stop_pos, ESTIMATE_SAMPLES);
+	return 1;
+}
+
+/* Make sure the cache entry of the given file is current, computing the
+ * metadata the same way tcpslice_open() does.  A file that is not a usable
+ * pcap file is just left out.  Return 1 if the file has a current entry.
+ */
+int
+cache_refresh_file(const char *filename)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct file_meta meta;
+	struct stat sb;
+	pcap_t *p;
+	int seekable, ok = 0;
+
+	if (stat(filename, &sb) < 0 || ! S_ISREG(sb.st_mode))
+		return 0;
+	if (cache_lookup(filename, &meta))
+		return 1;
+
+	if ((p = savefile_open(filename, &seekable, errbuf)) == NULL)
+		return 0;
+	if (! seekable) {
+		pcap_close(p);
+		return 0;
+	}
+
+	if (file_meta_read(p, &meta)) {
+		cache_store(filename, &sb, &meta);
+		ok = 1;
+	}
+
+	pcap_close(p);
+	return ok;
+}
+
+/* Refresh the entries of all the regular files in the given directory and
+ * return how many of them are usable pcap files, or -1 if the directory
+ * cannot be read.
+ */
+int
+cache_refresh_dir(const char *dirname)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int count = 0;
+
+	if ((dir = opendir(dirname)) == NULL)
+		return -1;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		if (snprintf(path, sizeof(path), "%s/%s", dirname, de->d_name) >=
+		    (int) sizeof(path))
+			continue;
+		count += cache_refresh_file(path);
+	}
+	closedir(dir);
+	return count;
+}
+
+/* Forget about the files that no longer exist. */
+void
+cache_prune(void)
+{
+	struct cache_entry **ep, *e;
+	struct stat sb;
+	unsigned int i;
+
+	cache_lock();
+	for (i = 0; i < CACHE_BUCKETS; i++)
+		for (ep = &cache_table[i]; (e = *ep) != NULL; ) {
+			if (stat(e->path, &sb) == 0) {
+				ep = &e->next;
+				continue;
+			}
+			*ep = e->next;
+			free(e->path);
+			free(e);
+			--cache_entries;
+			cache_changed = 1;
+		}
+	cache_unlock();
+}
+
+/* Load the entries saved by cache_save() to the given file, which need
+ * not exist.  Lines that cannot be parsed are skipped.  Return the number
+ * of entries loaded, or -1 with errno set if the file cannot be read.
+ */
+int
+cache_load(const char *filename)
+{
+	char line[PATH_MAX + 256], *tab;
+	struct file_meta meta;
+	struct stat sb;
+	uint64_t dev, ino;
+	int64_t size, mtime, start_sec, stop_sec;
+	long start_usec, stop_usec;
+	FILE *f;
+	int count = 0;
+
+	if ((f = fopen(filename, "r")) == NULL)
+		return errno == ENOENT ? 0 : -1;
+	if (fgets(line, sizeof(line), f) == NULL ||
+	    strcmp(line, CACHE_FILE_MAGIC "\n") != 0) {
+		fclose(f);
+		return 0;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+	memset(&meta, 0, sizeof(meta));
+	cache_lock();
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((tab = strchr(line, '\t')) == NULL || line[0] != '/')
+			continue;
+		*tab = '\0';
+		if (sscanf(tab + 1, "%" SCNu64 " %" SCNu64 " %" SCNd64 " %"
+			   SCNd64 " %" SCNd64 " %ld %" SCNd64 " %ld %" SCNd64
+			   " %" SCNd64 " %" SCNd64, &dev, &ino, &size, &mtime,
+			   &start_sec, &start_usec, &stop_sec, &stop_usec,
+			   &meta.start_pos, &meta.stop_pos, &meta.packets) != 11)
+			continue;
+		sb.st_dev = (dev_t) dev;
+		sb.st_ino = (ino_t) ino;
+		sb.st_size = (off_t) size;
+		sb.st_mtime = (time_t) mtime;
+		meta.start_time.tv_sec = (time_t) start_sec;
+		meta.start_time.tv_usec = start_usec;
+		meta.stop_time.tv_sec = (time_t) stop_sec;
+		meta.stop_time.tv_usec = stop_usec;
+		cache_set(line, &sb, &meta);
+		++count;
+	}
+	cache_changed = 0;
+	cache_unlock();
+	fclose(f);
+	return count;
+}
+
+/* Save the entries to the given file, if they changed since they were
+ * loaded, through a temporary file renamed over it so that a run that is
+ * interrupted leaves the previous one.  Return 0 on success, or -1 with
+ * errno set.
+ */
+int
+cache_save(const char *filename)
+{
+	char tmpname[PATH_MAX];
+	const struct cache_entry *e;
+	unsigned int i;
+	FILE *f;
+	int status = 0;
+
+	cache_lock();
+	if (! cache_changed) {
+		cache_unlock();
+		return 0;
+	}
+	if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename) >=
+	    (int) sizeof(tmpname)) {
+		cache_unlock();
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ((f = fopen(tmpname, "w")) == NULL) {
+		cache_unlock();
+		return -1;
+	}
+	fprintf(f, "%s\n", CACHE_FILE_MAGIC);
+	for (i = 0; i < CACHE_BUCKETS; i++)
+		for (e = cache_table[i]; e != NULL; e = e->next) {
+			/* A name the line format cannot hold is left out. */
+			if (strpbrk(e->path, "\t\n") != NULL)
+				continue;
+			fprintf(f, "%s\t%" PRIu64 " %" PRIu64 " %" PRId64 " %"
+				PRId64 " %" PRId64 " %ld %" PRId64 " %ld %" PRId64
+				" %" PRId64 " %" PRId64 "\n", e->path,
+				(uint64_t) e->dev, (uint64_t) e->ino,
+				(int64_t) e->size, (int64_t) e->mtime,
+				(int64_t) e->meta.start_time.tv_sec,
+				(long) e->meta.start_time.tv_usec,
+				(int64_t) e->meta.stop_time.tv_sec,
+				(long) e->meta.stop_time.tv_usec,
+				e->meta.start_pos, e->meta.stop_pos,
+				e->meta.packets);
+		}
+	if (ferror(f))
+		status = -1;
+	if (fclose(f) != 0)
+		status = -1;
+	if (status == 0 && rename(tmpname, filename) < 0)
+		status = -1;
+	if (status < 0)
+		(void) unlink(tmpname);
+	else
+		cache_changed = 0;
+	cache_unlock();
+	return status;
+}
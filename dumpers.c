@@ -0,0 +1,697 @@
+/*
+ * Copyright (c) 2020, 2021, 2023, 2024, 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ * Copyright (c) 2006
+ *	Sebastien Raveau <sebastien.raveau@epita.fr>.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * This file contains the code for the PCAP files that tracked sessions
+ * are extracted to with -f, which is shared by sessions.c (libnids) and
+ * flows.c (the built-in tracker):
+ *  - dumpers_init() has to be called each time we change PCAP file
+ *  - dumpers_split() makes as many sets of files as threads writing to
+ *    them, each with its share of the limits of -m and -M
+ *  - dumper_open() creates the file of a primary session, which its
+ *    subsessions share with dumper_share(), and dumper_close() drops a
+ *    reference to it
+ *  - dumper_get() returns the open file to write a frame to, or
+ *    dumper_buffer() keeps the frame in memory for later with -M
+ *  - dumpers_lookback_end() gets the files written once the lookback
+ *    before the range (-b) is over
+ *  - dumpers_exit() waits for the buffered frames to be written and
+ *    reports with -v
+ *
+ * During the lookback, frames are only buffered, whether with -M or not:
+ * the sessions that end before the range are dropped along with their
+ * frames, and only the others get a file.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_PTHREADS
+# include <pthread.h>
+#endif /* HAVE_PTHREADS */
+
+#include "varattrs.h"
+#include "sessions.h"
+
+/*
+ * Structure used by sessions and subsessions to safely share
+ * the same file descriptor, when they have to be saved in the
+ * same PCAP file and can be closed in a different order than
+ * they were opened. The file name is made from `type' (the
+ * name of the type of the primary session in lowercase) and `id'
+ * whenever the file has to be opened, rather than kept for the
+ * whole life of the file. `created' tells whether the file has been
+ * created yet, so as to append to it if it has to be reopened.
+ * The open ones are also in a list from the most to the least
+ * recently written, through `lru_prev' and `lru_next', to pick
+ * the one to close when too many are open. With buffering, the
+ * packets not written yet are in `buf' (a struct pcap_pkthdr and
+ * the data of each), and the ones with such packets are in a list
+ * through `buf_prev' and `buf_next'. These lists are those of the
+ * `set' of files the dumper belongs to.
+ */
+struct shared_dumper
+{
+  struct dumper_set		*set;
+  const char			*type;
+  uint32_t			id;
+  pcap_dumper_t			*filedesc;
+  uint32_t			references;
+  int				created;
+  struct shared_dumper		*lru_prev;
+  struct shared_dumper		*lru_next;
+  u_char			*buf;
+  size_t			buf_len;
+  size_t			buf_size;
+  struct shared_dumper		*buf_prev;
+  struct shared_dumper		*buf_next;
+};
+
+/*
+ * The files written to by one thread, which only that thread (or the
+ * writer thread, with buffering) may touch. A set counts how many of
+ * its files are open, to stay below its share `max_files' of
+ * sessions_max_open_files or to cope with the "Too many open files"
+ * errors by closing the least recently written ones, and has the head
+ * and tail of the list of open ones. It also counts how many times a
+ * frame went to a file that was open, how many times a file had to be
+ * reopened and how many times one had to be closed.
+ *
+ * With buffering, it has the list of its files that have buffered
+ * packets and the total size of their buffers, which are handed over
+ * to be written out, biggest first, once that total reaches its share
+ * `buffer_size' of sessions_buffer_size.
+ */
+struct dumper_set
+{
+  unsigned int			fd_count;
+  unsigned int			max_files;
+  struct shared_dumper		*lru_head;
+  struct shared_dumper		*lru_tail;
+  uint64_t			hits;
+  uint64_t			reopens;
+  uint64_t			evictions;
+  struct shared_dumper		*buffered;
+  size_t			buffered_size;
+  uint32_t			buffered_count;
+  size_t			buffer_size;
+  char				*filename;
+  size_t			filename_size;
+};
+
+static struct dumper_set	*dumper_sets = NULL;
+static unsigned int		dumper_set_count = 0;
+
+/*
+ * The handle the PCAP files of sessions are opened with, which has the
+ * link type of the input files and stays open until dumpers_exit().
+ */
+static pcap_t			*dumper_pcap = NULL;
+
+/*
+ * Shared dumpers come from a slab, see slab_alloc().
+ */
+static struct slab		dumper_slab = { sizeof(struct shared_dumper), NULL, NULL, 0, 0, 0, 0 };
+
+/*
+ * With buffering and threads, the buffers handed over are written by
+ * `dumper_writer' in the background, for all the sets, and `dumper_jobs'
+ * is the queue of buffers for it to write, the size of which also counts
+ * against the buffer size of each set.
+ */
+#ifdef HAVE_PTHREADS
+struct dumper_job
+{
+  struct shared_dumper		*dumper;
+  u_char			*buf;
+  size_t			len;
+  size_t			size;
+  int				last;
+  struct dumper_job		*next;
+};
+
+static pthread_t		dumper_writer;
+static int			dumper_writer_running = 0;
+static pthread_mutex_t		dumper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		dumper_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t		dumper_written = PTHREAD_COND_INITIALIZER;
+static struct dumper_job	*dumper_jobs = NULL;
+static struct dumper_job	**dumper_jobs_tail = &dumper_jobs;
+static size_t			dumper_jobs_size = 0;
+static int			dumper_writer_quit = 0;
+#endif /* HAVE_PTHREADS */
+
+static int			dumper_evict(struct dumper_set *s);
+static void			dumper_unbuffer(struct shared_dumper *d);
+static void			dumper_hand_over(struct shared_dumper *d, const int last);
+static void			dumper_writer_stop(void);
+
+/*
+ * Shared dumpers are freed by the writer thread as well as by the
+ * threads tracking sessions.
+ */
+static struct shared_dumper *
+dumper_alloc(void)
+{
+  struct shared_dumper		*d;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&dumper_lock);
+#endif /* HAVE_PTHREADS */
+  d = (struct shared_dumper *) slab_alloc(&dumper_slab);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&dumper_lock);
+#endif /* HAVE_PTHREADS */
+  return d;
+}
+
+static void
+dumper_free(struct shared_dumper *d)
+{
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&dumper_lock);
+#endif /* HAVE_PTHREADS */
+  slab_free(&dumper_slab, d);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&dumper_lock);
+#endif /* HAVE_PTHREADS */
+}
+
+/*
+ * The name of the file of a shared dumper, in a buffer of its set that
+ * is reused.
+ */
+static const char *
+dumper_filename(const struct shared_dumper *d)
+{
+  struct dumper_set		*s = d->set;
+  size_t			need = strlen(sessions_file_format) + strlen(d->type) + 16;
+
+  if (need > s->filename_size) {
+    free(s->filename);
+    s->filename_size = need;
+    if (NULL == (s->filename = malloc(s->filename_size)))
+      error("malloc() failed in %s()", __func__);
+  }
+  sprintf(s->filename, sessions_file_format, d->type, d->id);
+  return s->filename;
+}
+
+struct shared_dumper *
+dumper_open(const char *type, const uint32_t id, const unsigned int set)
+{
+  struct shared_dumper		*d;
+
+  d = dumper_alloc();
+  d->set = &dumper_sets[set];
+  d->type = type;
+  d->id = id;
+  d->references = 1;
+  /*
+   * With buffering, the file is created when its first packets are
+   * written out, by the writer thread if there is one.
+   */
+  if (!sessions_buffer_size && !lookback_time)
+    dumper_get(d);
+  return d;
+}
+
+static void
+dumper_lru_unlink(struct shared_dumper *d)
+{
+  if (NULL != d->lru_prev)
+    d->lru_prev->lru_next = d->lru_next;
+  else
+    d->set->lru_head = d->lru_next;
+  if (NULL != d->lru_next)
+    d->lru_next->lru_prev = d->lru_prev;
+  else
+    d->set->lru_tail = d->lru_prev;
+}
+
+static void
+dumper_lru_push(struct shared_dumper *d)
+{
+  struct dumper_set		*s = d->set;
+
+  d->lru_prev = NULL;
+  d->lru_next = s->lru_head;
+  if (NULL != s->lru_head)
+    s->lru_head->lru_prev = d;
+  else
+    s->lru_tail = d;
+  s->lru_head = d;
+}
+
+/*
+ * Close the least recently written file of a set, if there is one and it
+ * can be reopened later without losing what was written to it.
+ */
+static int			dumper_evict(struct dumper_set *s)
+{
+#ifdef HAVE_PCAP_DUMP_OPEN_APPEND
+  struct shared_dumper		*d = s->lru_tail;
+
+  if (NULL == d)
+    return 0;
+  dumper_lru_unlink(d);
+  pcap_dump_close(d->filedesc);
+  d->filedesc = NULL;
+  --s->fd_count;
+  ++s->evictions;
+  return 1;
+#else
+  return 0;
+#endif /* HAVE_PCAP_DUMP_OPEN_APPEND */
+}
+
+/*
+ * The file is created when first opened and appended to when reopened.
+ */
+pcap_dumper_t			*dumper_get(struct shared_dumper *d)
+{
+  struct dumper_set		*s = d->set;
+  const char			*filename;
+
+  if (NULL != d->filedesc) {
+    ++s->hits;
+    if (d != s->lru_head) {
+      dumper_lru_unlink(d);
+      dumper_lru_push(d);
+    }
+    return d->filedesc;
+  }
+
+  while (s->max_files && s->fd_count >= s->max_files)
+    if (!dumper_evict(s))
+      break;
+  filename = dumper_filename(d);
+  for (;;) {
+#ifdef HAVE_PCAP_DUMP_OPEN_APPEND
+    if (d->created)
+      d->filedesc = pcap_dump_open_append(dumper_pcap, filename);
+    else
+#endif /* HAVE_PCAP_DUMP_OPEN_APPEND */
+      d->filedesc = pcap_dump_open(dumper_pcap, filename);
+    if (NULL != d->filedesc)
+      break;
+    if (EMFILE != errno || !dumper_evict(s))
+      error("%s(): %s: %s", __func__,
+	  filename,
+	  pcap_geterr(dumper_pcap));
+  }
+  if (d->created)
+    ++s->reopens;
+  d->created = 1;
+  ++s->fd_count;
+  dumper_lru_push(d);
+  return d->filedesc;
+}
+
+/*
+ * Close the file for good, once nothing refers to it any more.
+ */
+static void
+dumper_release(struct shared_dumper *d)
+{
+  if (NULL != d->filedesc) {
+    dumper_lru_unlink(d);
+    pcap_dump_close(d->filedesc);
+    --d->set->fd_count;
+  }
+  dumper_free(d);
+}
+
+/*
+ * The file of a primary session is the file of its subsessions too.
+ */
+struct shared_dumper *
+dumper_share(struct shared_dumper *d)
+{
+  if (NULL != d)
+    d->references++;
+  return d;
+}
+
+void				dumper_close(struct shared_dumper *d)
+{
+  if (NULL == d)
+    return;
+  --d->references;
+  if (!d->references) {
+    if (lookback_time) {
+      dumper_unbuffer(d);
+      free(d->buf);
+      dumper_free(d);
+    } else if (sessions_buffer_size)
+      dumper_hand_over(d, 1);
+    else
+      dumper_release(d);
+  }
+}
+
+/*
+ * Write out buffered packets, and free the buffer.
+ */
+static void
+dumper_write(struct shared_dumper *d, u_char *buf, const size_t len)
+{
+  pcap_dumper_t			*p = dumper_get(d);
+  struct pcap_pkthdr		ph;
+  size_t			pos = 0;
+
+  while (pos < len) {
+    memcpy(&ph, buf + pos, sizeof(ph));
+    pos += sizeof(ph);
+    pcap_dump((u_char *)p, &ph, buf + pos);
+    pos += ph.caplen;
+  }
+  free(buf);
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+dumper_writer_main(void *arg _U_)
+{
+  struct dumper_job		*job;
+
+  pthread_mutex_lock(&dumper_lock);
+  for (;;) {
+    while (NULL == dumper_jobs && !dumper_writer_quit)
+      pthread_cond_wait(&dumper_queued, &dumper_lock);
+    if (NULL == (job = dumper_jobs))
+      break;
+    if (NULL == (dumper_jobs = job->next))
+      dumper_jobs_tail = &dumper_jobs;
+    pthread_mutex_unlock(&dumper_lock);
+
+    dumper_write(job->dumper, job->buf, job->len);
+    if (job->last)
+      dumper_release(job->dumper);
+
+    pthread_mutex_lock(&dumper_lock);
+    dumper_jobs_size -= job->size;
+    pthread_cond_broadcast(&dumper_written);
+    free(job);
+  }
+  pthread_mutex_unlock(&dumper_lock);
+  return NULL;
+}
+#endif /* HAVE_PTHREADS */
+
+/*
+ * Take a file out of the list of the ones with buffered packets.
+ */
+static void
+dumper_unbuffer(struct shared_dumper *d)
+{
+  struct dumper_set		*s = d->set;
+
+  if (NULL == d->buf)
+    return;
+  if (NULL != d->buf_prev)
+    d->buf_prev->buf_next = d->buf_next;
+  else
+    s->buffered = d->buf_next;
+  if (NULL != d->buf_next)
+    d->buf_next->buf_prev = d->buf_prev;
+  s->buffered_size -= d->buf_size;
+  --s->buffered_count;
+}
+
+/*
+ * Take the buffered packets of a file, and the file itself if `last' is
+ * set, from the thread tracking its session and get them written out, in
+ * the background if possible.
+ */
+static void
+dumper_hand_over(struct shared_dumper *d, const int last)
+{
+  u_char			*buf = d->buf;
+  size_t			len = d->buf_len;
+  size_t			size = d->buf_size;
+#ifdef HAVE_PTHREADS
+  struct dumper_job		*job;
+#endif /* HAVE_PTHREADS */
+
+  dumper_unbuffer(d);
+  d->buf = NULL;
+  d->buf_len = d->buf_size = 0;
+#ifdef HAVE_PTHREADS
+  if (NULL == (job = malloc(sizeof(struct dumper_job))))
+    error("malloc() failed in %s()", __func__);
+  job->dumper = d;
+  job->buf = buf;
+  job->len = len;
+  job->size = size;
+  job->last = last;
+  job->next = NULL;
+  pthread_mutex_lock(&dumper_lock);
+  if (!dumper_writer_running) {
+    dumper_writer_running =
+	!pthread_create(&dumper_writer, NULL, dumper_writer_main, NULL);
+  }
+  if (dumper_writer_running) {
+    *dumper_jobs_tail = job;
+    dumper_jobs_tail = &job->next;
+    dumper_jobs_size += size;
+    pthread_cond_signal(&dumper_queued);
+    pthread_mutex_unlock(&dumper_lock);
+    return;
+  }
+  pthread_mutex_unlock(&dumper_lock);
+  free(job);
+#endif /* HAVE_PTHREADS */
+  dumper_write(d, buf, len);
+  if (last)
+    dumper_release(d);
+}
+
+static void
+dumper_writer_stop(void)
+{
+#ifdef HAVE_PTHREADS
+  if (!dumper_writer_running)
+    return;
+  pthread_mutex_lock(&dumper_lock);
+  dumper_writer_quit = 1;
+  pthread_cond_signal(&dumper_queued);
+  pthread_mutex_unlock(&dumper_lock);
+  pthread_join(dumper_writer, NULL);
+  dumper_writer_running = 0;
+  dumper_writer_quit = 0;
+#endif /* HAVE_PTHREADS */
+}
+
+static int
+dumper_size_cmp(const void *a, const void *b)
+{
+  size_t			size_a = (*(struct shared_dumper *const *)a)->buf_size;
+  size_t			size_b = (*(struct shared_dumper *const *)b)->buf_size;
+
+  return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+/*
+ * Hand the biggest buffers of a set over until half of its buffer size
+ * is free, then wait for the background writes to leave room for that.
+ */
+static void
+dumper_make_room(struct dumper_set *s)
+{
+  struct shared_dumper		**by_size;
+  struct shared_dumper		*d;
+  uint32_t			i = 0;
+
+  by_size = malloc(s->buffered_count * sizeof(struct shared_dumper *));
+  if (NULL == by_size)
+    error("malloc() failed in %s()", __func__);
+  for (d = s->buffered; NULL != d; d = d->buf_next)
+    by_size[i++] = d;
+  qsort(by_size, i, sizeof(struct shared_dumper *), dumper_size_cmp);
+  for (i = 0; s->buffered_size > s->buffer_size / 2; ++i)
+    dumper_hand_over(by_size[i], 0);
+  free(by_size);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&dumper_lock);
+  while (s->buffered_size + dumper_jobs_size > s->buffer_size &&
+	 dumper_jobs_size)
+    pthread_cond_wait(&dumper_written, &dumper_lock);
+  pthread_mutex_unlock(&dumper_lock);
+#endif /* HAVE_PTHREADS */
+}
+
+/*
+ * Buffer a frame made of `head_len' bytes at `head' and the rest at `data'.
+ */
+void
+dumper_buffer(struct shared_dumper *d, const struct pcap_pkthdr *ph,
+	      const u_char *head, const u_int head_len, const u_char *data)
+{
+  struct dumper_set		*s = d->set;
+  size_t			need = d->buf_len + sizeof(*ph) + ph->caplen;
+  size_t			size;
+  u_char			*buf;
+
+  if (need > d->buf_size) {
+    for (size = d->buf_size ? d->buf_size : 4096; size < need; size *= 2)
+      ;
+    if (NULL == (buf = realloc(d->buf, size)))
+      error("realloc() failed in %s()", __func__);
+    if (NULL == d->buf) {
+      d->buf_prev = NULL;
+      d->buf_next = s->buffered;
+      if (NULL != s->buffered)
+	s->buffered->buf_prev = d;
+      s->buffered = d;
+      ++s->buffered_count;
+    }
+    s->buffered_size += size - d->buf_size;
+    d->buf = buf;
+    d->buf_size = size;
+  }
+  memcpy(d->buf + d->buf_len, ph, sizeof(*ph));
+  memcpy(d->buf + d->buf_len + sizeof(*ph), head, head_len);
+  memcpy(d->buf + d->buf_len + sizeof(*ph) + head_len, data, ph->caplen - head_len);
+  d->buf_len = need;
+  if (s->buffered_size > s->buffer_size && !lookback_time)
+    dumper_make_room(s);
+}
+
+void				dumpers_init(pcap_t *p)
+{
+  /*
+   * The input files are closed as soon as they have been read, so the
+   * PCAP files of sessions need a handle of their own, with the biggest
+   * snapshot length of all.
+   */
+  if (NULL == dumper_pcap || pcap_snapshot(p) > pcap_snapshot(dumper_pcap)) {
+    if (NULL != dumper_pcap)
+      pcap_close(dumper_pcap);
+    if (NULL == (dumper_pcap = pcap_open_dead(pcap_datalink(p), pcap_snapshot(p))))
+      error("pcap_open_dead() failed in %s()", __func__);
+  }
+  if (NULL == dumper_sets)
+    dumpers_split(1);
+}
+
+/*
+ * Replace the sets of files, which must not have any file yet, with `n'
+ * sets that share the limits of -m and -M evenly.
+ */
+void				dumpers_split(const unsigned int n)
+{
+  unsigned int			i;
+
+  for (i = 0; i < dumper_set_count; ++i)
+    free(dumper_sets[i].filename);
+  free(dumper_sets);
+  if (NULL == (dumper_sets = calloc(n, sizeof(struct dumper_set))))
+    error("calloc() failed in %s()", __func__);
+  dumper_set_count = n;
+  /* Every set needs at least one file open to write to. */
+  if (NULL != sessions_file_format && sessions_max_open_files &&
+      sessions_max_open_files < n)
+    error("-m %u leaves less than one open file to each of the %u threads"
+	" tracking sessions (see -j)", sessions_max_open_files, n);
+  for (i = 0; i < n; ++i) {
+    if (sessions_max_open_files)
+      dumper_sets[i].max_files = sessions_max_open_files / n;
+    dumper_sets[i].buffer_size = sessions_buffer_size > n ?
+	sessions_buffer_size / n : sessions_buffer_size;
+  }
+}
+
+/*
+ * Once the range starts, write out what the sessions still open buffered
+ * during the lookback: right away without -M, as frames are written
+ * straight to the files from now on, or as usual with it.
+ */
+void				dumpers_lookback_end(void)
+{
+  struct dumper_set		*s;
+  struct shared_dumper		*d;
+  unsigned int			i;
+  u_char			*buf;
+  size_t			len;
+
+  for (i = 0; i < dumper_set_count; ++i) {
+    s = &dumper_sets[i];
+    if (sessions_buffer_size) {
+      if (s->buffered_size > s->buffer_size)
+	dumper_make_room(s);
+      continue;
+    }
+    while (NULL != (d = s->buffered)) {
+      buf = d->buf;
+      len = d->buf_len;
+      dumper_unbuffer(d);
+      d->buf = NULL;
+      d->buf_len = d->buf_size = 0;
+      dumper_write(d, buf, len);
+    }
+  }
+}
+
+void				dumpers_exit(void)
+{
+  uint64_t			hits = 0;
+  uint64_t			reopens = 0;
+  uint64_t			evictions = 0;
+  unsigned int			i;
+
+  dumper_writer_stop();
+  for (i = 0; i < dumper_set_count; ++i) {
+    hits += dumper_sets[i].hits;
+    reopens += dumper_sets[i].reopens;
+    evictions += dumper_sets[i].evictions;
+    free(dumper_sets[i].filename);
+  }
+  free(dumper_sets);
+  dumper_sets = NULL;
+  dumper_set_count = 0;
+  if (verbose && NULL != sessions_file_format)
+    printf("Session files: %" PRIu64 " files (%" PRIu64 " at most at a time) in %u slabs, %" PRIu64 " writes to open files, %" PRIu64 " reopened, %" PRIu64 " closed to stay below the limit\n",
+	dumper_slab.allocs, dumper_slab.max_in_use, dumper_slab.chunk_count,
+	hits, reopens, evictions);
+  slab_destroy(&dumper_slab);
+  if (NULL != dumper_pcap) {
+    pcap_close(dumper_pcap);
+    dumper_pcap = NULL;
+  }
+}
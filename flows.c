@@ -0,0 +1,1309 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The built-in tracker of TCP and UDP sessions, which tcpslice uses with
+ * -n or when it was built without libnids.  It takes the addresses and
+ * ports of each packet straight from the frame, over Ethernet (with VLAN
+ * tags), Linux cooked, BSD loopback and raw IP link layers, for IPv6 as
+ * well as IPv4, and reassembles neither IP fragments nor TCP streams,
+ * which splitting a capture into sessions does not need.  The fragments
+ * of IP packets other than the first one are not part of any session.
+ *
+ * A TCP session starts with a SYN, which has 60 seconds to lead to an
+ * established connection, and ends once both FINs have been acknowledged
+ * or with a RST.  A UDP session starts with any datagram and ends once it
+ * has been idle for the expiration delay of -e, or for 60 seconds without
+ * one.  The expiration delay ends idle TCP sessions too.
+ *
+ * Sessions are numbered, reported and extracted to files the same way as
+ * the ones libnids finds in sessions.c.
+ *
+ * With threads (sessions_threads, from -j), the flows are split into
+ * shards by a hash of their key, which is the same for both directions,
+ * and each shard has a thread of its own, with its table, its timeouts
+ * and its set of files.  The main thread reads and parses the packets and
+ * hands them over in batches; each thread follows the flows of its shard
+ * through the batch, noting which sessions it opened and closed, then the
+ * main thread merges these notes in packet order to number and report the
+ * sessions exactly as a single thread would, and each thread writes the
+ * packets of its shard to the files of their sessions in order while the
+ * next batch is tracked.  A session never depends on another one here, so
+ * no shard has anything to hand over to another.
+ */
+
+#include <config.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "tcpslice.h"
+#include "sessions.h"
+
+#define FLOW_HANDSHAKE_DELAY	60	/* seconds to establish a TCP connection */
+#define FLOW_IDLE_DELAY		60	/* seconds of idle UDP without -e */
+
+#define FLOW_BATCH_PACKETS	4096	/* packets handed to the threads at once */
+#define FLOW_BATCH_BYTES	(1024 * 1024)	/* or bytes of packets */
+#define FLOW_BATCHES		3	/* filled, tracked and written at once */
+
+#define ETHERTYPE_IPV4		0x0800
+#define ETHERTYPE_IPV6		0x86dd
+#define ETHERTYPE_8021Q		0x8100
+#define ETHERTYPE_8021AD	0x88a8
+#define ETHERTYPE_QINQ		0x9100
+
+enum flow_type {
+	FLOW_TCP = 0x01,
+	FLOW_UDP = 0x02
+};
+
+/* The addresses and ports of both ends of a flow, the lowest end first,
+ * so that the packets of both directions have the same key.  An IPv4
+ * address takes the first 4 bytes of its `addr' and the rest is zero.
+ */
+struct flow_key {
+	u_char		addr[2][16];
+	uint16_t	port[2];
+	uint8_t		version;	/* of IP */
+	uint8_t		proto;		/* IPPROTO_TCP or IPPROTO_UDP */
+};
+
+/* What flow_parse() finds in a packet. */
+struct flow_packet {
+	struct flow_key	key;
+	int		from;		/* the end of the key that sent it */
+	uint8_t		tcp_flags;
+	uint32_t	seq;
+	uint32_t	ack;
+	uint32_t	payload;	/* bytes of TCP or UDP data */
+};
+
+/* The flows that time out after the same delay, in the order they do:
+ * as packets come in time order, a flow whose timeout is pushed back
+ * goes to the tail, and the flows at the head are the first ones due.
+ */
+struct flow_queue {
+	time_t		delay;
+	struct flow	*head;
+	struct flow	*tail;
+};
+
+struct flow {
+	struct flow_key	key;
+	uint32_t	hash;		/* of the key */
+	uint32_t	id;
+	enum flow_type	type;
+	int		client;		/* the end of the key that started it */
+	u_int		state;		/* FLOW_* flags below */
+	uint32_t	fin_seq[2];	/* of the FIN of each end */
+	struct timeval	lastseen;
+	uint64_t	bytes;		/* of TCP or UDP data */
+	struct shared_dumper *dumper;
+	struct flow	*hash_next;
+	struct flow_queue *queue;	/* NULL if it does not time out */
+	time_t		timeout;
+	uint64_t	queued;		/* the number of the packet that did it */
+	struct flow	*queue_prev;
+	struct flow	*queue_next;
+};
+
+#define FLOW_SYNACK		0x01	/* the server answered the SYN */
+#define FLOW_ESTABLISHED	0x02	/* and the client acknowledged it */
+#define FLOW_FIN(end)		(0x04 << (end))	/* the end sent a FIN */
+#define FLOW_FIN_ACKED(end)	(0x10 << (end))	/* which was acknowledged */
+
+/* A session opened or closed by a thread during a batch, for the main
+ * thread to report.  The events of a packet come in the order of their
+ * "order" and then of their "queued": first the sessions that expired
+ * without completing their handshake and then the idle ones, each in
+ * the order they were queued in, then the opening and the closing of the
+ * session of the packet itself.  That is the order a single thread meets
+ * them in.
+ */
+struct flow_event {
+	uint32_t	entry;		/* the packet in the batch */
+	uint32_t	order;		/* FLOW_EVENT_* below */
+	uint64_t	queued;
+	struct flow	*flow;
+};
+
+#define FLOW_EVENT_HANDSHAKE	0	/* expired during the handshake */
+#define FLOW_EVENT_IDLE		1	/* expired while idle */
+#define FLOW_EVENT_OPENED	2
+#define FLOW_EVENT_CLOSED	3
+
+/* The part of the flows that a thread tracks, with everything needed to
+ * track them, which no other thread touches while it runs.  With threads,
+ * the flows it closes stay in "closed" until their packets are written.
+ */
+struct flow_shard {
+	u_int		index;		/* also that of its set of files */
+	struct flow	**table;	/* by hash of their key */
+	uint32_t	table_size;	/* a power of 2 that grows with count */
+	uint32_t	count;
+	struct flow_queue handshake_queue;
+	struct flow_queue idle_queue;
+	struct slab	slab;		/* of flows, see slab_alloc() */
+	struct timeval	now;		/* the time of the packet being tracked */
+	uint64_t	packet;		/* and its number */
+	struct flow_event *events;	/* of the batch being tracked */
+	uint32_t	event_count;
+	uint32_t	event_size;
+	uint32_t	event_next;	/* to report */
+	struct flow	*closed;	/* through hash_next */
+#ifdef HAVE_PTHREADS
+	pthread_t	thread;
+#endif
+};
+
+/* A packet handed to the threads, with what the main thread found out
+ * about it.  Its data are only kept if they have to be written.
+ */
+struct flow_entry {
+	struct pcap_pkthdr hdr;
+	struct timeval	ts;
+	time_t		expire;		/* the sessions due then */
+	int		shard;		/* -1 if not tracked */
+	uint32_t	hash;
+	struct flow_packet fp;
+	size_t		offset;		/* of the data in the batch */
+	struct flow	*flow;		/* set by the thread of the shard */
+};
+
+struct flow_batch {
+	struct flow_entry *entries;
+	uint32_t	count;
+	uint64_t	first;		/* number of the first packet */
+	u_char		*data;
+	size_t		len;
+	size_t		size;
+};
+
+static u_int flow_track_types;
+
+static struct flow_shard *flow_shards;	/* NULL until the first packet */
+static u_int flow_shard_count;
+static int flow_threads;		/* each shard has its thread */
+
+static uint32_t flow_counter;
+static uint32_t flow_peak;		/* of sessions_count */
+
+/* The time and the number of packets tracked so far. */
+static struct timeval flow_now;
+static uint64_t flow_packets;
+
+#ifdef HAVE_PTHREADS
+/* The main thread fills a batch while the threads write the packets of
+ * the previous batch and then track the packets of the one before, so
+ * batches take turns at the three.  Each of these steps starts with
+ * flow_step_start() and ends with flow_step_end().
+ */
+static struct flow_batch flow_batches[FLOW_BATCHES];
+static u_int flow_filling;
+static struct flow_batch *flow_tracked;	/* by the running step */
+static int flow_running;
+
+static pthread_mutex_t flow_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flow_go = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t flow_done = PTHREAD_COND_INITIALIZER;
+static uint64_t flow_step;
+static u_int flow_busy;			/* threads still in the step */
+static int flow_quit;
+static struct flow_batch *flow_step_write;
+static struct flow_batch *flow_step_track;
+#endif /* HAVE_PTHREADS */
+
+static uint16_t
+get_be16(const u_char *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t
+get_be32(const u_char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3];
+}
+
+static const char *
+flow_type_name(const enum flow_type type, const int upper)
+{
+	if (type == FLOW_TCP)
+		return upper ? "TCP" : "tcp";
+	return upper ? "UDP" : "udp";
+}
+
+/* The key of a fragment of an IP packet, which has the addresses alone,
+ * the lowest first, as only the first fragment has the ports.
+ */
+static void
+flow_fragment_key(struct flow_key *key, const u_int version,
+		  const u_char *src, const u_char *dst, const size_t alen)
+{
+	int from = memcmp(src, dst, alen) > 0;
+
+	memset(key, 0, sizeof(*key));
+	key->version = (uint8_t)version;
+	memcpy(key->addr[from], src, alen);
+	memcpy(key->addr[!from], dst, alen);
+}
+
+/* Find the TCP or UDP header of a frame of link type "dlt" and fill in
+ * "fp".  Returns 0 if the frame is not a TCP or UDP packet, or is too
+ * short to tell.  If "frag" is not NULL, any fragment of an IP packet,
+ * the first one included, fills in "frag" with flow_fragment_key() and
+ * returns -1 instead.
+ */
+static int
+flow_parse(const int dlt, const struct pcap_pkthdr *h, const u_char *pkt,
+	   struct flow_packet *fp, struct flow_key *frag)
+{
+	const u_char *p = pkt;
+	const u_char *end = pkt + h->caplen;
+	const u_char *src, *dst;
+	u_int ethertype = 0;	/* none, go by the IP version */
+	u_int version, hlen, len, nh;
+	uint16_t sport, dport;
+	size_t alen;
+	int cmp;
+
+	switch (dlt) {
+
+	case DLT_EN10MB:
+		if (end - p < 14)
+			return 0;
+		ethertype = get_be16(p + 12);
+		p += 14;
+		while (ethertype == ETHERTYPE_8021Q ||
+		       ethertype == ETHERTYPE_8021AD ||
+		       ethertype == ETHERTYPE_QINQ) {
+			if (end - p < 4)
+				return 0;
+			ethertype = get_be16(p + 2);
+			p += 4;
+		}
+		break;
+
+#ifdef DLT_LINUX_SLL
+	case DLT_LINUX_SLL:
+		if (end - p < 16)
+			return 0;
+		ethertype = get_be16(p + 14);
+		p += 16;
+		break;
+#endif
+
+#ifdef DLT_LINUX_SLL2
+	case DLT_LINUX_SLL2:
+		if (end - p < 20)
+			return 0;
+		ethertype = get_be16(p);
+		p += 20;
+		break;
+#endif
+
+	case DLT_NULL:
+#ifdef DLT_LOOP
+	case DLT_LOOP:
+#endif
+		/* The address family, the values and byte order of which
+		 * depend on the system that wrote the file.
+		 */
+		if (end - p < 4)
+			return 0;
+		p += 4;
+		break;
+
+	case DLT_RAW:
+#ifdef DLT_IPV4
+	case DLT_IPV4:
+#endif
+#ifdef DLT_IPV6
+	case DLT_IPV6:
+#endif
+		break;
+
+	default:
+		return 0;
+	}
+	if (ethertype != 0 && ethertype != ETHERTYPE_IPV4 &&
+	    ethertype != ETHERTYPE_IPV6)
+		return 0;
+	if (p >= end)
+		return 0;
+
+	version = p[0] >> 4;
+	switch (version) {
+
+	case 4:
+		if (end - p < 20)
+			return 0;
+		hlen = (p[0] & 0x0f) * 4;
+		len = get_be16(p + 2);
+		if (hlen < 20 || len < hlen || end - p < (ptrdiff_t)hlen)
+			return 0;
+		nh = p[9];
+		src = p + 12;
+		dst = p + 16;
+		alen = 4;
+		/* More fragments, or not the first one. */
+		if (frag != NULL && (get_be16(p + 6) & 0x3fff)) {
+			flow_fragment_key(frag, version, src, dst, alen);
+			return -1;
+		}
+		/* Only the first fragment has the ports. */
+		if (get_be16(p + 6) & 0x1fff)
+			return 0;
+		p += hlen;
+		len -= hlen;
+		break;
+
+	case 6:
+		if (end - p < 40)
+			return 0;
+		len = get_be16(p + 4);
+		nh = p[6];
+		src = p + 8;
+		dst = p + 24;
+		alen = 16;
+		p += 40;
+		/* Skip the extension headers that may come before the
+		 * TCP or UDP header.
+		 */
+		while (nh == IPPROTO_HOPOPTS || nh == IPPROTO_ROUTING ||
+		       nh == IPPROTO_DSTOPTS || nh == IPPROTO_FRAGMENT ||
+		       nh == IPPROTO_AH) {
+			if (end - p < 8)
+				return 0;
+			if (nh == IPPROTO_FRAGMENT) {
+				if (frag != NULL) {
+					flow_fragment_key(frag, version,
+							  src, dst, alen);
+					return -1;
+				}
+				if (get_be16(p + 2) & 0xfff8)
+					return 0;
+				hlen = 8;
+			} else if (nh == IPPROTO_AH)
+				hlen = (p[1] + 2) * 4;
+			else
+				hlen = (p[1] + 1) * 8;
+			if (end - p < (ptrdiff_t)hlen || len < hlen)
+				return 0;
+			nh = p[0];
+			p += hlen;
+			len -= hlen;
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	/* "len" is what the IP header says, the packet may have been
+	 * captured short of it.
+	 */
+	switch (nh) {
+
+	case IPPROTO_TCP:
+		if (end - p < 20)
+			return 0;
+		hlen = (p[12] >> 4) * 4;
+		fp->tcp_flags = p[13];
+		fp->seq = get_be32(p + 4);
+		fp->ack = get_be32(p + 8);
+		fp->payload = len > hlen ? len - hlen : 0;
+		break;
+
+	case IPPROTO_UDP:
+		if (end - p < 8)
+			return 0;
+		len = get_be16(p + 4);
+		fp->tcp_flags = 0;
+		fp->payload = len > 8 ? len - 8 : 0;
+		break;
+
+	default:
+		return 0;
+	}
+	sport = get_be16(p);
+	dport = get_be16(p + 2);
+
+	memset(&fp->key, 0, sizeof(fp->key));
+	fp->key.version = (uint8_t)version;
+	fp->key.proto = (uint8_t)nh;
+	cmp = memcmp(src, dst, alen);
+	fp->from = cmp > 0 || (cmp == 0 && sport > dport);
+	memcpy(fp->key.addr[fp->from], src, alen);
+	fp->key.port[fp->from] = sport;
+	memcpy(fp->key.addr[!fp->from], dst, alen);
+	fp->key.port[!fp->from] = dport;
+	return 1;
+}
+
+static uint32_t
+flow_hash(const struct flow_key *key)
+{
+	const u_char *p = (const u_char *)key;
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(*key); i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+
+static struct flow *
+flow_find(const struct flow_shard *s, const struct flow_key *key,
+	  const uint32_t hash)
+{
+	struct flow *f;
+
+	if (s->table == NULL)
+		return NULL;
+	for (f = s->table[hash & (s->table_size - 1)]; f != NULL;
+	     f = f->hash_next)
+		if (f->hash == hash && !memcmp(&f->key, key, sizeof(*key)))
+			return f;
+	return NULL;
+}
+
+static void
+flow_table_grow(struct flow_shard *s)
+{
+	struct flow **table;
+	struct flow *f, *next;
+	uint32_t size = s->table_size ? s->table_size * 2 : 1024;
+	uint32_t i;
+
+	table = calloc(size, sizeof(*table));
+	if (table == NULL)
+		error("calloc() failed in %s()", __func__);
+	for (i = 0; i < s->table_size; i++)
+		for (f = s->table[i]; f != NULL; f = next) {
+			next = f->hash_next;
+			f->hash_next = table[f->hash & (size - 1)];
+			table[f->hash & (size - 1)] = f;
+		}
+	free(s->table);
+	s->table = table;
+	s->table_size = size;
+}
+
+/* Move a flow to the tail of the queue "q", which makes it time out after
+ * the delay of the queue, or take it out of its queue if "q" is NULL.
+ */
+static void
+flow_set_queue(struct flow_shard *s, struct flow *f, struct flow_queue *q)
+{
+	if (f->queue != NULL) {
+		if (f->queue_prev != NULL)
+			f->queue_prev->queue_next = f->queue_next;
+		else
+			f->queue->head = f->queue_next;
+		if (f->queue_next != NULL)
+			f->queue_next->queue_prev = f->queue_prev;
+		else
+			f->queue->tail = f->queue_prev;
+	}
+	f->queue = q;
+	if (q == NULL)
+		return;
+	f->timeout = s->now.tv_sec + q->delay;
+	f->queued = s->packet;
+	f->queue_prev = q->tail;
+	f->queue_next = NULL;
+	if (q->tail != NULL)
+		q->tail->queue_next = f;
+	else
+		q->head = f;
+	q->tail = f;
+}
+
+/* Number and report sessions, in the order a single thread meets them. */
+static void
+flow_opened(struct flow *f, const struct timeval *ts)
+{
+	f->id = ++flow_counter;
+	if (++sessions_count > flow_peak)
+		flow_peak = sessions_count;
+	if (verbose)
+		printf("Session #%u (%s) opened at %s (active sessions total: %u)\n",
+		       f->id, flow_type_name(f->type, 1),
+		       timestamp_to_string(ts), sessions_count);
+}
+
+static void
+flow_closed(const struct flow *f, const struct timeval *ts)
+{
+	--sessions_count;
+	if (bonus_time || verbose)
+		printf("Session #%u (%s) closed at %s (active sessions total: %u)\n",
+		       f->id, flow_type_name(f->type, 1),
+		       timestamp_to_string(ts), sessions_count);
+}
+
+/* Report a session right away, or once the batch is over with threads. */
+static void
+flow_event(struct flow_shard *s, struct flow *f, const uint32_t entry,
+	   const uint32_t order)
+{
+	struct flow_event *ev;
+
+	if (!flow_threads) {
+		if (order == FLOW_EVENT_OPENED)
+			flow_opened(f, &s->now);
+		else
+			flow_closed(f, &s->now);
+		return;
+	}
+	if (s->event_count == s->event_size) {
+		s->event_size = s->event_size ? s->event_size * 2 : 256;
+		s->events = realloc(s->events,
+				    s->event_size * sizeof(*s->events));
+		if (s->events == NULL)
+			error("realloc() failed in %s()", __func__);
+	}
+	ev = &s->events[s->event_count++];
+	ev->entry = entry;
+	ev->order = order;
+	ev->queued = order < FLOW_EVENT_OPENED ? f->queued : 0;
+	ev->flow = f;
+}
+
+static struct flow *
+flow_add(struct flow_shard *s, const struct flow_packet *fp,
+	 const uint32_t hash, const enum flow_type type, const uint32_t entry)
+{
+	struct flow *f;
+	struct flow **bucket;
+
+	if (s->count >= s->table_size)
+		flow_table_grow(s);
+	f = slab_alloc(&s->slab);
+	f->key = fp->key;
+	f->hash = hash;
+	f->type = type;
+	/* Unless only the SYN+ACK was captured, whoever sent the first
+	 * packet is the client.
+	 */
+	if (type == FLOW_TCP && (fp->tcp_flags & TH_ACK))
+		f->client = !fp->from;
+	else
+		f->client = fp->from;
+	bucket = &s->table[hash & (s->table_size - 1)];
+	f->hash_next = *bucket;
+	*bucket = f;
+	++s->count;
+	flow_event(s, f, entry, FLOW_EVENT_OPENED);
+	return f;
+}
+
+static void
+flow_free(struct flow_shard *s, struct flow *f)
+{
+	dumper_close(f->dumper);
+	slab_free(&s->slab, f);
+}
+
+static void
+flow_del(struct flow_shard *s, struct flow *f, const uint32_t entry,
+	 const uint32_t order)
+{
+	struct flow **p;
+
+	flow_event(s, f, entry, order);
+	--s->count;
+	for (p = &s->table[f->hash & (s->table_size - 1)]; *p != f;
+	     p = &(*p)->hash_next)
+		;
+	*p = f->hash_next;
+	flow_set_queue(s, f, NULL);
+	if (flow_threads) {
+		f->hash_next = s->closed;
+		s->closed = f;
+	} else
+		flow_free(s, f);
+}
+
+static void
+flows_expire(struct flow_shard *s, const time_t now, const uint32_t entry)
+{
+	while (s->handshake_queue.head != NULL &&
+	       now >= s->handshake_queue.head->timeout)
+		flow_del(s, s->handshake_queue.head, entry,
+			 FLOW_EVENT_HANDSHAKE);
+	while (s->idle_queue.head != NULL &&
+	       now >= s->idle_queue.head->timeout)
+		flow_del(s, s->idle_queue.head, entry, FLOW_EVENT_IDLE);
+}
+
+/* Follow the handshake and the closing of a TCP connection.  Returns 1
+ * once the connection is over.
+ */
+static int
+flow_tcp(struct flow_shard *s, struct flow *f, const struct flow_packet *fp)
+{
+	const int from = fp->from;
+	const int to = !from;
+	const u_int syn_ack = fp->tcp_flags & (TH_SYN | TH_ACK);
+
+	if (fp->tcp_flags & TH_RST)
+		return 1;
+	if (!(f->state & FLOW_ESTABLISHED)) {
+		if (from != f->client && syn_ack == (TH_SYN | TH_ACK))
+			f->state |= FLOW_SYNACK;
+		else if (from == f->client && syn_ack == TH_ACK &&
+			 (f->state & FLOW_SYNACK)) {
+			f->state |= FLOW_ESTABLISHED;
+			if (!sessions_expiration_delay)
+				flow_set_queue(s, f, NULL);
+		}
+	}
+	if (fp->tcp_flags & TH_FIN) {
+		f->state |= FLOW_FIN(from);
+		f->fin_seq[from] = fp->seq + fp->payload;
+	}
+	if ((fp->tcp_flags & TH_ACK) && (f->state & FLOW_FIN(to)) &&
+	    (int32_t)(fp->ack - f->fin_seq[to]) > 0)
+		f->state |= FLOW_FIN_ACKED(to);
+	return (f->state & (FLOW_FIN_ACKED(0) | FLOW_FIN_ACKED(1))) ==
+	    (FLOW_FIN_ACKED(0) | FLOW_FIN_ACKED(1));
+}
+
+/* Write a packet to the file of its session. */
+static void
+flow_write(const struct flow_shard *s, struct flow *f,
+	   const struct pcap_pkthdr *h, const u_char *data)
+{
+	if (sessions_file_format == NULL)
+		return;
+	if (f->dumper == NULL)
+		f->dumper = dumper_open(flow_type_name(f->type, 0), f->id,
+					s->index);
+	if (sessions_buffer_size || lookback_time)
+		dumper_buffer(f->dumper, h, data, h->caplen, data + h->caplen);
+	else
+		pcap_dump((u_char *)dumper_get(f->dumper), h, data);
+}
+
+/* Track a TCP or UDP packet of a shard, and write it out right away if
+ * "data" is given.  Returns the flow it belongs to, if any, which may
+ * have been closed by it.
+ */
+static struct flow *
+flow_track(struct flow_shard *s, const struct flow_packet *fp,
+	   const uint32_t hash, const uint32_t entry,
+	   const struct pcap_pkthdr *h, const u_char *data)
+{
+	enum flow_type type;
+	struct flow *f;
+
+	type = fp->key.proto == IPPROTO_TCP ? FLOW_TCP : FLOW_UDP;
+	f = flow_find(s, &fp->key, hash);
+	if (f == NULL) {
+		if (bonus_time ||
+		    (type == FLOW_TCP && !(fp->tcp_flags & TH_SYN)))
+			return NULL;
+		f = flow_add(s, fp, hash, type, entry);
+		flow_set_queue(s, f, type == FLOW_TCP ?
+		    &s->handshake_queue : &s->idle_queue);
+	} else if (sessions_expiration_delay || type == FLOW_UDP)
+		flow_set_queue(s, f, &s->idle_queue);
+	f->lastseen = s->now;
+	f->bytes += fp->payload;
+	if (data != NULL) {
+		flow_write(s, f, h, data);
+		if (bonus_time)
+			output_dump(global_output, h, data);
+	}
+	if (type == FLOW_TCP && flow_tcp(s, f, fp))
+		flow_del(s, f, entry, FLOW_EVENT_CLOSED);
+	return f;
+}
+
+static void
+flow_shard_init(struct flow_shard *s, const u_int index)
+{
+	memset(s, 0, sizeof(*s));
+	s->index = index;
+	s->slab.size = sizeof(struct flow);
+	s->handshake_queue.delay = FLOW_HANDSHAKE_DELAY;
+	s->idle_queue.delay = sessions_expiration_delay ?
+	    sessions_expiration_delay : FLOW_IDLE_DELAY;
+}
+
+#ifdef HAVE_PTHREADS
+/* Track the packets of a batch that belong to a shard, and expire its
+ * sessions as the time of every packet of the batch comes.
+ */
+static void
+flow_shard_track(struct flow_shard *s, struct flow_batch *b)
+{
+	struct flow_entry *e;
+	uint32_t i;
+
+	s->event_count = 0;
+	s->event_next = 0;
+	for (i = 0; i < b->count; i++) {
+		e = &b->entries[i];
+		s->now = e->ts;
+		s->packet = b->first + i;
+		flows_expire(s, e->expire, i);
+		if (e->shard == (int)s->index)
+			e->flow = flow_track(s, &e->fp, e->hash, i, NULL, NULL);
+	}
+}
+
+/* Write the packets of a batch that belong to a shard, and then forget
+ * about the sessions they closed.
+ */
+static void
+flow_shard_write(struct flow_shard *s, struct flow_batch *b)
+{
+	struct flow_entry *e;
+	struct flow *f;
+	uint32_t i;
+
+	if (sessions_file_format != NULL)
+		for (i = 0; i < b->count; i++) {
+			e = &b->entries[i];
+			if (e->shard == (int)s->index && e->flow != NULL)
+				flow_write(s, e->flow, &e->hdr,
+					   b->data + e->offset);
+		}
+	while ((f = s->closed) != NULL) {
+		s->closed = f->hash_next;
+		flow_free(s, f);
+	}
+}
+
+static void *
+flow_thread(void *arg)
+{
+	struct flow_shard *s = arg;
+	struct flow_batch *write, *track;
+	uint64_t step = 0;
+
+	pthread_mutex_lock(&flow_lock);
+	for (;;) {
+		while (step == flow_step && !flow_quit)
+			pthread_cond_wait(&flow_go, &flow_lock);
+		if (step == flow_step)
+			break;
+		step = flow_step;
+		write = flow_step_write;
+		track = flow_step_track;
+		pthread_mutex_unlock(&flow_lock);
+
+		if (write != NULL)
+			flow_shard_write(s, write);
+		if (track != NULL)
+			flow_shard_track(s, track);
+
+		pthread_mutex_lock(&flow_lock);
+		if (--flow_busy == 0)
+			pthread_cond_signal(&flow_done);
+	}
+	pthread_mutex_unlock(&flow_lock);
+	return NULL;
+}
+
+/* Report the events of a packet of a batch up to "last", merging those
+ * of all the shards.
+ */
+static void
+flow_report(const struct flow_batch *b, const uint32_t entry,
+	    const uint32_t last)
+{
+	struct flow_shard *s, *first;
+	struct flow_event *ev, *first_ev = NULL;
+	u_int i;
+
+	for (;;) {
+		first = NULL;
+		for (i = 0; i < flow_shard_count; i++) {
+			s = &flow_shards[i];
+			if (s->event_next == s->event_count)
+				continue;
+			ev = &s->events[s->event_next];
+			if (ev->entry != entry || ev->order > last)
+				continue;
+			if (first == NULL || ev->order < first_ev->order ||
+			    (ev->order == first_ev->order &&
+			     ev->queued < first_ev->queued)) {
+				first = s;
+				first_ev = ev;
+			}
+		}
+		if (first == NULL)
+			return;
+		first->event_next++;
+		if (first_ev->order == FLOW_EVENT_OPENED)
+			flow_opened(first_ev->flow, &b->entries[entry].ts);
+		else
+			flow_closed(first_ev->flow, &b->entries[entry].ts);
+	}
+}
+
+/* Report the sessions a batch opened and closed, and write its packets
+ * that belong to a session to the output after the window.
+ */
+static void
+flow_merge(const struct flow_batch *b)
+{
+	const struct flow_entry *e;
+	uint32_t i;
+
+	for (i = 0; i < b->count; i++) {
+		e = &b->entries[i];
+		flow_report(b, i, FLOW_EVENT_OPENED);
+		if (bonus_time && e->flow != NULL)
+			output_dump(global_output, &e->hdr,
+				    b->data + e->offset);
+		flow_report(b, i, FLOW_EVENT_CLOSED);
+	}
+}
+
+static void
+flow_step_start(struct flow_batch *write, struct flow_batch *track)
+{
+	pthread_mutex_lock(&flow_lock);
+	flow_step_write = write;
+	flow_step_track = track;
+	flow_busy = flow_shard_count;
+	++flow_step;
+	pthread_cond_broadcast(&flow_go);
+	pthread_mutex_unlock(&flow_lock);
+	flow_running = 1;
+	flow_tracked = track;
+}
+
+/* Wait for the running step, if any, and report what its batch brought.
+ * Returns that batch, the packets of which are now to be written.
+ */
+static struct flow_batch *
+flow_step_end(void)
+{
+	struct flow_batch *b = flow_tracked;
+
+	if (!flow_running)
+		return NULL;
+	pthread_mutex_lock(&flow_lock);
+	while (flow_busy)
+		pthread_cond_wait(&flow_done, &flow_lock);
+	pthread_mutex_unlock(&flow_lock);
+	flow_running = 0;
+	flow_tracked = NULL;
+	if (b != NULL)
+		flow_merge(b);
+	return b;
+}
+
+/* Hand the batch being filled over to the threads and start the next. */
+static void
+flow_submit(void)
+{
+	struct flow_batch *b;
+
+	flow_step_start(flow_step_end(), &flow_batches[flow_filling]);
+	flow_filling = (flow_filling + 1) % FLOW_BATCHES;
+	b = &flow_batches[flow_filling];
+	b->count = 0;
+	b->first = flow_packets;
+	b->len = 0;
+}
+
+/* Have every packet so far tracked, reported and written. */
+static void
+flow_drain(void)
+{
+	struct flow_batch *b;
+
+	if (flow_batches[flow_filling].count)
+		flow_submit();
+	if ((b = flow_step_end()) != NULL) {
+		flow_step_start(b, NULL);
+		flow_step_end();
+	}
+}
+
+static struct flow_entry *
+flow_entry_new(const struct pcap_pkthdr *h)
+{
+	struct flow_batch *b = &flow_batches[flow_filling];
+	struct flow_entry *e;
+
+	if (b->count == FLOW_BATCH_PACKETS ||
+	    (b->count && b->len + h->caplen > FLOW_BATCH_BYTES)) {
+		flow_submit();
+		b = &flow_batches[flow_filling];
+	}
+	e = &b->entries[b->count++];
+	++flow_packets;
+	e->hdr = *h;
+	e->ts = flow_now;
+	e->expire = flow_now.tv_sec;
+	e->shard = -1;
+	e->flow = NULL;
+	return e;
+}
+
+static void
+flow_entry_data(struct flow_entry *e, const u_char *data)
+{
+	struct flow_batch *b = &flow_batches[flow_filling];
+	size_t size;
+
+	if (b->len + e->hdr.caplen > b->size) {
+		for (size = b->size ? b->size : FLOW_BATCH_BYTES;
+		     size < b->len + e->hdr.caplen; size *= 2)
+			;
+		if ((b->data = realloc(b->data, size)) == NULL)
+			error("realloc() failed in %s()", __func__);
+		b->size = size;
+	}
+	e->offset = b->len;
+	memcpy(b->data + b->len, data, e->hdr.caplen);
+	b->len += e->hdr.caplen;
+}
+
+static void
+flow_threads_stop(void)
+{
+	u_int i;
+
+	pthread_mutex_lock(&flow_lock);
+	flow_quit = 1;
+	pthread_cond_broadcast(&flow_go);
+	pthread_mutex_unlock(&flow_lock);
+	for (i = 0; i < flow_shard_count; i++)
+		pthread_join(flow_shards[i].thread, NULL);
+	flow_quit = 0;
+	flow_step = 0;
+}
+
+/* Start a thread per shard.  Returns 0 if one could not be started, in
+ * which case there are none.
+ */
+static int
+flow_threads_start(void)
+{
+	u_int i;
+
+	for (i = 0; i < FLOW_BATCHES; i++) {
+		flow_batches[i].entries = malloc(FLOW_BATCH_PACKETS *
+		    sizeof(struct flow_entry));
+		if (flow_batches[i].entries == NULL)
+			error("malloc() failed in %s()", __func__);
+		flow_batches[i].count = 0;
+		flow_batches[i].first = 0;
+		flow_batches[i].len = 0;
+	}
+	flow_filling = 0;
+	for (i = 0; i < flow_shard_count; i++)
+		if (pthread_create(&flow_shards[i].thread, NULL, flow_thread,
+				   &flow_shards[i]))
+			break;
+	if (i < flow_shard_count) {
+		flow_shard_count = i;
+		flow_threads_stop();
+		return 0;
+	}
+	return 1;
+}
+
+static void
+flow_batches_free(void)
+{
+	u_int i;
+
+	for (i = 0; i < FLOW_BATCHES; i++) {
+		free(flow_batches[i].entries);
+		free(flow_batches[i].data);
+		memset(&flow_batches[i], 0, sizeof(flow_batches[i]));
+	}
+}
+#endif /* HAVE_PTHREADS */
+
+/* Make the shards on the first packet, once the number of threads is
+ * known: a single one and no thread unless sessions_threads says so.
+ */
+static void
+flows_start(void)
+{
+	u_int i;
+
+	flow_shard_count = 1;
+#ifdef HAVE_PTHREADS
+	if (sessions_threads > 0)
+		flow_shard_count = sessions_threads;
+#endif
+	flow_shards = calloc(flow_shard_count, sizeof(*flow_shards));
+	if (flow_shards == NULL)
+		error("calloc() failed in %s()", __func__);
+	for (i = 0; i < flow_shard_count; i++)
+		flow_shard_init(&flow_shards[i], i);
+#ifdef HAVE_PTHREADS
+	if (sessions_threads > 0) {
+		flow_threads = flow_threads_start();
+		if (flow_threads)
+			dumpers_split(flow_shard_count);
+		else {
+			flow_batches_free();
+			flow_shard_count = 1;
+		}
+	}
+#endif
+}
+
+void
+flows_init(const char *types)
+{
+	size_t len;
+
+	flow_track_types = 0;
+	for (;;) {
+		len = strcspn(types, ",");
+		if (len == 3 && !strncmp(types, "tcp", len))
+			flow_track_types |= FLOW_TCP;
+		else if (len == 3 && !strncmp(types, "udp", len))
+			flow_track_types |= FLOW_UDP;
+		else
+			error("unsupported session type `%.*s' without libnids or with -n",
+			      (int)len, types);
+		if (types[len] == '\0')
+			break;
+		types += len + 1;
+	}
+	bonus_time = 0;
+	track_sessions = 1;
+}
+
+void
+flows_packet(pcap_t *p, const struct pcap_pkthdr *h, const u_char *data)
+{
+	struct flow_packet fp;
+	struct flow_shard *s;
+	enum flow_type type;
+	uint32_t hash;
+
+	TIMEVAL_FROM_PKTHDR_TS(flow_now, h->ts);
+	if (flow_shards == NULL)
+		flows_start();
+#ifdef HAVE_PTHREADS
+	if (flow_threads) {
+		struct flow_entry *e = flow_entry_new(h);
+
+		if (!flow_parse(pcap_datalink(p), h, data, &e->fp, NULL))
+			return;
+		type = e->fp.key.proto == IPPROTO_TCP ? FLOW_TCP : FLOW_UDP;
+		if (!(type & flow_track_types))
+			return;
+		e->hash = flow_hash(&e->fp.key);
+		/* The high bits of the hash, the low ones pick buckets. */
+		e->shard = (int)(((uint64_t)e->hash * flow_shard_count) >> 32);
+		if (sessions_file_format != NULL || bonus_time)
+			flow_entry_data(e, data);
+		return;
+	}
+#endif /* HAVE_PTHREADS */
+	s = &flow_shards[0];
+	s->now = flow_now;
+	s->packet = flow_packets++;
+	flows_expire(s, flow_now.tv_sec, 0);
+	if (!flow_parse(pcap_datalink(p), h, data, &fp, NULL))
+		return;
+	type = fp.key.proto == IPPROTO_TCP ? FLOW_TCP : FLOW_UDP;
+	if (!(type & flow_track_types))
+		return;
+	hash = flow_hash(&fp.key);
+	flow_track(s, &fp, hash, 0, h, data);
+}
+
+/* The shard out of "n" of a packet, by the hash of its flow, which is the
+ * same in both directions.  All the fragments of IP packets go by their
+ * addresses alone, so that they end up together whichever one has the
+ * ports.  The other packets that are not of a TCP or UDP flow go to the
+ * first shard.
+ */
+u_int
+flows_shard(const int dlt, const struct pcap_pkthdr *h, const u_char *data,
+	    const u_int n)
+{
+	struct flow_packet fp;
+	struct flow_key frag;
+
+	switch (flow_parse(dlt, h, data, &fp, &frag)) {
+	case 0:
+		return 0;
+	case -1:
+		fp.key = frag;
+		break;
+	}
+	/* The high bits of the hash, as for the threads above. */
+	return (u_int)(((uint64_t)flow_hash(&fp.key) * n) >> 32);
+}
+
+void
+flows_flush(void)
+{
+#ifdef HAVE_PTHREADS
+	if (flow_threads)
+		flow_drain();
+#endif
+}
+
+static int
+flow_id_cmp(const void *a, const void *b)
+{
+	uint32_t id_a = (*(struct flow *const *)a)->id;
+	uint32_t id_b = (*(struct flow *const *)b)->id;
+
+	return id_a < id_b ? 1 : id_a > id_b ? -1 : 0;
+}
+
+static void
+flow_print_end(const struct flow *f, const int end)
+{
+	char buf[INET6_ADDRSTRLEN];
+
+	if (inet_ntop(f->key.version == 4 ? AF_INET : AF_INET6,
+		      f->key.addr[end], buf, sizeof(buf)) == NULL)
+		strcpy(buf, "?");
+	fprintf(stderr, "%15s:%-5u\t", buf, f->key.port[end]);
+}
+
+void
+flows_exit(void)
+{
+	struct flow **unclosed;
+	struct flow_shard *s;
+	struct flow *f;
+	struct slab slabs;
+	uint32_t count = 0;
+	uint32_t i;
+	u_int n;
+
+	/* As sessions_exit() does, jump forward one minute to end the TCP
+	 * sessions that did not have the time to complete the handshake,
+	 * and the idle UDP ones.
+	 */
+#ifdef HAVE_PTHREADS
+	if (flow_threads) {
+		struct pcap_pkthdr none;
+		struct flow_entry *e;
+
+		memset(&none, 0, sizeof(none));
+		e = flow_entry_new(&none);
+		e->expire = flow_now.tv_sec + 60;
+		flow_drain();
+		flow_threads_stop();
+		flow_batches_free();
+		flow_threads = 0;
+	} else
+#endif /* HAVE_PTHREADS */
+	if (flow_shards != NULL)
+		flows_expire(&flow_shards[0], flow_now.tv_sec + 60, 0);
+
+	/* Print a report about unclosed sessions, the latest first. */
+	if (sessions_count) {
+		unclosed = malloc(sessions_count * sizeof(*unclosed));
+		if (unclosed == NULL)
+			error("malloc() failed in %s()", __func__);
+		for (n = 0; n < flow_shard_count; n++) {
+			s = &flow_shards[n];
+			for (i = 0; i < s->table_size; i++)
+				for (f = s->table[i]; f != NULL;
+				     f = f->hash_next)
+					unclosed[count++] = f;
+		}
+		qsort(unclosed, count, sizeof(*unclosed), flow_id_cmp);
+		fprintf(stderr,
+			"%u unclosed %s (id, type, last, source, destination, bytes):\n",
+			count, count > 1 ? "sessions" : "session");
+		for (i = 0; i < count; i++) {
+			f = unclosed[i];
+			fprintf(stderr, "#%u\t", f->id);
+			fprintf(stderr, "%s\t", flow_type_name(f->type, 1));
+			fprintf(stderr, "%s\t", timestamp_to_string(&f->lastseen));
+			flow_print_end(f, f->client);
+			flow_print_end(f, !f->client);
+			fprintf(stderr, "%12" PRIu64 "\n", f->bytes);
+			dumper_close(f->dumper);
+		}
+		free(unclosed);
+		sessions_count = 0;
+	}
+	dumpers_exit();
+	memset(&slabs, 0, sizeof(slabs));
+	sessions_stats.buckets = 0;
+	for (n = 0; n < flow_shard_count; n++) {
+		s = &flow_shards[n];
+		slabs.allocs += s->slab.allocs;
+		slabs.chunk_count += s->slab.chunk_count;
+		sessions_stats.buckets += s->table_size;
+		slab_destroy(&s->slab);
+		free(s->table);
+		free(s->events);
+	}
+	/* Not the objects in use, which the threads free late, but the
+	 * sessions open at the same time in the order of the packets.
+	 */
+	if (verbose)
+		printf("Session objects: %" PRIu64 " sessions (%u at most at a time) in %u slabs\n",
+		       slabs.allocs, flow_peak, slabs.chunk_count);
+	sessions_stats.sessions = slabs.allocs;
+	sessions_stats.peak = flow_peak;
+	free(flow_shards);
+	flow_shards = NULL;
+	flow_shard_count = 0;
+	flow_counter = 0;
+	flow_peak = 0;
+	flow_packets = 0;
+	track_sessions = 0;
+}
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * gzfile.c - read gzip-compressed savefiles through stdio
+ *
+ * libpcap reads a savefile from a FILE and search.c seeks in it by byte
+ * offset, so a compressed savefile is presented as a stdio stream of its
+ * decompressed contents, made with fopencookie() or funopen().
+ *
+ * A BGZF file (as written by "bgzip") is a series of gzip members of at
+ * most 64 KiB of data each, which says in its header how long it is.
+ * Knowing where each member starts in both the compressed and the
+ * decompressed data, a seek only costs decompressing the member it lands
+ * in.  That index comes from the ".gzi" file next to the savefile when
+ * there is one ("bgzip -i" writes it), otherwise from reading the header
+ * and the trailer of every member, which is much less than decompressing.
+ *
+ * Any other gzip file can only be decompressed from the start, so it is
+ * read forward only, like a pipe; so is a BGZF file that is read from a
+ * pipe.  Only the first byte of the stream is looked at to tell whether
+ * it is compressed, and put back, so that it does not have to be opened
+ * again.
+ */
+
+#include <config.h>
+
+// For fopencookie().
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H) && \
+    (defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN))
+
+#include <zlib.h>
+
+/* The most a BGZF member can hold, compressed or not. */
+#define BGZF_MAX_BLOCK_SIZE 65536
+
+/* Fixed part of a gzip member header, up to and including XLEN. */
+#define GZIP_HDR_LEN 12
+
+struct gz_block {
+	int64_t	coffset;	/* start of the member in the file */
+	int64_t	uoffset;	/* start of its data in the decompressed data */
+};
+
+struct gzfile {
+	FILE	*fp;			/* the compressed file */
+	int	stream;			/* decompressed as it comes */
+	int	end;			/* of a member, when streaming */
+	int	error;			/* errno to return next, when streaming */
+
+	struct gz_block *index;		/* when BGZF, one entry per member */
+	size_t	nblocks, maxblocks;
+	int64_t	usize;			/* size of the decompressed data */
+	int64_t	pos;			/* current decompressed position */
+
+	ssize_t	cur;			/* member in ubuf, -1 if none */
+	u_int	ulen;			/* amount of data in ubuf */
+	z_stream zs;
+	u_char	cbuf[BGZF_MAX_BLOCK_SIZE];
+	u_char	ubuf[BGZF_MAX_BLOCK_SIZE];
+};
+
+static uint32_t
+get_le16(const u_char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t
+get_le32(const u_char *p)
+{
+	return get_le16(p) | get_le16(p + 2) << 16;
+}
+
+static uint64_t
+get_le64(const u_char *p)
+{
+	return get_le32(p) | (uint64_t) get_le32(p + 4) << 32;
+}
+
+/* Read the header of the BGZF member at the current position of the file.
+ * Return the size of the member and set *hdrlen to the length of its
+ * header, or return 0 at the end of the file and -1 if it is not a BGZF
+ * member.
+ */
+static int
+bgzf_header(FILE *fp, u_int *hdrlen)
+{
+	u_char hdr[GZIP_HDR_LEN + 256], *sub;
+	u_int xlen;
+	size_t n;
+
+	n = fread(hdr, 1, GZIP_HDR_LEN, fp);
+	if (n == 0 && feof(fp))
+		return 0;
+	if (n != GZIP_HDR_LEN || hdr[0] != 0x1f || hdr[1] != 0x8b ||
+	    hdr[2] != Z_DEFLATED || ! (hdr[3] & 0x04))
+		return -1;
+
+	/* Look for the "BC" subfield in the extra field. */
+	xlen = get_le16(hdr + 10);
+	if (xlen > sizeof(hdr) - GZIP_HDR_LEN ||
+	    fread(hdr + GZIP_HDR_LEN, 1, xlen, fp) != xlen)
+		return -1;
+	for (sub = hdr + GZIP_HDR_LEN; sub + 4 <= hdr + GZIP_HDR_LEN + xlen;
+	     sub += 4 + get_le16(sub + 2))
+		if (sub[0] == 'B' && sub[1] == 'C' && get_le16(sub + 2) == 2 &&
+		    sub + 6 <= hdr + GZIP_HDR_LEN + xlen) {
+			*hdrlen = GZIP_HDR_LEN + xlen;
+			return get_le16(sub + 4) + 1;
+		}
+	return -1;
+}
+
+static int
+add_block(struct gzfile *gzf, const int64_t coffset, const int64_t uoffset)
+{
+	if (gzf->nblocks == gzf->maxblocks) {
+		size_t max = gzf->maxblocks ? 2 * gzf->maxblocks : 1024;
+		struct gz_block *index = (struct gz_block *)
+			realloc(gzf->index, max * sizeof(struct gz_block));
+
+		if (index == NULL)
+			return -1;
+		gzf->index = index;
+		gzf->maxblocks = max;
+	}
+	gzf->index[gzf->nblocks].coffset = coffset;
+	gzf->index[gzf->nblocks].uoffset = uoffset;
+	gzf->nblocks++;
+	return 0;
+}
+
+/* Index the members from the given one to the end of the file by reading
+ * their headers and trailers.  Return 0 on success, -1 if the file is not
+ * BGZF all the way through.
+ */
+static int
+bgzf_scan(struct gzfile *gzf, int64_t coffset, int64_t uoffset)
+{
+	u_char isize[4];
+	u_int hdrlen;
+	int bsize;
+
+	for (;;) {
+		if (fseek64(gzf->fp, coffset, SEEK_SET) < 0)
+			return -1;
+		if ((bsize = bgzf_header(gzf->fp, &hdrlen)) <= 0)
+			break;
+		if ((u_int) bsize < hdrlen + 8 ||
+		    fseek64(gzf->fp, coffset + bsize - 4, SEEK_SET) < 0 ||
+		    fread(isize, 1, 4, gzf->fp) != 4 ||
+		    get_le32(isize) > BGZF_MAX_BLOCK_SIZE)
+			return -1;
+		if ((gzf->nblocks == 0 ||
+		     coffset > gzf->index[gzf->nblocks - 1].coffset) &&
+		    add_block(gzf, coffset, uoffset) < 0)
+			return -1;
+		coffset += bsize;
+		uoffset += get_le32(isize);
+	}
+	if (bsize < 0 || gzf->nblocks == 0)
+		return -1;
+	gzf->usize = uoffset;
+	return 0;
+}
+
+/* Load the index in "filename".gzi, if there is one: a little-endian count
+ * of entries followed by that many compressed and decompressed offsets of
+ * the members after the first one.
+ */
+static int
+bgzf_load_gzi(struct gzfile *gzf, const char *filename)
+{
+	char gzi[FILENAME_MAX];
+	u_char buf[16];
+	uint64_t count;
+	FILE *fp;
+	int ret = -1;
+
+	if (snprintf(gzi, sizeof(gzi), "%s.gzi", filename) >= (int) sizeof(gzi) ||
+	    (fp = fopen(gzi, "rb")) == NULL)
+		return -1;
+	if (fread(buf, 1, 8, fp) != 8 || add_block(gzf, 0, 0) < 0)
+		goto done;
+	for (count = get_le64(buf); count > 0; count--) {
+		if (fread(buf, 1, 16, fp) != 16 ||
+		    (int64_t) get_le64(buf) <= gzf->index[gzf->nblocks - 1].coffset ||
+		    add_block(gzf, get_le64(buf), get_le64(buf + 8)) < 0)
+			goto done;
+	}
+	ret = 0;
+done:
+	fclose(fp);
+	if (ret < 0)
+		gzf->nblocks = 0;
+	return ret;
+}
+
+/* Index the members, from the .gzi file as far as it goes. */
+static int
+bgzf_index(struct gzfile *gzf, const char *filename)
+{
+	if (bgzf_load_gzi(gzf, filename) == 0 &&
+	    bgzf_scan(gzf, gzf->index[gzf->nblocks - 1].coffset,
+		      gzf->index[gzf->nblocks - 1].uoffset) == 0)
+		return 0;
+	gzf->nblocks = 0;
+	return bgzf_scan(gzf, 0, 0);
+}
+
+/* Decompress member i into ubuf. */
+static int
+bgzf_load_block(struct gzfile *gzf, const size_t i)
+{
+	u_int hdrlen;
+	int bsize;
+
+	if (fseek64(gzf->fp, gzf->index[i].coffset, SEEK_SET) < 0 ||
+	    (bsize = bgzf_header(gzf->fp, &hdrlen)) <= 0 ||
+	    (u_int) bsize < hdrlen + 8 ||
+	    fread(gzf->cbuf, 1, bsize - hdrlen, gzf->fp) != (size_t) bsize - hdrlen)
+		return -1;
+
+	if (inflateReset(&gzf->zs) != Z_OK)
+		return -1;
+	gzf->zs.next_in = gzf->cbuf;
+	gzf->zs.avail_in = bsize - hdrlen - 8;
+	gzf->zs.next_out = gzf->ubuf;
+	gzf->zs.avail_out = sizeof(gzf->ubuf);
+	if (inflate(&gzf->zs, Z_FINISH) != Z_STREAM_END)
+		return -1;
+
+	gzf->ulen = sizeof(gzf->ubuf) - gzf->zs.avail_out;
+	if (crc32(crc32(0L, Z_NULL, 0), gzf->ubuf, gzf->ulen) !=
+	    get_le32(gzf->cbuf + bsize - hdrlen - 8))
+		return -1;
+	gzf->cur = i;
+	return 0;
+}
+
+/* The member that holds the given decompressed position. */
+static size_t
+bgzf_find_block(const struct gzfile *gzf, const int64_t pos)
+{
+	size_t lo = 0, hi = gzf->nblocks - 1, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (gzf->index[mid].uoffset <= pos)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* Decompress what comes next of a file that is not seekable or not BGZF,
+ * which may have several gzip members.
+ */
+static ssize_t
+gzfile_stream_read(struct gzfile *gzf, char *buf, size_t size)
+{
+	size_t n;
+	int ret;
+
+	gzf->zs.next_out = (u_char *) buf;
+	gzf->zs.avail_out = size > UINT32_MAX ? UINT32_MAX : (uInt) size;
+	while (gzf->zs.avail_out > 0 && ! gzf->error) {
+		if (gzf->zs.avail_in == 0) {
+			n = fread(gzf->cbuf, 1, sizeof(gzf->cbuf), gzf->fp);
+			if (n == 0) {
+				/* The end of the file must be that of a
+				 * member.
+				 */
+				if (ferror(gzf->fp) || ! gzf->end)
+					gzf->error = EIO;
+				break;
+			}
+			gzf->zs.next_in = gzf->cbuf;
+			gzf->zs.avail_in = (uInt) n;
+		}
+		gzf->end = 0;
+		ret = inflate(&gzf->zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			gzf->end = 1;
+			if (inflateReset(&gzf->zs) != Z_OK)
+				gzf->error = EIO;
+		} else if (ret != Z_OK)
+			gzf->error = EIO;
+	}
+
+	/* Return what there is before the error, and the error next. */
+	n = (u_char *) gzf->zs.next_out - (u_char *) buf;
+	if (n == 0 && gzf->error) {
+		errno = gzf->error;
+		return -1;
+	}
+	gzf->pos += n;
+	return n;
+}
+
+static ssize_t
+gzfile_read(void *cookie, char *buf, size_t size)
+{
+	struct gzfile *gzf = (struct gzfile *) cookie;
+	size_t done = 0, n;
+	int64_t off;
+
+	if (gzf->stream)
+		return gzfile_stream_read(gzf, buf, size);
+
+	while (done < size && gzf->pos < gzf->usize) {
+		if (gzf->cur < 0 ||
+		    (off = gzf->pos - gzf->index[gzf->cur].uoffset) < 0 ||
+		    off >= gzf->ulen) {
+			if (bgzf_load_block(gzf, bgzf_find_block(gzf, gzf->pos)) < 0) {
+				gzf->cur = -1;
+				errno = EIO;
+				return -1;
+			}
+			off = gzf->pos - gzf->index[gzf->cur].uoffset;
+			if (off >= gzf->ulen)
+				break;	/* the index is wrong */
+		}
+		n = gzf->ulen - off;
+		if (n > size - done)
+			n = size - done;
+		memcpy(buf + done, gzf->ubuf + off, n);
+		done += n;
+		gzf->pos += n;
+	}
+	return done;
+}
+
+static int
+gzfile_seek(void *cookie, int64_t *offset, int whence)
+{
+	struct gzfile *gzf = (struct gzfile *) cookie;
+	int64_t pos;
+
+	if (gzf->stream) {
+		/* Only telling where we are is cheap. */
+		if (whence != SEEK_CUR || *offset != 0) {
+			errno = ESPIPE;
+			return -1;
+		}
+		*offset = gzf->pos;
+		return 0;
+	}
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = *offset;
+		break;
+	case SEEK_CUR:
+		pos = gzf->pos + *offset;
+		break;
+	case SEEK_END:
+		pos = gzf->usize + *offset;
+		break;
+	default:
+		pos = -1;
+	}
+	if (pos < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	*offset = gzf->pos = pos;
+	return 0;
+}
+
+static int
+gzfile_close(void *cookie)
+{
+	struct gzfile *gzf = (struct gzfile *) cookie;
+
+	inflateEnd(&gzf->zs);
+	fclose(gzf->fp);
+	free(gzf->index);
+	free(gzf);
+	return 0;
+}
+
+#ifdef HAVE_FOPENCOOKIE
+static ssize_t
+cookie_read(void *cookie, char *buf, size_t size)
+{
+	return gzfile_read(cookie, buf, size);
+}
+
+static int
+cookie_seek(void *cookie, off64_t *offset, int whence)
+{
+	int64_t off = *offset;
+	int ret = gzfile_seek(cookie, &off, whence);
+
+	*offset = off;
+	return ret;
+}
+
+static FILE *
+cookie_open(struct gzfile *gzf)
+{
+	cookie_io_functions_t io = {
+		cookie_read, NULL, cookie_seek, gzfile_close
+	};
+
+	return fopencookie(gzf, "r", io);
+}
+#else /* HAVE_FOPENCOOKIE */
+static int
+cookie_read(void *cookie, char *buf, int size)
+{
+	return (int) gzfile_read(cookie, buf, size < 0 ? 0 : (size_t) size);
+}
+
+static fpos_t
+cookie_seek(void *cookie, fpos_t offset, int whence)
+{
+	int64_t off = offset;
+
+	return gzfile_seek(cookie, &off, whence) < 0 ? -1 : (fpos_t) off;
+}
+
+static FILE *
+cookie_open(struct gzfile *gzf)
+{
+	return funopen(gzf, cookie_read, NULL, cookie_seek, gzfile_close);
+}
+#endif /* HAVE_FOPENCOOKIE */
+
+FILE *
+gzfile_open(FILE *fp, const char *filename, int *seekable, char *errbuf)
+{
+	struct gzfile *gzf;
+	FILE *ret;
+	int c;
+
+	/* Leave it to libpcap to say what is wrong with an empty file. */
+	if ((c = getc(fp)) == EOF)
+		return fp;
+	if (ungetc(c, fp) == EOF) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filename,
+			 strerror(errno));
+		fclose(fp);
+		return NULL;
+	}
+	/* No savefile format starts like a gzip member. */
+	if (c != 0x1f)
+		return fp;
+
+	if ((gzf = (struct gzfile *) calloc(1, sizeof(struct gzfile))) == NULL ||
+	    inflateInit2(&gzf->zs, -MAX_WBITS) != Z_OK) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+		free(gzf);
+		fclose(fp);
+		return NULL;
+	}
+	gzf->fp = fp;
+	gzf->cur = -1;
+
+	if (*seekable && bgzf_index(gzf, filename) == 0)
+		*seekable = 1;
+	else {
+		/* Plain gzip or a pipe, decompress as it comes. */
+		inflateEnd(&gzf->zs);
+		free(gzf->index);
+		gzf->index = NULL;
+		gzf->nblocks = 0;
+		if ((*seekable && fseek64(fp, 0, SEEK_SET) < 0) ||
+		    inflateInit2(&gzf->zs, 16 + MAX_WBITS) != Z_OK) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filename,
+				 *seekable ? strerror(errno) : "out of memory");
+			free(gzf);
+			fclose(fp);
+			return NULL;
+		}
+		gzf->stream = 1;
+		*seekable = 0;
+	}
+
+	if ((ret = cookie_open(gzf)) == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filename,
+			 strerror(errno));
+		(void)gzfile_close(gzf);
+	}
+	return ret;
+}
+
+#else /* HAVE_LIBZ ... */
+
+FILE *
+gzfile_open(FILE *fp, const char *filename _U_, int *seekable _U_,
+	    char *errbuf _U_)
+{
+	return fp;
+}
+
+#endif /* HAVE_LIBZ ... */
@@ -0,0 +1,571 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * gzout.c - write BGZF-compressed savefiles
+ *
+ * The dumper writes into a stdio stream made with fopencookie() or
+ * funopen(), unbuffered so that the data of each packet has arrived by
+ * the time pcap_dump() returns.  The data is cut into BGZF members (see
+ * gzfile.c) between packets whenever the packets are small enough for
+ * that, so that reading the output again never needs to decompress two
+ * members for one packet.  Full members are compressed by a pool of
+ * threads, or in the calling thread if there are none, and written out
+ * in order, together with a .gzi index when the output is a file.
+ */
+
+#include <config.h>
+
+// For fopencookie().
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H) && \
+    (defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN))
+
+#include <zlib.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+/* The data of a member, kept below 64 KiB so that it stays below 64 KiB
+ * compressed too, as "bgzip" does.
+ */
+#define BGZF_BLOCK_DATA 0xff00
+
+#define BGZF_HDR_LEN 18
+#define BGZF_MAX_BLOCK_SIZE 65536
+
+/* Members in flight per thread. */
+#define JOBS_PER_THREAD 4
+
+struct gzout_job {
+	int	done;		/* compressed */
+	u_int	inlen;
+	u_int	mark;		/* end of the last whole packet in "in" */
+	u_int	outlen;		/* 0 if compressing failed */
+	u_char	in[BGZF_BLOCK_DATA];
+	u_char	out[BGZF_MAX_BLOCK_SIZE];
+};
+
+struct gzout {
+	int	fd;
+	char	*gzi;			/* name of the index, NULL if none */
+	int	error;			/* errno of the first failure */
+
+	struct gzout_job *jobs;
+	u_int	njobs;
+	uint64_t next_fill,		/* sequence number of the job in "cur" */
+		next_compress,		/* next job for a thread to take */
+		next_write;		/* next job to write out */
+	struct gzout_job *cur;		/* being filled, NULL if none */
+
+	z_stream zs;			/* when compressing without threads */
+
+	int64_t	coffset, uoffset;	/* written so far */
+	int64_t	*index;			/* both offsets of every member */
+	size_t	nindex, maxindex;
+
+	int	nthreads;
+#ifdef HAVE_PTHREADS
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;		/* a job waits for a thread */
+	pthread_cond_t done;		/* a job was compressed */
+	int	quit;
+#endif
+};
+
+static void
+put_le16(u_char *p, const uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void
+put_le32(u_char *p, const uint32_t v)
+{
+	put_le16(p, v & 0xffff);
+	put_le16(p + 2, v >> 16);
+}
+
+static void
+put_le64(u_char *p, const uint64_t v)
+{
+	put_le32(p, v & 0xffffffff);
+	put_le32(p + 4, v >> 32);
+}
+
+/* Make a BGZF member of the data of the job. */
+static void
+compress_job(z_stream *zs, struct gzout_job *job)
+{
+	static const u_char header[BGZF_HDR_LEN] = {
+		0x1f, 0x8b, Z_DEFLATED, 0x04, 0, 0, 0, 0, 0, 0xff,
+		6, 0, 'B', 'C', 2, 0, 0, 0
+	};
+	u_int bsize;
+
+	job->outlen = 0;
+	if (deflateReset(zs) != Z_OK)
+		return;
+	zs->next_in = job->in;
+	zs->avail_in = job->inlen;
+	zs->next_out = job->out + BGZF_HDR_LEN;
+	zs->avail_out = sizeof(job->out) - BGZF_HDR_LEN - 8;
+	if (deflate(zs, Z_FINISH) != Z_STREAM_END)
+		return;
+
+	bsize = sizeof(job->out) - zs->avail_out;
+	memcpy(job->out, header, BGZF_HDR_LEN);
+	put_le16(job->out + 16, bsize - 1);
+	put_le32(job->out + bsize - 8,
+		 crc32(crc32(0L, Z_NULL, 0), job->in, job->inlen));
+	put_le32(job->out + bsize - 4, job->inlen);
+	job->outlen = bsize;
+}
+
+static int
+deflate_init(z_stream *zs)
+{
+	memset(zs, 0, sizeof(*zs));
+	return deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+			    8, Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+compress_thread(void *arg)
+{
+	struct gzout *gzo = (struct gzout *) arg;
+	struct gzout_job *job;
+	z_stream zs;
+	int ok = deflate_init(&zs) == 0;
+
+	pthread_mutex_lock(&gzo->lock);
+	for (;;) {
+		while (! gzo->quit && gzo->next_compress == gzo->next_fill)
+			pthread_cond_wait(&gzo->filled, &gzo->lock);
+		if (gzo->next_compress == gzo->next_fill)
+			break;
+		job = &gzo->jobs[gzo->next_compress++ % gzo->njobs];
+		pthread_mutex_unlock(&gzo->lock);
+
+		if (ok)
+			compress_job(&zs, job);
+		else
+			job->outlen = 0;
+
+		pthread_mutex_lock(&gzo->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&gzo->done);
+	}
+	pthread_mutex_unlock(&gzo->lock);
+	if (ok)
+		deflateEnd(&zs);
+	return NULL;
+}
+#endif /* HAVE_PTHREADS */
+
+static void
+write_all(struct gzout *gzo, const u_char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0 && ! gzo->error) {
+		n = write(gzo->fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			gzo->error = n < 0 ? errno : EIO;
+			break;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Write out the oldest job once it is compressed. */
+static void
+write_job(struct gzout *gzo)
+{
+	struct gzout_job *job = &gzo->jobs[gzo->next_write % gzo->njobs];
+
+#ifdef HAVE_PTHREADS
+	if (gzo->nthreads > 0) {
+		pthread_mutex_lock(&gzo->lock);
+		while (! job->done)
+			pthread_cond_wait(&gzo->done, &gzo->lock);
+		pthread_mutex_unlock(&gzo->lock);
+	}
+#endif
+
+	if (job->outlen == 0 && ! gzo->error)
+		gzo->error = EIO;
+
+	/* Remember where the member is for the index. */
+	if (gzo->gzi != NULL && gzo->coffset > 0) {
+		if (gzo->nindex == gzo->maxindex) {
+			size_t max = gzo->maxindex ? 2 * gzo->maxindex : 1024;
+			int64_t *index = (int64_t *)
+				realloc(gzo->index, 2 * max * sizeof(int64_t));
+
+			if (index == NULL) {
+				free(gzo->gzi);
+				gzo->gzi = NULL;
+			} else {
+				gzo->index = index;
+				gzo->maxindex = max;
+			}
+		}
+		if (gzo->gzi != NULL) {
+			gzo->index[2 * gzo->nindex] = gzo->coffset;
+			gzo->index[2 * gzo->nindex + 1] = gzo->uoffset;
+			gzo->nindex++;
+		}
+	}
+
+	write_all(gzo, job->out, job->outlen);
+	gzo->coffset += job->outlen;
+	gzo->uoffset += job->inlen;
+	gzo->next_write++;
+}
+
+/* Hand the job being filled over to be compressed. */
+static void
+submit_job(struct gzout *gzo)
+{
+	struct gzout_job *job = gzo->cur;
+
+	gzo->cur = NULL;
+#ifdef HAVE_PTHREADS
+	if (gzo->nthreads > 0) {
+		pthread_mutex_lock(&gzo->lock);
+		job->done = 0;
+		gzo->next_fill++;
+		pthread_cond_signal(&gzo->filled);
+		pthread_mutex_unlock(&gzo->lock);
+		return;
+	}
+#endif
+	compress_job(&gzo->zs, job);
+	job->done = 1;
+	gzo->next_fill++;
+}
+
+/* Get a job to fill, waiting for the one that used the slot before to be
+ * written out.
+ */
+static struct gzout_job *
+next_job(struct gzout *gzo)
+{
+	struct gzout_job *job = &gzo->jobs[gzo->next_fill % gzo->njobs];
+
+	while (gzo->next_fill - gzo->next_write >= gzo->njobs)
+		write_job(gzo);
+	job->inlen = job->mark = 0;
+	return gzo->cur = job;
+}
+
+static ssize_t
+gzout_write(void *cookie, const char *buf, size_t size)
+{
+	struct gzout *gzo = (struct gzout *) cookie;
+	struct gzout_job *job;
+	size_t left = size, n;
+
+	if (gzo->error) {
+		errno = gzo->error;
+		return -1;
+	}
+
+	while (left > 0) {
+		job = gzo->cur != NULL ? gzo->cur : next_job(gzo);
+		n = sizeof(job->in) - job->inlen;
+		if (n >= left) {
+			memcpy(job->in + job->inlen, buf, left);
+			job->inlen += left;
+			break;
+		}
+
+		if (job->mark > 0) {
+			/* Move the partial packet to the next member. */
+			struct gzout_job *next;
+			u_int tail = job->inlen - job->mark;
+
+			job->inlen = job->mark;
+			submit_job(gzo);
+			next = next_job(gzo);
+			memcpy(next->in, job->in + job->inlen, tail);
+			next->inlen = tail;
+			continue;
+		}
+
+		/* A packet bigger than a member. */
+		memcpy(job->in + job->inlen, buf, n);
+		job->inlen += n;
+		buf += n;
+		left -= n;
+		submit_job(gzo);
+	}
+	return size;
+}
+
+/* Write out everything and the end-of-file marker, an empty member. */
+static int
+gzout_flush_all(void *cookie)
+{
+	struct gzout *gzo = (struct gzout *) cookie;
+
+	if (gzo->cur != NULL && gzo->cur->inlen > 0)
+		submit_job(gzo);
+	while (gzo->next_write < gzo->next_fill)
+		write_job(gzo);
+
+	(void)next_job(gzo);
+	submit_job(gzo);
+	write_job(gzo);
+	return gzo->error ? -1 : 0;
+}
+
+#ifdef HAVE_FOPENCOOKIE
+static ssize_t
+cookie_write(void *cookie, const char *buf, size_t size)
+{
+	return gzout_write(cookie, buf, size);
+}
+
+static FILE *
+cookie_open(struct gzout *gzo)
+{
+	cookie_io_functions_t io = {
+		NULL, cookie_write, NULL, gzout_flush_all
+	};
+
+	return fopencookie(gzo, "w", io);
+}
+#else /* HAVE_FOPENCOOKIE */
+static int
+cookie_write(void *cookie, const char *buf, int size)
+{
+	return (int) gzout_write(cookie, buf, size < 0 ? 0 : (size_t) size);
+}
+
+static FILE *
+cookie_open(struct gzout *gzo)
+{
+	return funopen(gzo, NULL, cookie_write, NULL, gzout_flush_all);
+}
+#endif /* HAVE_FOPENCOOKIE */
+
+static void
+write_gzi(struct gzout *gzo)
+{
+	u_char buf[16];
+	size_t i;
+	FILE *fp;
+
+	if ((fp = fopen(gzo->gzi, "wb")) == NULL)
+		return;
+	put_le64(buf, gzo->nindex);
+	fwrite(buf, 1, 8, fp);
+	for (i = 0; i < gzo->nindex; i++) {
+		put_le64(buf, gzo->index[2 * i]);
+		put_le64(buf + 8, gzo->index[2 * i + 1]);
+		fwrite(buf, 1, 16, fp);
+	}
+	if (fclose(fp) == EOF)
+		(void)unlink(gzo->gzi);
+}
+
+static void
+gzout_free(struct gzout *gzo)
+{
+#ifdef HAVE_PTHREADS
+	int i;
+
+	if (gzo->nthreads > 0) {
+		pthread_mutex_lock(&gzo->lock);
+		gzo->quit = 1;
+		pthread_cond_broadcast(&gzo->filled);
+		pthread_mutex_unlock(&gzo->lock);
+		for (i = 0; i < gzo->nthreads; i++)
+			pthread_join(gzo->threads[i], NULL);
+		pthread_mutex_destroy(&gzo->lock);
+		pthread_cond_destroy(&gzo->filled);
+		pthread_cond_destroy(&gzo->done);
+	}
+	free(gzo->threads);
+#endif
+	deflateEnd(&gzo->zs);
+	if (gzo->fd > STDERR_FILENO)
+		close(gzo->fd);
+	free(gzo->gzi);
+	free(gzo->index);
+	free(gzo->jobs);
+	free(gzo);
+}
+
+struct gzout *
+gzout_open(const char *filename, int nthreads, FILE **fpp, char *errbuf)
+{
+	struct gzout *gzo;
+
+	if ((gzo = (struct gzout *) calloc(1, sizeof(struct gzout))) == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+		return NULL;
+	}
+	gzo->fd = -1;
+
+#ifndef HAVE_PTHREADS
+	nthreads = 0;
+#endif
+	/* Two at least, for gzout_write() to move a partial packet from one
+	 * to the next.
+	 */
+	gzo->njobs = nthreads > 0 ? JOBS_PER_THREAD * nthreads : 2;
+	gzo->jobs = (struct gzout_job *)
+		calloc(gzo->njobs, sizeof(struct gzout_job));
+	if (gzo->jobs == NULL || deflate_init(&gzo->zs) < 0) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+		free(gzo->jobs);
+		free(gzo);
+		return NULL;
+	}
+
+	if (! strcmp(filename, "-"))
+		gzo->fd = STDOUT_FILENO;
+	else {
+		gzo->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (gzo->fd < 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filename,
+				 strerror(errno));
+			gzout_free(gzo);
+			return NULL;
+		}
+		/* Just go without an index if this fails. */
+		if ((gzo->gzi = (char *) malloc(strlen(filename) + 5)) != NULL)
+			sprintf(gzo->gzi, "%s.gzi", filename);
+	}
+
+#ifdef HAVE_PTHREADS
+	if (nthreads > 0) {
+		pthread_mutex_init(&gzo->lock, NULL);
+		pthread_cond_init(&gzo->filled, NULL);
+		pthread_cond_init(&gzo->done, NULL);
+		gzo->threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+		for (; gzo->threads != NULL && gzo->nthreads < nthreads;
+		     gzo->nthreads++)
+			if (pthread_create(&gzo->threads[gzo->nthreads], NULL,
+					   compress_thread, gzo) != 0)
+				break;
+		/* Fewer threads than asked for, or none at all, will do. */
+		if (gzo->nthreads == 0) {
+			pthread_mutex_destroy(&gzo->lock);
+			pthread_cond_destroy(&gzo->filled);
+			pthread_cond_destroy(&gzo->done);
+		}
+	}
+#endif
+
+	if ((*fpp = cookie_open(gzo)) == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filename,
+			 strerror(errno));
+		gzout_free(gzo);
+		return NULL;
+	}
+	setvbuf(*fpp, NULL, _IONBF, 0);
+	return gzo;
+}
+
+void
+gzout_packet_end(struct gzout *gzo)
+{
+	if (gzo->cur != NULL)
+		gzo->cur->mark = gzo->cur->inlen;
+}
+
+int
+gzout_close(struct gzout *gzo)
+{
+	int error = gzo->error;
+
+	if (! error && gzo->gzi != NULL)
+		write_gzi(gzo);
+	gzout_free(gzo);
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+#else /* HAVE_LIBZ ... */
+
+struct gzout *
+gzout_open(const char *filename _U_, int nthreads _U_, FILE **fpp _U_,
+	   char *errbuf)
+{
+	snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		 "compressed output is not supported in this build");
+	return NULL;
+}
+
+void
+gzout_packet_end(struct gzout *gzo _U_)
+{
+}
+
+int
+gzout_close(struct gzout *gzo _U_)
+{
+	return 0;
+}
+
+#endif /* HAVE_LIBZ ... */
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * histogram.c - the packet counts of the -H option
+ *
+ * Only the headers of the packets of the window are read, and nothing is
+ * written but the counts of packets, of bytes on the wire and of bytes
+ * captured per interval of time, their totals, and how many packets had
+ * each range of captured length.  The intervals are aligned on multiples
+ * of their length since the epoch, and only those with packets are
+ * printed, as they are done with.  As the data is not read, duplicates
+ * cannot be told apart and are all counted, as with -D.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+
+/* Captured lengths by powers of 2, from 0-63 up to 131072 and more. */
+#define CAPLEN_SHIFT	6
+#define CAPLEN_BUCKETS	13
+
+struct counts {
+	uint64_t	packets;
+	uint64_t	bytes;		/* on the wire */
+	uint64_t	captured;
+};
+
+static void
+counts_add(struct counts *c, const struct pcap_pkthdr *hdr)
+{
+	++c->packets;
+	c->bytes += hdr->len;
+	c->captured += hdr->caplen;
+}
+
+static int
+caplen_bucket(bpf_u_int32 caplen)
+{
+	int i = 0;
+
+	for (caplen >>= CAPLEN_SHIFT; caplen != 0 && i < CAPLEN_BUCKETS - 1;
+	     caplen >>= 1)
+		++i;
+	return i;
+}
+
+static void
+print_interval(FILE *f, const enum stats_format format, const time_t start,
+	       const struct counts *c, const int first)
+{
+	if (format == STATS_TEXT)
+		fprintf(f, "%-12" PRId64 " %14" PRIu64 " %18" PRIu64 " %18" PRIu64
+			"\n", (int64_t) start, c->packets, c->bytes,
+			c->captured);
+	else
+		fprintf(f, "%s{\"start\": %" PRId64 ", \"packets\": %" PRIu64
+			", \"bytes\": %" PRIu64 ", \"captured\": %" PRIu64 "}",
+			first ? "\n  " : ",\n  ", (int64_t) start, c->packets,
+			c->bytes, c->captured);
+}
+
+void
+histogram(FILE *f, const enum stats_format format, tcpslice_t *t,
+	  const struct timeval *start_time, const struct timeval *stop_time,
+	  const time_t interval)
+{
+	struct counts current, total;
+	uint64_t caplens[CAPLEN_BUCKETS];
+	struct pcap_pkthdr *hdr;
+	const u_char *pkt;
+	time_t current_start = 0, packet_start;
+	int status, i, printed = 0;
+
+	memset(&current, 0, sizeof(current));
+	memset(&total, 0, sizeof(total));
+	memset(caplens, 0, sizeof(caplens));
+
+	if (tcpslice_set_headers_only(t, 1) < 0 ||
+	    tcpslice_setwindow(t, start_time, stop_time) < 0)
+		error("%s", tcpslice_geterr(t));
+
+	if (format == STATS_TEXT)
+		fprintf(f, "%-12s %14s %18s %18s\n", "interval", "packets",
+			"bytes", "captured");
+	else
+		fprintf(f, "{\n\"interval\": %" PRId64 ",\n\"intervals\": [",
+			(int64_t) interval);
+
+	while ((status = tcpslice_next(t, &hdr, &pkt)) == 1) {
+		packet_start = hdr->ts.tv_sec - hdr->ts.tv_sec % interval;
+		/* Packets come in time order, but be safe. */
+		if (current.packets && packet_start > current_start) {
+			print_interval(f, format, current_start, &current,
+				       ! printed++);
+			memset(&current, 0, sizeof(current));
+		}
+		if (! current.packets)
+			current_start = packet_start;
+		counts_add(&current, hdr);
+		counts_add(&total, hdr);
+		++caplens[caplen_bucket(hdr->caplen)];
+	}
+	if (status == -1)
+		error("%s", tcpslice_geterr(t));
+	if (current.packets)
+		print_interval(f, format, current_start, &current, ! printed++);
+
+	if (format == STATS_TEXT) {
+		fprintf(f, "%-12s %14" PRIu64 " %18" PRIu64 " %18" PRIu64 "\n",
+			"total", total.packets, total.bytes, total.captured);
+		fprintf(f, "\n%-12s %14s\n", "caplen", "packets");
+		for (i = 0; i < CAPLEN_BUCKETS; i++) {
+			char range[32];
+
+			if (i < CAPLEN_BUCKETS - 1)
+				snprintf(range, sizeof(range), "%u-%u",
+					 i ? 1u << (CAPLEN_SHIFT + i - 1) : 0,
+					 (1u << (CAPLEN_SHIFT + i)) - 1);
+			else
+				snprintf(range, sizeof(range), "%u-",
+					 1u << (CAPLEN_SHIFT + i - 1));
+			fprintf(f, "%-12s %14" PRIu64 "\n", range, caplens[i]);
+		}
+		return;
+	}
+	fprintf(f, "],\n\"total\": {\"packets\": %" PRIu64 ", \"bytes\": %"
+		PRIu64 ", \"captured\": %" PRIu64 "},\n\"caplen\": [",
+		total.packets, total.bytes, total.captured);
+	for (i = 0; i < CAPLEN_BUCKETS; i++) {
+		fprintf(f, "%s{\"min\": %u, ", i ? ",\n  " : "\n  ",
+			i ? 1u << (CAPLEN_SHIFT + i - 1) : 0);
+		if (i < CAPLEN_BUCKETS - 1)
+			fprintf(f, "\"max\": %u, ",
+				(1u << (CAPLEN_SHIFT + i)) - 1);
+		fprintf(f, "\"packets\": %" PRIu64 "}", caplens[i]);
+	}
+	fprintf(f, "]\n}\n");
+}
@@ -29,10 +29,17 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <config.h>
+
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include <bfd.h>
 
 /*
@@ -53,6 +60,7 @@
  * unset or set to an empty string, print nothing, like with no instrumentation
  * set to "all" or "a", print all the functions names
  * set to "global" or "g", print only the global functions names
+ * set to "profile" or "p", print nothing but profile the run, see below
  */
 
 #define ND_NO_INSTRUMENT __attribute__((no_instrument_function))
@@ -66,37 +74,136 @@ typedef enum {
 	EXIT
 } action_type;
 
+typedef enum {
+	INSTRUMENT_UNSET,
+	INSTRUMENT_OFF,
+	INSTRUMENT_ALL,
+	INSTRUMENT_GLOBAL,
+	INSTRUMENT_PROFILE
+} instrument_mode;
+
+/*
+ * The profile mode keeps, for each thread, the tree of the calling
+ * contexts met: a node per function called from the context of its
+ * parent node, with the number of calls, and the time spent in them
+ * with (inclusive) and without (exclusive) the time of the calls they
+ * made, in ticks of the time stamp counter where there is one and in
+ * nanoseconds otherwise.  Entering and leaving a function costs a hash
+ * table lookup and two reads of the clock, and nothing is printed nor
+ * looked up in the symbols until the program exits.  Then
+ *  - <prefix>.profile gets the flat profile, with the calls and the
+ *    inclusive and exclusive time of each function, and the calls and
+ *    inclusive time of each caller -> callee edge
+ *  - <prefix>.folded gets the exclusive time of each calling context in
+ *    nanoseconds, one "main;f;g 1234" line each, the collapsed stacks
+ *    that flame graph tools take
+ * where <prefix> is the value of the environment variable
+ * INSTRUMENT_PROFILE, or tcpslice.<pid> by default.
+ */
+#define PROFILE_ROOT UINT32_MAX	/* the parent of the outermost calls */
+
+struct profile_node {
+	void		*fn;
+	uint32_t	parent;
+	uint64_t	calls;
+	uint64_t	inclusive;
+	uint64_t	exclusive;
+};
+
+struct profile_frame {
+	uint32_t	node;
+	uint64_t	start;
+	uint64_t	children;	/* time of the calls it made */
+};
+
+struct profile_thread {
+	struct profile_node *nodes;
+	uint32_t	node_count;
+	uint32_t	node_size;
+	uint32_t	*table;		/* node + 1 by hash of parent and fn */
+	uint32_t	table_size;	/* a power of 2, 0 for a free slot */
+	struct profile_frame *stack;
+	uint32_t	depth;
+	uint32_t	stack_size;
+	struct profile_thread *next;
+};
+
+/* What the report adds up for a function, or for an edge if caller is set. */
+struct profile_func {
+	void		*caller;
+	void		*fn;
+	uint64_t	calls;
+	uint64_t	inclusive;
+	uint64_t	exclusive;
+};
+
+static __thread struct profile_thread *profile_self;
+static struct profile_thread *profile_threads;
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static uint64_t profile_start_ticks;
+static uint64_t profile_start_ns;
+
+/* The symbols of the program, loaded by load_symbols(). */
+static bfd* abfd;
+static asymbol **symtab;
+static long symcount;
+static asection *text;
+static bfd_vma vma;
+
 void __cyg_profile_func_enter(void *this_fn, void *call_site) ND_NO_INSTRUMENT;
 
 void __cyg_profile_func_exit(void *this_fn, void *call_site) ND_NO_INSTRUMENT;
 
+static instrument_mode get_mode(void) ND_NO_INSTRUMENT;
+static int load_symbols(void) ND_NO_INSTRUMENT;
 static void print_debug(void *this_fn, void *call_site, action_type action)
 	ND_NO_INSTRUMENT;
+static uint64_t profile_ns(void) ND_NO_INSTRUMENT;
+static uint64_t profile_ticks(void) ND_NO_INSTRUMENT;
+static void *profile_grow(void *array, uint32_t *size, const size_t elt_size)
+	ND_NO_INSTRUMENT;
+static struct profile_thread *profile_thread_new(void) ND_NO_INSTRUMENT;
+static uint32_t profile_hash(const uint32_t parent, const void *fn)
+	ND_NO_INSTRUMENT;
+static void profile_rehash(struct profile_thread *pt) ND_NO_INSTRUMENT;
+static uint32_t profile_node(struct profile_thread *pt, const uint32_t parent,
+	void *fn) ND_NO_INSTRUMENT;
+static void profile_enter(void *this_fn) ND_NO_INSTRUMENT;
+static void profile_exit(void) ND_NO_INSTRUMENT;
+static const char *profile_name(void *fn) ND_NO_INSTRUMENT;
+static int profile_func_cmp(const void *a, const void *b) ND_NO_INSTRUMENT;
+static int profile_time_cmp(const void *a, const void *b) ND_NO_INSTRUMENT;
+static struct profile_func *profile_sum(int edges, size_t *count)
+	ND_NO_INSTRUMENT;
+static void profile_folded(FILE *f, const struct profile_thread *pt,
+	uint32_t n, const double ns_per_tick) ND_NO_INSTRUMENT;
+static void profile_report(void) ND_NO_INSTRUMENT;
 
 void
 __cyg_profile_func_enter(void *this_fn, void *call_site)
 {
-	print_debug(this_fn, call_site, ENTER);
+	if (get_mode() == INSTRUMENT_PROFILE)
+		profile_enter(this_fn);
+	else
+		print_debug(this_fn, call_site, ENTER);
 }
 
 void
 __cyg_profile_func_exit(void *this_fn, void *call_site)
 {
-	print_debug(this_fn, call_site, EXIT);
+	if (get_mode() == INSTRUMENT_PROFILE)
+		profile_exit();
+	else
+		print_debug(this_fn, call_site, EXIT);
 }
 
-static void print_debug(void *this_fn, void *call_site, action_type action)
+static instrument_mode get_mode(void)
 {
-	static bfd* abfd;
-	static asymbol **symtab;
-	static long symcount;
-	static asection *text;
-	static bfd_vma vma;
-	static int instrument_set;
-	static int instrument_off;
-	static int instrument_global;
-
-	if (!instrument_set) {
+	static instrument_mode mode = INSTRUMENT_UNSET;
+
+	if (mode == INSTRUMENT_UNSET) {
 		static char *instrument_type;
 
 		/* Get the configuration environment variable INSTRUMENT value if any */
@@ -104,76 +211,100 @@ static void print_debug(void *this_fn, void *call_site, action_type action)
 		/* unset or set to an empty string ? */
 		if (instrument_type == NULL ||
 			!strncmp(instrument_type, "", sizeof(""))) {
-			instrument_off = 1;
+			mode = INSTRUMENT_OFF;
 		} else {
 			/* set to "global" or "g" ? */
 			if (!strncmp(instrument_type, "global", sizeof("global")) ||
 				!strncmp(instrument_type, "g", sizeof("g")))
-				instrument_global = 1;
-			else if (strncmp(instrument_type, "all", sizeof("all")) &&
-					 strncmp(instrument_type, "a", sizeof("a"))) {
+				mode = INSTRUMENT_GLOBAL;
+			else if (!strncmp(instrument_type, "profile", sizeof("profile")) ||
+					 !strncmp(instrument_type, "p", sizeof("p")))
+				mode = INSTRUMENT_PROFILE;
+			else if (!strncmp(instrument_type, "all", sizeof("all")) ||
+					 !strncmp(instrument_type, "a", sizeof("a")))
+				mode = INSTRUMENT_ALL;
+			else {
 				fprintf(stderr, "INSTRUMENT can be only \"\", \"all\", \"a\", "
-						"\"global\" or \"g\".\n");
+						"\"global\", \"g\", \"profile\" or \"p\".\n");
 				exit(1);
 			}
 		}
-		instrument_set = 1;
 	}
+	return mode;
+}
 
-	if (instrument_off)
-			return;
+/* Returns 1 if the symbols are loaded, 0 if they cannot be. */
+static int load_symbols(void)
+{
+	static int failed;
+	char pgm_name[1024];
+	long symsize;
 
 	/* If no errors, this block should be executed one time */
+	if (abfd && text)
+		return 1;
+	if (failed)
+		return 0;
+	failed = 1;
+
+	ssize_t ret = readlink("/proc/self/exe", pgm_name, sizeof(pgm_name));
+	if (ret == -1) {
+		perror("failed to find executable");
+		return 0;
+	}
+	if (ret == sizeof(pgm_name)) {
+		/* no space for the '\0' */
+		printf("truncation may have occurred\n");
+		return 0;
+	}
+	pgm_name[ret] = '\0';
+
+	bfd_init();
+
+	abfd = bfd_openr(pgm_name, NULL);
 	if (!abfd) {
-		char pgm_name[1024];
-		long symsize;
+		bfd_perror("bfd_openr");
+		return 0;
+	}
 
-		ssize_t ret = readlink("/proc/self/exe", pgm_name, sizeof(pgm_name));
-		if (ret == -1) {
-			perror("failed to find executable");
-			return;
-		}
-		if (ret == sizeof(pgm_name)) {
-			/* no space for the '\0' */
-			printf("truncation may have occurred\n");
-			return;
-		}
-		pgm_name[ret] = '\0';
+	if (!bfd_check_format(abfd, bfd_object)) {
+		bfd_perror("bfd_check_format");
+		return 0;
+	}
 
-		bfd_init();
+	if((symsize = bfd_get_symtab_upper_bound(abfd)) == -1) {
+		bfd_perror("bfd_get_symtab_upper_bound");
+		return 0;
+	}
 
-		abfd = bfd_openr(pgm_name, NULL);
-		if (!abfd) {
-			bfd_perror("bfd_openr");
-			return;
-		}
+	symtab = (asymbol **)malloc((size_t)symsize);
+	symcount = bfd_canonicalize_symtab(abfd, symtab);
+	if (symcount < 0) {
+		free(symtab);
+		bfd_perror("bfd_canonicalize_symtab");
+		return 0;
+	}
 
-		if (!bfd_check_format(abfd, bfd_object)) {
-			bfd_perror("bfd_check_format");
-			return;
-		}
+	if ((text = bfd_get_section_by_name(abfd, ".text")) == NULL) {
+		bfd_perror("bfd_get_section_by_name");
+		return 0;
+	}
+	vma = text->vma;
+	failed = 0;
+	return 1;
+}
 
-		if((symsize = bfd_get_symtab_upper_bound(abfd)) == -1) {
-			bfd_perror("bfd_get_symtab_upper_bound");
-			return;
-		}
+static void print_debug(void *this_fn, void *call_site, action_type action)
+{
+	instrument_mode mode = get_mode();
 
-		symtab = (asymbol **)malloc((size_t)symsize);
-		symcount = bfd_canonicalize_symtab(abfd, symtab);
-		if (symcount < 0) {
-			free(symtab);
-			bfd_perror("bfd_canonicalize_symtab");
+	if (mode == INSTRUMENT_OFF)
 			return;
-		}
 
-		if ((text = bfd_get_section_by_name(abfd, ".text")) == NULL) {
-			bfd_perror("bfd_get_section_by_name");
-			return;
-		}
-		vma = text->vma;
-	}
+	if (!load_symbols())
+		return;
 
-	if (instrument_global) {
+	if (mode == INSTRUMENT_GLOBAL) {
 		symbol_info syminfo;
 		int found;
 		long i;
@@ -265,4 +396,339 @@ static void print_debug(void *this_fn, void *call_site, action_type action)
 	fflush(stdout);
 }
 
+
+static uint64_t profile_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return profile_ns();
+#endif
+}
+
+/* Double the size of an array, which must not fail. */
+static void *profile_grow(void *array, uint32_t *size, const size_t elt_size)
+{
+	*size = *size ? *size * 2 : 1024;
+	array = realloc(array, *size * elt_size);
+	if (array == NULL) {
+		fprintf(stderr, "out of memory for the profile\n");
+		exit(1);
+	}
+	return array;
+}
+
+static struct profile_thread *profile_thread_new(void)
+{
+	struct profile_thread *pt;
+	int first;
+
+	pt = (struct profile_thread *)calloc(1, sizeof(*pt));
+	if (pt == NULL) {
+		fprintf(stderr, "out of memory for the profile\n");
+		exit(1);
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&profile_lock);
+#endif
+	first = profile_threads == NULL;
+	pt->next = profile_threads;
+	profile_threads = pt;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&profile_lock);
+#endif
+	if (first) {
+		profile_start_ns = profile_ns();
+		profile_start_ticks = profile_ticks();
+		atexit(profile_report);
+	}
+	profile_self = pt;
+	return pt;
+}
+
+static uint32_t profile_hash(const uint32_t parent, const void *fn)
+{
+	uint64_t h = ((uint64_t)(uintptr_t)fn >> 4) ^ ((uint64_t)parent << 32);
+
+	h *= 0x9e3779b97f4a7c15ULL;
+	return (uint32_t)(h >> 32);
+}
+
+static void profile_rehash(struct profile_thread *pt)
+{
+	uint32_t mask, i, n;
+
+	free(pt->table);
+	pt->table = NULL;
+	pt->table = (uint32_t *)profile_grow(NULL, &pt->table_size,
+		sizeof(*pt->table));
+	memset(pt->table, 0, pt->table_size * sizeof(*pt->table));
+	mask = pt->table_size - 1;
+	for (n = 0; n < pt->node_count; n++) {
+		i = profile_hash(pt->nodes[n].parent, pt->nodes[n].fn) & mask;
+		while (pt->table[i] != 0)
+			i = (i + 1) & mask;
+		pt->table[i] = n + 1;
+	}
+}
+
+/* The node of the calls of fn from the context of parent, new or not. */
+static uint32_t profile_node(struct profile_thread *pt, const uint32_t parent,
+	void *fn)
+{
+	struct profile_node *node;
+	uint32_t mask, i, n;
+
+	if (pt->node_count * 2 >= pt->table_size)
+		profile_rehash(pt);
+	mask = pt->table_size - 1;
+	for (i = profile_hash(parent, fn) & mask; (n = pt->table[i]) != 0;
+		 i = (i + 1) & mask) {
+		node = &pt->nodes[n - 1];
+		if (node->parent == parent && node->fn == fn)
+			return n - 1;
+	}
+	if (pt->node_count == pt->node_size)
+		pt->nodes = (struct profile_node *)profile_grow(pt->nodes,
+			&pt->node_size, sizeof(*pt->nodes));
+	node = &pt->nodes[pt->node_count];
+	memset(node, 0, sizeof(*node));
+	node->fn = fn;
+	node->parent = parent;
+	pt->table[i] = pt->node_count + 1;
+	return pt->node_count++;
+}
+
+static void profile_enter(void *this_fn)
+{
+	struct profile_thread *pt = profile_self;
+	struct profile_frame *frame;
+	uint32_t parent;
+
+	if (pt == NULL)
+		pt = profile_thread_new();
+	if (pt->depth == pt->stack_size)
+		pt->stack = (struct profile_frame *)profile_grow(pt->stack,
+			&pt->stack_size, sizeof(*pt->stack));
+	parent = pt->depth ? pt->stack[pt->depth - 1].node : PROFILE_ROOT;
+	frame = &pt->stack[pt->depth];
+	frame->node = profile_node(pt, parent, this_fn);
+	frame->children = 0;
+	++pt->depth;
+	/* Last, so as not to count the lookup. */
+	frame->start = profile_ticks();
+}
+
+static void profile_exit(void)
+{
+	uint64_t now = profile_ticks();
+	struct profile_thread *pt = profile_self;
+	struct profile_frame *frame;
+	struct profile_node *node;
+	uint64_t elapsed;
+
+	if (pt == NULL || pt->depth == 0)
+		return;
+	frame = &pt->stack[--pt->depth];
+	elapsed = now - frame->start;
+	node = &pt->nodes[frame->node];
+	++node->calls;
+	node->inclusive += elapsed;
+	node->exclusive += elapsed - frame->children;
+	if (pt->depth)
+		pt->stack[pt->depth - 1].children += elapsed;
+}
+
+/* The name of a function, or its address if it has none that is known.
+ * The result is valid until the next call.
+ */
+static const char *profile_name(void *fn)
+{
+	static char buf[2 * sizeof(void *) + 3];
+	const char *file;
+	const char *func;
+	unsigned int line;
+
+	if (load_symbols() && (bfd_vma)fn >= vma &&
+		bfd_find_nearest_line(abfd, text, symtab, (bfd_vma)fn - vma,
+							  &file, &func, &line) &&
+		func != NULL && *func != '\0')
+		return func;
+	snprintf(buf, sizeof(buf), "%p", fn);
+	return buf;
+}
+
+static int profile_func_cmp(const void *a, const void *b)
+{
+	const struct profile_func *fa = (const struct profile_func *)a;
+	const struct profile_func *fb = (const struct profile_func *)b;
+
+	if (fa->caller != fb->caller)
+		return (uintptr_t)fa->caller < (uintptr_t)fb->caller ? -1 : 1;
+	if (fa->fn != fb->fn)
+		return (uintptr_t)fa->fn < (uintptr_t)fb->fn ? -1 : 1;
+	return 0;
+}
+
+/* The most exclusive time first, or the most inclusive time for edges. */
+static int profile_time_cmp(const void *a, const void *b)
+{
+	const struct profile_func *fa = (const struct profile_func *)a;
+	const struct profile_func *fb = (const struct profile_func *)b;
+	uint64_t ta = fa->caller ? fa->inclusive : fa->exclusive;
+	uint64_t tb = fb->caller ? fb->inclusive : fb->exclusive;
+
+	return ta > tb ? -1 : ta < tb;
+}
+
+/* Add up the nodes of all the threads by function, or by edge.  The
+ * inclusive time of a function, or of an edge, only counts its outermost
+ * calls, so that the time of recursive calls is not counted twice.
+ */
+static struct profile_func *profile_sum(int edges, size_t *count)
+{
+	struct profile_thread *pt;
+	struct profile_func *funcs, *f;
+	const struct profile_node *node;
+	size_t size = 0, n = 0, i, j;
+	uint32_t k, a;
+	int outermost;
+
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+		size += pt->node_count;
+	funcs = (struct profile_func *)calloc(size ? size : 1, sizeof(*funcs));
+	if (funcs == NULL) {
+		*count = 0;
+		return NULL;
+	}
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+		for (k = 0; k < pt->node_count; k++) {
+			node = &pt->nodes[k];
+			if (edges && node->parent == PROFILE_ROOT)
+				continue;
+			f = &funcs[n++];
+			f->caller = edges ? pt->nodes[node->parent].fn : NULL;
+			f->fn = node->fn;
+			f->calls = node->calls;
+			f->exclusive = node->exclusive;
+			outermost = 1;
+			for (a = node->parent; a != PROFILE_ROOT && outermost;
+				 a = pt->nodes[a].parent)
+				if (pt->nodes[a].fn == f->fn && (!edges ||
+					(pt->nodes[a].parent != PROFILE_ROOT &&
+					 pt->nodes[pt->nodes[a].parent].fn == f->caller)))
+					outermost = 0;
+			if (outermost)
+				f->inclusive = node->inclusive;
+		}
+	qsort(funcs, n, sizeof(*funcs), profile_func_cmp);
+	for (i = 0, j = 0; i < n; i++) {
+		if (j > 0 && !profile_func_cmp(&funcs[j - 1], &funcs[i])) {
+			funcs[j - 1].calls += funcs[i].calls;
+			funcs[j - 1].inclusive += funcs[i].inclusive;
+			funcs[j - 1].exclusive += funcs[i].exclusive;
+		} else
+			funcs[j++] = funcs[i];
+	}
+	qsort(funcs, j, sizeof(*funcs), profile_time_cmp);
+	*count = j;
+	return funcs;
+}
+
+/* Print the calling context of a node, outermost call first. */
+static void profile_folded(FILE *f, const struct profile_thread *pt,
+	uint32_t n, const double ns_per_tick)
+{
+	const struct profile_node *node = &pt->nodes[n];
+	uint32_t path[256];
+	uint32_t depth = 0;
+	uint32_t a;
+
+	if (node->exclusive == 0)
+		return;
+	for (a = n; a != PROFILE_ROOT && depth < 256; a = pt->nodes[a].parent)
+		path[depth++] = a;
+	while (depth > 0) {
+		fputs(profile_name(pt->nodes[path[--depth]].fn), f);
+		fputc(depth ? ';' : ' ', f);
+	}
+	fprintf(f, "%.0f\n", node->exclusive * ns_per_tick);
+}
+
+static void profile_report(void)
+{
+	struct profile_thread *pt;
+	struct profile_func *funcs;
+	size_t count, i;
+	char name[1024];
+	const char *prefix;
+	char *suffix;
+	double ns_per_tick, total = 0;
+	uint64_t ticks;
+	uint32_t n;
+	FILE *f;
+
+	/* The calls still in progress in this thread, at least main(),
+	 * end now.
+	 */
+	while (profile_self != NULL && profile_self->depth > 0)
+		profile_exit();
+
+	ticks = profile_ticks() - profile_start_ticks;
+	ns_per_tick = ticks ? (double)(profile_ns() - profile_start_ns) / ticks : 1;
+	prefix = getenv("INSTRUMENT_PROFILE");
+	if (prefix != NULL && *prefix != '\0')
+		snprintf(name, sizeof(name) - 8, "%s", prefix);
+	else
+		snprintf(name, sizeof(name) - 8, "tcpslice.%ld", (long)getpid());
+	suffix = name + strlen(name);
+
+	strcpy(suffix, ".profile");
+	if ((f = fopen(name, "w")) == NULL) {
+		perror(name);
+		return;
+	}
+	funcs = profile_sum(0, &count);
+	for (i = 0; i < count; i++)
+		total += funcs[i].exclusive;
+	fprintf(f, "%% excl  exclusive ms  inclusive ms         calls  function\n");
+	for (i = 0; i < count; i++)
+		fprintf(f, "%6.2f %13.3f %13.3f %13llu  %s\n",
+			total ? 100 * funcs[i].exclusive / total : 0.0,
+			funcs[i].exclusive * ns_per_tick / 1e6,
+			funcs[i].inclusive * ns_per_tick / 1e6,
+			(unsigned long long)funcs[i].calls,
+			profile_name(funcs[i].fn));
+	free(funcs);
+	funcs = profile_sum(1, &count);
+	fprintf(f, "\n inclusive ms         calls  caller -> callee\n");
+	for (i = 0; i < count; i++) {
+		fprintf(f, "%13.3f %13llu  %s -> ",
+			funcs[i].inclusive * ns_per_tick / 1e6,
+			(unsigned long long)funcs[i].calls,
+			profile_name(funcs[i].caller));
+		fprintf(f, "%s\n", profile_name(funcs[i].fn));
+	}
+	free(funcs);
+	fclose(f);
+
+	strcpy(suffix, ".folded");
+	if ((f = fopen(name, "w")) == NULL) {
+		perror(name);
+		return;
+	}
+	for (pt = profile_threads; pt != NULL; pt = pt->next)
+		for (n = 0; n < pt->node_count; n++)
+			profile_folded(f, pt, n, ns_per_tick);
+	fclose(f);
+}
+
 /* vi: set tabstop=4 softtabstop=0 shiftwidth=4 smarttab autoindent : */
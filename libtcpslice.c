@@ -0,0 +1,843 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * libtcpslice.c - open, position and merge pcap savefiles
+ *
+ * This is what used to be open_files() and extract_slice() in tcpslice.c,
+ * with the state that was global kept in the handle instead and with the
+ * errors returned to the caller rather than terminating the program.
+ */
+
+#include <config.h>
+
+// For fileno().
+#if defined(__SUNPRO_C) && ! defined(__EXTENSIONS__)
+#define __EXTENSIONS__
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+#include "libtcpslice.h"
+
+/* Before libpcap 1.1. */
+#ifndef PCAP_NETMASK_UNKNOWN
+#define PCAP_NETMASK_UNKNOWN 0xffffffff
+#endif
+
+/* The structure used to keep track of files being merged. */
+struct tcpslice_file {
+	int64_t	start_pos,	/* seek position corresponding to start time */
+		stop_pos;	/* seek position corresponding to stop time */
+	struct timeval
+		file_start_time,	/* time of first pkt in file */
+		file_stop_time,		/* time of last pkt in file */
+		last_pkt_time;		/* time of most recently read pkt */
+	pcap_t	*p;
+	struct pcap_pkthdr hdr;
+	const u_char *pkt;
+	char	*filename;
+	int	streaming;	/* cannot seek, so read forward only */
+	int	headers_only;	/* skip the data of the packets */
+	int	nsec;		/* nanosecond timestamps, for headers_only */
+	int	done;
+	struct tcpslice_file_stats stats;
+};
+
+struct tcpslice {
+	struct tcpslice_file *files;
+	int	numfiles;
+	int	snaplen;		/* largest snapshot length of the files */
+	int	keep_dups;
+	int	relative_time_merge;
+	int	positioned;		/* tcpslice_setwindow() was called */
+	int	timing;			/* tcpslice_set_timing() */
+	int	filtering;		/* tcpslice_setfilter() */
+	struct bpf_program filter;
+	struct timeval
+		base_time,		/* lowest start time of the files */
+		stop_time,
+		relative_stop;
+	struct tcpslice_file *cur;	/* file of the packet last returned */
+	struct tcpslice_file *prev;	/* even once it moved past it */
+	struct tcpslice_stats stats;
+
+	struct tcpslice_file *last_file;	/* remember the last packet */
+	struct pcap_pkthdr last_hdr;		/* in order to remove duplicates */
+	u_char	*last_pkt;
+	u_int	last_pkt_size;
+
+	char	errbuf[PCAP_ERRBUF_SIZE];
+};
+
+/* Read the clocks: the wall clock, and the CPU time of the calling thread
+ * where it can be told apart, or else that of the process.
+ */
+static void
+stats_clock_read(struct stats_clock *c)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	c->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	c->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	c->cpu = (double) clock() / CLOCKS_PER_SEC;
+#endif
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	c->wall = tv.tv_sec + tv.tv_usec / 1e6;
+	c->cpu = (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+void
+stats_clock_start(struct stats_clock *c)
+{
+	stats_clock_read(c);
+}
+
+void
+stats_clock_stop(const struct stats_clock *c, struct tcpslice_time *t)
+{
+	struct stats_clock now;
+
+	stats_clock_read(&now);
+	t->wall += now.wall - c->wall;
+	t->cpu += now.cpu - c->cpu;
+	++t->count;
+}
+
+/* Get the next record in a file.  Deal with end of file.
+ *
+ * This routine also prevents time from going "backwards"
+ * within a single file.
+ */
+static void
+get_next_packet(struct tcpslice_file *f)
+{
+	struct timeval tvbuf;
+
+	for (;;) {
+		if (f->headers_only) {
+			char errbuf[PCAP_ERRBUF_SIZE];
+
+			/* A read error ends the file, as with pcap_next(). */
+			f->pkt = NULL;
+			if (sf_next_header(f->p, &f->hdr, f->nsec, errbuf) < 1) {
+				f->done = 1;
+				pcap_close(f->p);
+				f->p = NULL;
+				return;
+			}
+			++f->stats.packets_read;
+			f->stats.bytes_read += PCAP_RECORD_HDR_LEN;
+		} else {
+			f->pkt = pcap_next(f->p, &f->hdr);
+			if (! f->pkt) {
+				f->done = 1;
+				pcap_close(f->p);
+				f->p = NULL;
+				return;
+			}
+			++f->stats.packets_read;
+			f->stats.bytes_read += PCAP_RECORD_HDR_LEN + f->hdr.caplen;
+		}
+		TIMEVAL_FROM_PKTHDR_TS(tvbuf, f->hdr.ts);
+		if (! sf_timestamp_less_than(&tvbuf, &f->last_pkt_time))
+			break;
+		++f->stats.dropped;
+	}
+
+	f->last_pkt_time = tvbuf;
+}
+
+/* The stop time of a file whose end is not known, as late as a pcap file
+ * can hold, or as time_t can hold if that is less.
+ */
+static void
+unknown_stop_time(struct timeval *tv)
+{
+	tv->tv_sec = sizeof(time_t) > 4 ? (time_t) UINT32_MAX : (time_t) INT32_MAX;
+	tv->tv_usec = 999999;
+}
+
+/* Open a savefile, compressed or not, and tell whether it can seek: a pipe,
+ * a socket, a terminal or a compressed file other than BGZF can only be
+ * read forward.
+ */
+pcap_t *
+savefile_open(const char *filename, int *seekable, char *errbuf)
+{
+	FILE *fp;
+	pcap_t *p;
+
+	if (strcmp(filename, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(filename, "rb")) == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filename,
+			 strerror(errno));
+		return NULL;
+	}
+	/* Ask the descriptor, not stdio, so that its buffer is left alone. */
+	*seekable = lseek(fileno(fp), 0, SEEK_CUR) >= 0;
+
+	/* A stream that is decompressed, if it is compressed. */
+	if ((fp = gzfile_open(fp, filename, seekable, errbuf)) == NULL)
+		return NULL;
+	if ((p = pcap_fopen_offline(fp, errbuf)) == NULL)
+		fclose(fp);
+	return p;
+}
+
+static int
+open_file(tcpslice_t *t, struct tcpslice_file *f, char *errbuf)
+{
+	struct file_meta meta;
+	struct stats_clock clock;
+	FILE *pf;
+	int seekable;
+	int found;
+
+	f->p = savefile_open(f->filename, &seekable, errbuf);
+	if (! f->p) {
+		char msg[PCAP_ERRBUF_SIZE];
+
+		strcpy(msg, errbuf);
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "bad pcap file %s: %s",
+			 f->filename, msg);
+		return -1;
+	}
+
+	int this_snap = pcap_snapshot(f->p);
+	if (this_snap > t->snaplen)
+		t->snaplen = this_snap;
+
+	/* Without seeking there is no end to find, and the first packet is
+	 * the first one to return.
+	 */
+	if (! seekable) {
+		f->streaming = 1;
+		if ((f->pkt = pcap_next(f->p, &f->hdr)) == NULL) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+				 "error reading packet in %s: %s",
+				 f->filename, pcap_geterr(f->p));
+			return -1;
+		}
+		++f->stats.packets_read;
+		f->stats.bytes_read += PCAP_RECORD_HDR_LEN + f->hdr.caplen;
+		TIMEVAL_FROM_PKTHDR_TS(f->file_start_time, f->hdr.ts);
+		f->last_pkt_time = f->file_start_time;
+		unknown_stop_time(&f->file_stop_time);
+		return 0;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	/* Only a hint, so it does not matter whether it works. */
+	pf = pcap_file(f->p);
+	if (pf != NULL && fileno(pf) != -1) {
+		(void)posix_fadvise(fileno(pf), 0, 0, POSIX_FADV_RANDOM);
+		(void)posix_fadvise(fileno(pf), 0, 0, POSIX_FADV_NOREUSE);
+	}
+#endif
+
+	/* The server may know already where the packets are. */
+	if (cache_lookup(f->filename, &meta)) {
+		f->start_pos = meta.start_pos;
+		f->stop_pos = meta.stop_pos;
+		f->file_start_time = meta.start_time;
+		f->file_stop_time = meta.stop_time;
+		return 0;
+	}
+
+	f->start_pos = ftell64(pcap_file(f->p));
+
+	if (pcap_next(f->p, &f->hdr) == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "error reading packet in %s: %s",
+			 f->filename, pcap_geterr(f->p));
+		return -1;
+	}
+	++f->stats.packets_read;
+	f->stats.bytes_read += PCAP_RECORD_HDR_LEN + f->hdr.caplen;
+
+	TIMEVAL_FROM_PKTHDR_TS(f->file_start_time, f->hdr.ts);
+
+	stats_clock_start(&clock);
+	found = sf_find_end(f->p, this_snap, &f->file_start_time,
+			    &f->file_stop_time, &f->stats);
+	stats_clock_stop(&clock, &f->stats.find_end);
+	if (! found) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			 "problems finding end packet of file %s", f->filename);
+		return -1;
+	}
+
+	f->stop_pos = ftell64(pcap_file(f->p));
+	return 0;
+}
+
+tcpslice_t *
+tcpslice_open(char *const filenames[], const int numfiles, char *errbuf)
+{
+	tcpslice_t *t;
+	struct stats_clock clock;
+	int i, status;
+
+	if (numfiles <= 0) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "no input files specified");
+		return NULL;
+	}
+
+	t = (tcpslice_t *) calloc(1, sizeof(tcpslice_t));
+	if (t != NULL)
+		t->files = (struct tcpslice_file *)
+			calloc(numfiles, sizeof(struct tcpslice_file));
+	if (t == NULL || t->files == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			 "unable to allocate memory for %d input files", numfiles);
+		free(t);
+		return NULL;
+	}
+	t->numfiles = numfiles;
+
+	for (i = 0; i < numfiles; ++i) {
+		t->files[i].filename = strdup(filenames[i]);
+		if (t->files[i].filename == NULL) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+			tcpslice_close(t);
+			return NULL;
+		}
+		stats_clock_start(&clock);
+		status = open_file(t, &t->files[i], errbuf);
+		stats_clock_stop(&clock, &t->files[i].stats.open);
+		if (status < 0) {
+			tcpslice_close(t);
+			return NULL;
+		}
+	}
+
+	t->base_time = tcpslice_first_time(t);
+	t->stop_time = tcpslice_last_time(t);
+	return t;
+}
+
+void
+tcpslice_close(tcpslice_t *t)
+{
+	int i;
+
+	for (i = 0; i < t->numfiles; i++) {
+		if (t->files[i].p != NULL)
+			pcap_close(t->files[i].p);
+		free(t->files[i].filename);
+	}
+	if (t->filtering)
+		pcap_freecode(&t->filter);
+	free(t->files);
+	free(t->last_pkt);
+	free(t);
+}
+
+char *
+tcpslice_geterr(tcpslice_t *t)
+{
+	return t->errbuf;
+}
+
+int
+tcpslice_numfiles(const tcpslice_t *t)
+{
+	return t->numfiles;
+}
+
+const char *
+tcpslice_filename(const tcpslice_t *t, const int i)
+{
+	return t->files[i].filename;
+}
+
+void
+tcpslice_file_times(const tcpslice_t *t, const int i,
+		    struct timeval *start, struct timeval *stop)
+{
+	*start = t->files[i].file_start_time;
+	*stop = t->files[i].file_stop_time;
+}
+
+/* Of all the files, what is the lowest start time. */
+struct timeval
+tcpslice_first_time(const tcpslice_t *t)
+{
+	struct timeval min_time = t->files[0].file_start_time;
+	int i;
+
+	for (i = 1; i < t->numfiles; i++)
+		if (sf_timestamp_less_than(&t->files[i].file_start_time, &min_time))
+			min_time = t->files[i].file_start_time;
+	return min_time;
+}
+
+/* Of all the files, what is the latest end time. */
+struct timeval
+tcpslice_last_time(const tcpslice_t *t)
+{
+	struct timeval max_time = t->files[0].file_stop_time;
+	int i;
+
+	for (i = 1; i < t->numfiles; i++)
+		if (sf_timestamp_less_than(&max_time, &t->files[i].file_stop_time))
+			max_time = t->files[i].file_stop_time;
+	return max_time;
+}
+
+int
+tcpslice_snapshot(const tcpslice_t *t)
+{
+	return t->snaplen;
+}
+
+int
+tcpslice_seekable(const tcpslice_t *t, const int i)
+{
+	return ! t->files[i].streaming;
+}
+
+pcap_t *
+tcpslice_pcap(const tcpslice_t *t, const int i)
+{
+	return t->files[i].p;
+}
+
+pcap_t *
+tcpslice_current(const tcpslice_t *t)
+{
+	return t->cur != NULL ? t->cur->p : NULL;
+}
+
+void
+tcpslice_set_relative_time(tcpslice_t *t, const int on)
+{
+	t->relative_time_merge = on;
+}
+
+void
+tcpslice_set_keep_dups(tcpslice_t *t, const int on)
+{
+	t->keep_dups = on;
+}
+
+int
+tcpslice_set_headers_only(tcpslice_t *t, const int on)
+{
+	struct tcpslice_file *f;
+	uint32_t magic;
+	int64_t pos;
+	int i;
+
+	if (t->positioned) {
+		snprintf(t->errbuf, sizeof(t->errbuf),
+			 "the headers can only be chosen before the window");
+		return -1;
+	}
+	for (i = 0; i < t->numfiles; ++i) {
+		f = &t->files[i];
+		f->headers_only = 0;
+		if (! on || t->filtering || f->streaming || f->p == NULL)
+			continue;
+		/* libpcap does not tell the precision of the file, so look
+		 * at its magic number.
+		 */
+		if ((pos = ftell64(pcap_file(f->p))) < 0 ||
+		    fseek64(pcap_file(f->p), 0, SEEK_SET) < 0 ||
+		    fread(&magic, sizeof(magic), 1, pcap_file(f->p)) != 1 ||
+		    fseek64(pcap_file(f->p), pos, SEEK_SET) < 0) {
+			snprintf(t->errbuf, sizeof(t->errbuf),
+				 "cannot read the header of %s", f->filename);
+			return -1;
+		}
+		f->nsec = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+		f->headers_only = 1;
+	}
+	return 0;
+}
+
+int
+tcpslice_setfilter(tcpslice_t *t, const char *expr)
+{
+	pcap_t *p = t->files[0].p;
+	int i;
+
+	if (t->positioned || p == NULL) {
+		snprintf(t->errbuf, sizeof(t->errbuf),
+			 "the filter can only be set before the window");
+		return -1;
+	}
+	if (t->filtering) {
+		pcap_freecode(&t->filter);
+		t->filtering = 0;
+	}
+	if (expr == NULL)
+		return 0;
+
+	/* The files all have the link-layer header type of the first one,
+	 * or there is no merging them.
+	 */
+	if (pcap_compile(p, &t->filter, expr, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+		snprintf(t->errbuf, sizeof(t->errbuf), "%s", pcap_geterr(p));
+		return -1;
+	}
+	t->filtering = 1;
+
+	/* The filter looks at the data. */
+	for (i = 0; i < t->numfiles; ++i)
+		t->files[i].headers_only = 0;
+	return 0;
+}
+
+void
+tcpslice_set_timing(tcpslice_t *t, const int on)
+{
+	t->timing = on;
+}
+
+void
+tcpslice_get_file_stats(const tcpslice_t *t, const int i,
+			struct tcpslice_file_stats *st)
+{
+	*st = t->files[i].stats;
+}
+
+void
+tcpslice_get_stats(const tcpslice_t *t, struct tcpslice_stats *st)
+{
+	*st = t->stats;
+}
+
+void
+tcpslice_set_stop(tcpslice_t *t, const struct timeval *stop)
+{
+	t->stop_time = *stop;
+	timersub(stop, &t->base_time, &t->relative_stop);
+}
+
+int
+tcpslice_setwindow(tcpslice_t *t, const struct timeval *start,
+		   const struct timeval *stop)
+{
+	struct tcpslice_file *f;
+	struct timeval temp1, relative_start;
+	struct stats_clock clock;
+	int i;
+
+	if (t->positioned) {
+		snprintf(t->errbuf, sizeof(t->errbuf),
+			 "the window can be set only once");
+		return -1;
+	}
+	t->positioned = 1;
+
+	timersub(start, &t->base_time, &relative_start);
+	tcpslice_set_stop(t, stop);
+
+	for (i = 0; i < t->numfiles; ++i) {
+		f = &t->files[i];
+
+		/* compute the first packet time within *this* file */
+		if (t->relative_time_merge) {
+			/* relative time within this file */
+			timeradd(&f->file_start_time, &relative_start, &temp1);
+		} else {
+			/* absolute time */
+			temp1 = *start;
+		}
+
+		if (f->streaming) {
+			/* There is nothing to do but to read up to the
+			 * start, the first packet being read already.
+			 */
+			stats_clock_start(&clock);
+			while (! f->done &&
+			       sf_timestamp_less_than(&f->last_pkt_time, &temp1))
+				get_next_packet(f);
+			stats_clock_stop(&clock, &f->stats.find_packet);
+			continue;
+		}
+
+		/* check if this file has *anything* for us ... */
+		if (sf_timestamp_less_than(&f->file_stop_time, &temp1)) {
+			/* there aren't any packets of interest in this file */
+			f->done = 1;
+			pcap_close(f->p);
+			f->p = NULL;
+			continue;
+		}
+
+		/*
+		 * sf_find_packet() requires that the time it's passed as
+		 * its last argument be in the range [min_time, max_time],
+		 * so we enforce that constraint here.
+		 */
+
+		if (sf_timestamp_less_than(&temp1, &f->file_start_time)){
+			temp1 = f->file_start_time;
+		}
+
+		stats_clock_start(&clock);
+		if (sf_find_packet(f->p, t->snaplen, &f->file_start_time,
+				   f->start_pos, &f->file_stop_time, f->stop_pos,
+				   &temp1, t->errbuf, &f->stats) < 0)
+			return -1;
+		stats_clock_stop(&clock, &f->stats.find_packet);
+
+		/* get first packet for this file */
+		get_next_packet(f);
+	}
+	return 0;
+}
+
+/* The time by which the packet of the given file is merged. */
+static void
+merge_time(const tcpslice_t *t, const struct tcpslice_file *f,
+	   struct timeval *tv)
+{
+	if (t->relative_time_merge)
+		timersub(&f->hdr.ts, &f->file_start_time, tv);
+	else
+		TIMEVAL_FROM_PKTHDR_TS(*tv, f->hdr.ts);
+}
+
+/* Whether the packet of the given file is the one last returned from
+ * another file, and if not, remember it for next time.
+ */
+static int
+is_duplicate(tcpslice_t *t, struct tcpslice_file *f)
+{
+	if (t->last_file != NULL && t->last_file != f &&
+	    ! memcmp(&t->last_hdr, &f->hdr, sizeof(t->last_hdr)) &&
+	    ! memcmp(t->last_pkt, f->pkt, t->last_hdr.caplen))
+		return 1;
+
+	if (f->hdr.caplen > t->last_pkt_size) {
+		u_char *buf = (u_char *) realloc(t->last_pkt, f->hdr.caplen);
+
+		if (buf == NULL) {
+			/* Just don't compare against this one. */
+			t->last_file = NULL;
+			return 0;
+		}
+		t->last_pkt = buf;
+		t->last_pkt_size = f->hdr.caplen;
+	}
+	t->last_file = f;
+	t->last_hdr = f->hdr;
+	memcpy(t->last_pkt, f->pkt, f->hdr.caplen);
+	return 0;
+}
+
+static int
+next_packet(tcpslice_t *t, struct pcap_pkthdr **hdr, const u_char **data)
+{
+	struct tcpslice_file *f, *min_file;
+	struct timeval temp1, temp2, tvbuf, min_time, next_time;
+	struct stats_clock clock;
+	int i, dup, have_next;
+
+	if (! t->positioned &&
+	    tcpslice_setwindow(t, &t->base_time, &t->stop_time) < 0)
+		return -1;
+
+	/* Only now that the caller is done with it, move past the packet
+	 * returned last time.
+	 */
+	if (t->cur != NULL) {
+		get_next_packet(t->cur);
+		t->cur = NULL;
+	}
+
+	/*
+	 * Loop through the packets of all the files, putting packets out
+	 * in timestamp order.
+	 *
+	 * Quite often, the files will not have overlapping
+	 * timestamps, so it would be nice to try to deal
+	 * efficiently with that situation. (XXX)
+	 */
+	for (;;) {
+		/* Find the earliest packet, and the time of the packet that
+		 * would come next from the other files.
+		 */
+		min_file = NULL;
+		have_next = 0;
+		for (i = 0; i < t->numfiles; ++i) {
+			f = &t->files[i];
+			if (f->done)
+				continue;
+			merge_time(t, f, &temp2);
+			if (! min_file ||
+			    sf_timestamp_less_than(&temp2, &min_time)) {
+				if (min_file) {
+					next_time = min_time;
+					have_next = 1;
+				}
+				min_file = f;
+				min_time = temp2;
+			} else if (! have_next ||
+				   sf_timestamp_less_than(&temp2, &next_time)) {
+				next_time = temp2;
+				have_next = 1;
+			}
+		}
+
+		if (! min_file)
+			return -2;	/* didn't find any !done files */
+
+		if (t->relative_time_merge) {
+			/* relative time w/in this file */
+			timeradd(&min_file->file_start_time, &t->relative_stop,
+				 &temp1);
+		} else
+			/* take absolute times */
+			temp1 = t->stop_time;
+
+		TIMEVAL_FROM_PKTHDR_TS(tvbuf, min_file->hdr.ts);
+		if (sf_timestamp_less_than(&temp1, &tvbuf))
+			/* We've gone beyond the end of the region of
+			 * interest.  Keep the packet for the case the
+			 * caller moves the end.
+			 */
+			return 0;
+
+		if (t->filtering &&
+		    ! pcap_offline_filter(&t->filter, &min_file->hdr,
+					  min_file->pkt)) {
+			/* Skip the packets of this file that the filter
+			 * rejects for as long as they come before those of
+			 * the other files, without looking at these again.
+			 */
+			do {
+				++t->stats.filtered;
+				get_next_packet(min_file);
+				if (min_file->done)
+					break;
+				merge_time(t, min_file, &temp2);
+				TIMEVAL_FROM_PKTHDR_TS(tvbuf, min_file->hdr.ts);
+			} while ((! have_next ||
+				  sf_timestamp_less_than(&temp2, &next_time)) &&
+				 ! sf_timestamp_less_than(&temp1, &tvbuf) &&
+				 ! pcap_offline_filter(&t->filter,
+						       &min_file->hdr,
+						       min_file->pkt));
+			continue;
+		}
+
+		if (t->relative_time_merge) {
+			timersub(&min_file->hdr.ts, &min_file->file_start_time,
+				 &temp1);
+			timeradd(&temp1, &t->base_time, &min_file->hdr.ts);
+		}
+
+		if (t->keep_dups || t->numfiles == 1 || min_file->pkt == NULL)
+			break;
+		if (t->timing)
+			stats_clock_start(&clock);
+		dup = is_duplicate(t, min_file);
+		if (t->timing)
+			stats_clock_stop(&clock, &t->stats.dedup);
+		if (! dup)
+			break;
+
+		++t->stats.duplicates;
+		get_next_packet(min_file);
+	}
+
+	++t->stats.packets;
+	if (t->prev != NULL && t->prev != min_file)
+		++t->stats.reordered;
+	t->prev = min_file;
+	t->cur = min_file;
+	*hdr = &min_file->hdr;
+	*data = min_file->pkt;
+	return 1;
+}
+
+int
+tcpslice_next(tcpslice_t *t, struct pcap_pkthdr **hdr, const u_char **data)
+{
+	struct stats_clock clock;
+	int status;
+
+	if (! t->timing)
+		return next_packet(t, hdr, data);
+	stats_clock_start(&clock);
+	status = next_packet(t, hdr, data);
+	stats_clock_stop(&clock, &t->stats.merge);
+	return status;
+}
+
+int
+tcpslice_loop(tcpslice_t *t, const int cnt, pcap_handler callback,
+	      u_char *user)
+{
+	struct pcap_pkthdr *hdr;
+	const u_char *data;
+	int n = 0, status;
+
+	while (cnt <= 0 || n < cnt) {
+		status = tcpslice_next(t, &hdr, &data);
+		if (status == -1)
+			return -1;
+		if (status != 1)
+			break;
+		(*callback)(user, hdr, data);
+		++n;
+	}
+	return n;
+}
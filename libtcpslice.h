@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * libtcpslice - the slicing engine of tcpslice as a library
+ *
+ * A handle merges any number of pcap savefiles in timestamp order and
+ * yields the packets that fall into a time window, without the caller
+ * having to write them out and read them back.  Handles do not share any
+ * state except the file metadata cache, which has a lock of its own, so
+ * separate handles may be used in separate threads.
+ *
+ * The usual sequence is:
+ *
+ *	t = tcpslice_open(files, numfiles, errbuf);
+ *	tcpslice_setwindow(t, &start, &stop);
+ *	while ((status = tcpslice_next(t, &hdr, &data)) == 1)
+ *		use the packet;
+ *	tcpslice_close(t);
+ *
+ * An input that cannot seek, such as a pipe, is read forward only: its
+ * packets before the window are read and dropped, and reading stops once
+ * the window is past, but its end is not known in advance.
+ *
+ * Errors are reported the way libpcap does: functions that return a
+ * pointer return NULL and fill in a PCAP_ERRBUF_SIZE buffer, functions
+ * that return an int return -1 and the message is in tcpslice_geterr().
+ */
+
+#ifndef LIBTCPSLICE_H
+#define LIBTCPSLICE_H
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <pcap.h>
+
+typedef struct tcpslice tcpslice_t;
+
+/* Open the given savefiles and locate their first and last packets.  The
+ * files must all exist and be readable pcap files; the file names are
+ * copied.
+ */
+tcpslice_t	*tcpslice_open(char *const filenames[], const int numfiles,
+			       char *errbuf);
+void		tcpslice_close(tcpslice_t *t);
+char		*tcpslice_geterr(tcpslice_t *t);
+
+/* What tcpslice_open() found out about the files.  The stop time of an
+ * input that is not seekable is the latest time a savefile can hold.
+ */
+int		tcpslice_numfiles(const tcpslice_t *t);
+const char	*tcpslice_filename(const tcpslice_t *t, const int i);
+int		tcpslice_seekable(const tcpslice_t *t, const int i);
+void		tcpslice_file_times(const tcpslice_t *t, const int i,
+			struct timeval *start, struct timeval *stop);
+struct timeval	tcpslice_first_time(const tcpslice_t *t);
+struct timeval	tcpslice_last_time(const tcpslice_t *t);
+int		tcpslice_snapshot(const tcpslice_t *t);
+
+/* The libpcap handle of a file, NULL once the file has nothing more to
+ * offer.  Use it for pcap_datalink(), pcap_dump_open() and the like, not
+ * for reading.
+ */
+pcap_t		*tcpslice_pcap(const tcpslice_t *t, const int i);
+
+/* Merge the files by time relative to the start of each file rather than
+ * by absolute time, as "tcpslice -l" does.  Off by default.
+ */
+void		tcpslice_set_relative_time(tcpslice_t *t, const int on);
+
+/* Pass through the packets that occur in more than one file, as
+ * "tcpslice -D" does.  Off by default.
+ */
+void		tcpslice_set_keep_dups(tcpslice_t *t, const int on);
+
+/* Read only the headers of the packet records, seeking over their data,
+ * so that tcpslice_next() returns the headers with NULL data.  Inputs that
+ * cannot seek are still read whole.  Without the data, duplicates cannot
+ * be told apart, so none are removed.  To be called before the window is
+ * set.  Returns 0 on success, -1 on error.
+ */
+int		tcpslice_set_headers_only(tcpslice_t *t, const int on);
+
+/* Only return the packets that match the given filter expression, as
+ * compiled by pcap_compile() for the link-layer header type of the first
+ * file, or all of them again if it is NULL.  The packets that do not match
+ * are dropped before duplicates are looked for.  The data is read even
+ * with tcpslice_set_headers_only(), the filter needing it.  To be called
+ * before the window is set.  Returns 0 on success, -1 on error.
+ */
+int		tcpslice_setfilter(tcpslice_t *t, const char *expr);
+
+/* Position every file at the first packet at or after "start".  Packets
+ * after "stop" are not returned.  Without a call to this function, the
+ * window is the whole of the files.  Returns 0 on success, -1 on error.
+ */
+int		tcpslice_setwindow(tcpslice_t *t, const struct timeval *start,
+			const struct timeval *stop);
+
+/* Move the end of the window, including after tcpslice_next() returned 0. */
+void		tcpslice_set_stop(tcpslice_t *t, const struct timeval *stop);
+
+/* Get the next packet of the window.  The header and the data point into
+ * libpcap's buffers and remain valid until the next call for the same
+ * handle.  Returns
+ *
+ *	 1 if a packet was returned,
+ *	 0 if the next packet is past the end of the window (it will be
+ *	   returned if tcpslice_set_stop() moves the end past it),
+ *	-1 on error,
+ *	-2 if there are no more packets in any of the files.
+ */
+int		tcpslice_next(tcpslice_t *t, struct pcap_pkthdr **hdr,
+			const u_char **data);
+
+/* The libpcap handle of the file the last packet came from. */
+pcap_t		*tcpslice_current(const tcpslice_t *t);
+
+/* Time spent in a phase of the work, in seconds of wall clock and of CPU
+ * of the thread that did it, and how many times it was entered.
+ */
+struct tcpslice_time {
+	double		wall;
+	double		cpu;
+	uint64_t	count;
+};
+
+/* What reading a file took so far.  Opening includes finding the end,
+ * and finding the packet of the start of the window includes reading up
+ * to it.  The bytes read are those of the packet records and of the
+ * blocks read to search the file, uncompressed.
+ */
+struct tcpslice_file_stats {
+	struct tcpslice_time open;
+	struct tcpslice_time find_end;
+	struct tcpslice_time find_packet;
+	struct tcpslice_time read_up_to;
+	uint64_t	bytes_read;
+	uint64_t	packets_read;
+	uint64_t	dropped;	/* for going back in time */
+	uint64_t	seeks;
+	uint64_t	probes;		/* positions tried by the search */
+	uint64_t	headers;	/* offsets examined for a header */
+};
+
+/* What merging the files took so far.  The times are only measured once
+ * tcpslice_set_timing() turned them on, as they cost a few system calls
+ * per packet.  A packet is counted as reordered when it comes from
+ * another file than the packet before it.
+ */
+struct tcpslice_stats {
+	struct tcpslice_time merge;	/* tcpslice_next() */
+	struct tcpslice_time dedup;	/* part of it */
+	uint64_t	packets;
+	uint64_t	duplicates;
+	uint64_t	reordered;
+	uint64_t	filtered;	/* not matching the filter */
+};
+
+void		tcpslice_set_timing(tcpslice_t *t, const int on);
+void		tcpslice_get_file_stats(const tcpslice_t *t, const int i,
+			struct tcpslice_file_stats *st);
+void		tcpslice_get_stats(const tcpslice_t *t, struct tcpslice_stats *st);
+
+/* Call "callback" for at most "cnt" packets of the window, or for all of
+ * them if cnt is not positive, like pcap_loop().  Returns the number of
+ * packets processed or -1 on error.
+ */
+int		tcpslice_loop(tcpslice_t *t, const int cnt, pcap_handler callback,
+			u_char *user);
+
+#endif /* LIBTCPSLICE_H */
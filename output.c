@@ -0,0 +1,674 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * output.c - the output file of the slice, rotated with -C and -G
+ *
+ * Without rotation there is one output file, opened before reading.
+ * With it, a file is opened by the first packet that does not belong in
+ * the current one: with -G, each interval of that many seconds of packet
+ * time, aligned on multiples of it since the epoch, has files of its own,
+ * named by strftime() of the -w name with the start of the interval; with
+ * -C, a file holds no more than that many bytes (before compression), and
+ * the files of an interval are told apart by ".0", ".1" and so on after
+ * the name.  Closing a file, which waits for its compression to finish,
+ * is left to a thread, which also opens the file most likely to come next
+ * ahead of time, so that the merge does not wait for either.  That file
+ * is only opened ahead if it does not exist yet, and is removed if the
+ * guess turns out to be wrong.
+ *
+ * With -P, the output is split into that many shards by a hash of the
+ * addresses and ports of the packets, the same in both directions (see
+ * flows_shard()), so that each TCP or UDP session is all in one shard;
+ * the fragments of IP packets go by their addresses alone, so that those
+ * of a packet stay together, and the other packets go to the first one.
+ * Each shard is an output of its own, named after -w with ".0", ".1" and
+ * so on appended and rotated as above, and is written by a thread of its
+ * own, which the main thread hands the packets of the shard over to in
+ * buffers.  The packets of a shard are written in the order of the merge.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+#include "sessions.h"
+
+#define NAME_MAX_LEN	4096	/* of the files */
+#define SHARD_BUFFER_SIZE	(256 * 1024)	/* packets handed over at once */
+
+/* Keeps the headers of struct shard_buffer aligned. */
+#define SHARD_RECORD_LEN(caplen) \
+	((sizeof(struct pcap_pkthdr) + (caplen) + 7) & ~(size_t) 7)
+
+struct output_file {
+	pcap_dumper_t	*dumper;
+	struct gzout	*gzo;
+	char		*name;
+};
+
+/* Packets, each a struct pcap_pkthdr followed by its data and padding. */
+struct shard_buffer {
+	u_char		*data;
+	size_t		len;
+	size_t		size;
+};
+
+struct shard {
+	struct output	*output;
+	char		*name;
+	struct shard_buffer fill;	/* by the main thread */
+#ifdef HAVE_PTHREADS
+	int		threaded;
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	struct shard_buffer write;	/* by the thread */
+	int		full;		/* write is to be written */
+	int		quit;
+#endif
+};
+
+struct output {
+	int		dlt;
+	unsigned int	nshards;	/* -P, 0 if not split */
+	struct shard	*shards;
+
+	pcap_t		*p;		/* for the header of the files */
+	const char	*name;		/* of -w */
+	uint64_t	max_size;	/* -C, 0 for no limit */
+	time_t		interval;	/* -G, 0 for none */
+	int		compress;
+	int		nthreads;	/* to compress each file */
+
+	struct output_file cur;
+	uint64_t	size;		/* of the current file so far */
+	time_t		start;		/* of its interval */
+	unsigned int	index;		/* in its interval */
+	unsigned int	files;		/* opened so far */
+	struct output_file next;	/* opened ahead, if any */
+
+#ifdef HAVE_PTHREADS
+	int		threaded;
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int		busy;		/* the thread has a job */
+	int		quit;
+	struct output_file old;		/* the job: close this file, */
+	struct output_file unused;	/* remove this one and */
+	char		*ahead;		/* open this one as next */
+	char		errbuf[PCAP_ERRBUF_SIZE];	/* if closing failed */
+#endif
+};
+
+/* The name of a file of the given interval, as a new string. */
+static char *
+output_name(const struct output *o, const time_t start,
+	    const unsigned int index)
+{
+	char buf[NAME_MAX_LEN];
+	char *name;
+	struct tm *tm;
+#ifdef HAVE_PTHREADS
+	struct tm tmbuf;
+#endif
+	size_t len;
+
+	if (o->interval) {
+#ifdef HAVE_PTHREADS
+		/* The threads of the shards name files at the same time. */
+		tm = localtime_r(&start, &tmbuf);
+#else
+		tm = localtime(&start);
+#endif
+		if (tm == NULL || (len = strftime(buf, sizeof(buf), o->name,
+						  tm)) == 0)
+			error("cannot make a file name of '%s'", o->name);
+	} else {
+		if ((len = strlen(o->name)) >= sizeof(buf))
+			error("file name '%s' is too long", o->name);
+		memcpy(buf, o->name, len + 1);
+	}
+	if (o->max_size &&
+	    snprintf(buf + len, sizeof(buf) - len, ".%u", index) >=
+	    (int) (sizeof(buf) - len))
+		error("file name '%s' is too long", buf);
+	if ((name = strdup(buf)) == NULL)
+		error("malloc() failed in %s()", __func__);
+	return name;
+}
+
+/* Open a file and write its header.  If "ahead", the file must not exist
+ * yet.  Returns 0 on success, -1 with a message in errbuf on error.
+ */
+static int
+file_open(const struct output *o, struct output_file *of, const int ahead,
+	  char *errbuf)
+{
+	FILE *fp = NULL;
+	int fd = -1;
+
+	if (ahead) {
+		fd = open(of->name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if (fd < 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (o->compress) {
+		if (fd >= 0)
+			close(fd);	/* gzout_open() opens it again */
+		of->gzo = gzout_open(of->name, o->nthreads, &fp, errbuf);
+		if (of->gzo == NULL)
+			goto fail;
+	} else if (fd >= 0) {
+		if ((fp = fdopen(fd, "w")) == NULL) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", strerror(errno));
+			close(fd);
+			goto fail;
+		}
+	} else {
+		of->dumper = pcap_dump_open(o->p, of->name);
+		if (of->dumper == NULL) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s",
+				 pcap_geterr(o->p));
+			return -1;
+		}
+		return 0;
+	}
+
+	if ((of->dumper = pcap_dump_fopen(o->p, fp)) == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(o->p));
+		fclose(fp);
+		if (of->gzo != NULL)
+			(void)gzout_close(of->gzo);
+		of->gzo = NULL;
+		goto fail;
+	}
+	return 0;
+
+    fail:
+	if (ahead)
+		(void)unlink(of->name);
+	return -1;
+}
+
+/* Close a file, and remove it if asked to.  Returns 0 on success, -1 with
+ * a message in errbuf on error.
+ */
+static int
+file_close(struct output_file *of, const int remove, char *errbuf)
+{
+	char gzi[NAME_MAX_LEN + sizeof(".gzi")];
+	int status = 0;
+
+	if (of->dumper != NULL) {
+		pcap_dump_close(of->dumper);
+		if (of->gzo != NULL && gzout_close(of->gzo) < 0 && ! remove) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE,
+				 "error writing output file '%s': %s",
+				 of->name, strerror(errno));
+			status = -1;
+		}
+		if (remove) {
+			(void)unlink(of->name);
+			/* and the index gzout_close() wrote */
+			if (of->gzo != NULL) {
+				snprintf(gzi, sizeof(gzi), "%s.gzi", of->name);
+				(void)unlink(gzi);
+			}
+		}
+	}
+	free(of->name);
+	memset(of, 0, sizeof(*of));
+	return status;
+}
+
+/* Open the file to come next if asked to, which is not an error if it
+ * cannot be done.
+ */
+static void
+file_ahead(const struct output *o, struct output_file *of, char *name)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+
+	memset(of, 0, sizeof(*of));
+	if (name == NULL)
+		return;
+	of->name = name;
+	if (file_open(o, of, 1, errbuf) < 0) {
+		free(of->name);
+		of->name = NULL;
+	}
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+output_thread(void *arg)
+{
+	struct output *o = (struct output *) arg;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct output_file next;
+
+	pthread_mutex_lock(&o->lock);
+	for (;;) {
+		while (! o->busy && ! o->quit)
+			pthread_cond_wait(&o->cond, &o->lock);
+		if (! o->busy)
+			break;
+		pthread_mutex_unlock(&o->lock);
+
+		/* The main thread leaves all of this alone while busy. */
+		if (file_close(&o->old, 0, errbuf) < 0 && o->errbuf[0] == '\0')
+			strcpy(o->errbuf, errbuf);
+		(void)file_close(&o->unused, 1, errbuf);
+		file_ahead(o, &next, o->ahead);
+		o->ahead = NULL;
+
+		pthread_mutex_lock(&o->lock);
+		o->next = next;
+		o->busy = 0;
+		pthread_cond_broadcast(&o->cond);
+	}
+	pthread_mutex_unlock(&o->lock);
+	return NULL;
+}
+#endif
+
+/* Wait for the thread to be done with its job, if any. */
+static void
+output_wait(struct output *o)
+{
+#ifdef HAVE_PTHREADS
+	if (! o->threaded)
+		return;
+	pthread_mutex_lock(&o->lock);
+	while (o->busy)
+		pthread_cond_wait(&o->cond, &o->lock);
+	pthread_mutex_unlock(&o->lock);
+	if (o->errbuf[0] != '\0')
+		error("%s", o->errbuf);
+#else
+	(void)o;
+#endif
+}
+
+/* Move on to the file of the given interval and index. */
+static void
+output_rotate(struct output *o, const time_t start, const unsigned int index)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct output_file of, old, unused;
+	char *ahead = NULL;
+
+	output_wait(o);
+	memset(&of, 0, sizeof(of));
+	memset(&unused, 0, sizeof(unused));
+	of.name = output_name(o, start, index);
+	if (o->next.dumper != NULL && ! strcmp(o->next.name, of.name)) {
+		free(of.name);
+		of = o->next;
+	} else {
+		unused = o->next;
+		if (file_open(o, &of, 0, errbuf) < 0)
+			error("error creating output file '%s': %s", of.name,
+			      errbuf);
+	}
+	memset(&o->next, 0, sizeof(o->next));
+
+	old = o->cur;
+	o->cur = of;
+	o->size = PCAP_FILE_HDR_LEN;
+	o->start = start;
+	o->index = index;
+	++o->files;
+
+	/* Guess which file comes next: the next one of the interval if
+	 * there is a limit to the size, or else the one of the next one.
+	 */
+	if (o->max_size)
+		ahead = output_name(o, start, index + 1);
+	else if (o->interval)
+		ahead = output_name(o, start + o->interval, 0);
+
+#ifdef HAVE_PTHREADS
+	if (o->threaded) {
+		pthread_mutex_lock(&o->lock);
+		o->old = old;
+		o->unused = unused;
+		o->ahead = ahead;
+		o->busy = 1;
+		pthread_cond_broadcast(&o->cond);
+		pthread_mutex_unlock(&o->lock);
+		return;
+	}
+#endif
+	if (file_close(&old, 0, errbuf) < 0)
+		error("%s", errbuf);
+	(void)file_close(&unused, 1, errbuf);
+	file_ahead(o, &o->next, ahead);
+}
+
+/* Write out the packets of a buffer of a shard. */
+static void
+shard_write(struct shard *sh, struct shard_buffer *b)
+{
+	const struct pcap_pkthdr *hdr;
+	size_t pos;
+
+	for (pos = 0; pos < b->len; pos += SHARD_RECORD_LEN(hdr->caplen)) {
+		hdr = (const struct pcap_pkthdr *) (b->data + pos);
+		output_dump(sh->output, hdr, (const u_char *) (hdr + 1));
+	}
+	b->len = 0;
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+shard_thread(void *arg)
+{
+	struct shard *sh = (struct shard *) arg;
+
+	pthread_mutex_lock(&sh->lock);
+	for (;;) {
+		while (! sh->full && ! sh->quit)
+			pthread_cond_wait(&sh->cond, &sh->lock);
+		if (! sh->full)
+			break;
+		pthread_mutex_unlock(&sh->lock);
+		shard_write(sh, &sh->write);
+		pthread_mutex_lock(&sh->lock);
+		sh->full = 0;
+		pthread_cond_broadcast(&sh->cond);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	return NULL;
+}
+#endif
+
+/* Hand the buffer of a shard over to its thread, or write it out if it
+ * has none.
+ */
+static void
+shard_flush(struct shard *sh)
+{
+#ifdef HAVE_PTHREADS
+	struct shard_buffer b;
+
+	if (sh->threaded) {
+		pthread_mutex_lock(&sh->lock);
+		while (sh->full)
+			pthread_cond_wait(&sh->cond, &sh->lock);
+		b = sh->write;
+		sh->write = sh->fill;
+		sh->fill = b;
+		sh->full = 1;
+		pthread_cond_broadcast(&sh->cond);
+		pthread_mutex_unlock(&sh->lock);
+		return;
+	}
+#endif
+	shard_write(sh, &sh->fill);
+}
+
+static void
+shard_dump(struct shard *sh, const struct pcap_pkthdr *hdr,
+	   const u_char *pkt)
+{
+	struct shard_buffer *b = &sh->fill;
+	size_t len = SHARD_RECORD_LEN(hdr->caplen);
+
+	if (b->len + len > b->size && b->len > 0)
+		shard_flush(sh);
+	if (len > b->size) {
+		/* The first packet of the buffer, or one bigger than it. */
+		free(b->data);
+		b->size = len > SHARD_BUFFER_SIZE ? len : SHARD_BUFFER_SIZE;
+		if ((b->data = (u_char *) malloc(b->size)) == NULL)
+			error("malloc() failed in %s()", __func__);
+	}
+	memcpy(b->data + b->len, hdr, sizeof(*hdr));
+	memcpy(b->data + b->len + sizeof(*hdr), pkt, hdr->caplen);
+	b->len += len;
+}
+
+static void
+shards_open(struct output *o, pcap_t *p, const char *name,
+	    const uint64_t max_size, const time_t interval,
+	    const int compress, const int nthreads)
+{
+	struct shard *sh;
+	unsigned int i;
+	size_t len = strlen(name) + 12;
+
+	o->shards = (struct shard *) calloc(o->nshards, sizeof(struct shard));
+	if (o->shards == NULL)
+		error("malloc() failed in %s()", __func__);
+	for (i = 0; i < o->nshards; i++) {
+		sh = &o->shards[i];
+		if ((sh->name = (char *) malloc(len)) == NULL)
+			error("malloc() failed in %s()", __func__);
+		snprintf(sh->name, len, "%s.%u", name, i);
+		/* The threads of -j go to the shards in turn. */
+		sh->output = output_open(p, sh->name, max_size, interval,
+					 compress, nthreads / o->nshards, 0);
+#ifdef HAVE_PTHREADS
+		pthread_mutex_init(&sh->lock, NULL);
+		pthread_cond_init(&sh->cond, NULL);
+		if (pthread_create(&sh->thread, NULL, shard_thread, sh) == 0)
+			sh->threaded = 1;
+		else {
+			/* Write in the main thread then. */
+			pthread_mutex_destroy(&sh->lock);
+			pthread_cond_destroy(&sh->cond);
+		}
+#endif
+	}
+}
+
+static unsigned int
+shards_close(struct output *o, const struct timeval *start_time)
+{
+	struct shard *sh;
+	unsigned int i, files = 0;
+
+	for (i = 0; i < o->nshards; i++) {
+		sh = &o->shards[i];
+		if (sh->fill.len > 0)
+			shard_flush(sh);
+#ifdef HAVE_PTHREADS
+		if (sh->threaded) {
+			pthread_mutex_lock(&sh->lock);
+			sh->quit = 1;
+			pthread_cond_broadcast(&sh->cond);
+			pthread_mutex_unlock(&sh->lock);
+		}
+#endif
+	}
+	for (i = 0; i < o->nshards; i++) {
+		sh = &o->shards[i];
+#ifdef HAVE_PTHREADS
+		if (sh->threaded) {
+			pthread_join(sh->thread, NULL);
+			pthread_mutex_destroy(&sh->lock);
+			pthread_cond_destroy(&sh->cond);
+			free(sh->write.data);
+		}
+#endif
+		files += output_close(sh->output, start_time);
+		free(sh->fill.data);
+		free(sh->name);
+	}
+	free(o->shards);
+	return files;
+}
+
+struct output *
+output_open(pcap_t *p, const char *name, const uint64_t max_size,
+	    const time_t interval, const int compress, const int nthreads,
+	    const unsigned int nshards)
+{
+	struct output *o;
+
+	if (nshards > 1 && ! strcmp(name, "-"))
+		error("cannot split the standard output, use -w");
+	if ((max_size || interval) && ! strcmp(name, "-"))
+		error("cannot rotate the standard output, use -w");
+	if (interval && strchr(name, '%') == NULL)
+		error("with -G, the name of -w needs a strftime() conversion, as in '%s-%%H%%M%%S'",
+		      name);
+	if ((o = (struct output *) calloc(1, sizeof(struct output))) == NULL)
+		error("malloc() failed in %s()", __func__);
+	if (nshards > 1) {
+		o->dlt = pcap_datalink(p);
+		o->nshards = nshards;
+		shards_open(o, p, name, max_size, interval, compress,
+			    nthreads);
+		return o;
+	}
+	if ((o->p = pcap_open_dead(pcap_datalink(p), pcap_snapshot(p))) == NULL)
+		error("pcap_open_dead() failed in %s()", __func__);
+	o->name = name;
+	o->max_size = max_size;
+	o->interval = interval;
+	o->compress = compress;
+	o->nthreads = nthreads;
+
+	/* Always write the output file, even with no packet to put there. */
+	if (! max_size && ! interval) {
+		output_rotate(o, 0, 0);
+		return o;
+	}
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_init(&o->lock, NULL);
+	pthread_cond_init(&o->cond, NULL);
+	if (pthread_create(&o->thread, NULL, output_thread, o) == 0)
+		o->threaded = 1;
+	else {
+		/* Rotate in the main thread then. */
+		pthread_mutex_destroy(&o->lock);
+		pthread_cond_destroy(&o->cond);
+	}
+#endif
+	return o;
+}
+
+void
+output_dump(struct output *o, const struct pcap_pkthdr *hdr,
+	    const u_char *pkt)
+{
+	uint64_t len = PCAP_RECORD_HDR_LEN + hdr->caplen;
+	time_t start;
+
+	if (o->shards != NULL) {
+		shard_dump(&o->shards[flows_shard(o->dlt, hdr, pkt,
+						  o->nshards)], hdr, pkt);
+		return;
+	}
+
+	if (o->max_size || o->interval) {
+		start = o->interval ?
+		    hdr->ts.tv_sec - hdr->ts.tv_sec % o->interval : 0;
+		/* Packets that are late for their interval, which the
+		 * trackers of sessions may write after the window, go
+		 * to the current file.
+		 */
+		if (! o->files || start > o->start)
+			output_rotate(o, start, 0);
+		else if (o->max_size && o->size > PCAP_FILE_HDR_LEN &&
+			 o->size + len > o->max_size)
+			output_rotate(o, o->start, o->index + 1);
+	}
+
+	pcap_dump((u_char *) o->cur.dumper, hdr, pkt);
+	if (o->cur.gzo != NULL)
+		gzout_packet_end(o->cur.gzo);
+	o->size += len;
+}
+
+unsigned int
+output_close(struct output *o, const struct timeval *start_time)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	unsigned int files;
+
+	if (o->shards != NULL) {
+		files = shards_close(o, start_time);
+		free(o);
+		return files;
+	}
+
+	/* A slice without packets still gets a file. */
+	if (! o->files)
+		output_rotate(o, o->interval ? start_time->tv_sec -
+			      start_time->tv_sec % o->interval : 0, 0);
+
+	output_wait(o);
+#ifdef HAVE_PTHREADS
+	if (o->threaded) {
+		pthread_mutex_lock(&o->lock);
+		o->quit = 1;
+		pthread_cond_broadcast(&o->cond);
+		pthread_mutex_unlock(&o->lock);
+		pthread_join(o->thread, NULL);
+		pthread_mutex_destroy(&o->lock);
+		pthread_cond_destroy(&o->cond);
+	}
+#endif
+	(void)file_close(&o->next, 1, errbuf);
+	if (file_close(&o->cur, 0, errbuf) < 0)
+		error("%s", errbuf);
+
+	files = o->files;
+	pcap_close(o->p);
+	free(o);
+	return files;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * report.c - the times of the files of -J, -R, -r and -t
+ *
+ * Reporting on a file only takes finding its first and last packets, so
+ * unlike slicing there is no need to open all the files before starting,
+ * nor to look at them one after the other: a pool of threads takes the
+ * files in turn, each one looking its file up in the metadata cache (see
+ * cache.c) or else reading it and storing what it found there.  A file is
+ * printed once all the files before it are done, so in the order of the
+ * command line, or as soon as it is done with -O.  A file that
+ * cannot be read is reported and skipped rather than ending the run.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pcap.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+
+struct report_file {
+	const char	*filename;
+	struct file_meta meta;
+	int64_t		size;		/* -1 if not a regular file */
+	int		streaming;	/* cannot seek, so no end */
+	int		done;
+	char		*error;		/* why it could not be read */
+};
+
+struct report {
+	FILE		*f;
+	int		json;
+	int		ordered;	/* in the order of the files */
+	struct report_file *files;
+	int		numfiles;
+	int		next;		/* next file for a thread to take */
+	int		printed;	/* files printed so far, if ordered */
+	int		failed;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_t	lock;
+#endif
+};
+
+#ifdef HAVE_PTHREADS
+#define report_lock(r)		pthread_mutex_lock(&(r)->lock)
+#define report_unlock(r)	pthread_mutex_unlock(&(r)->lock)
+#else
+#define report_lock(r)
+#define report_unlock(r)
+#endif
+
+/* VARARGS */
+static void
+report_error(struct report_file *rf, const char *fmt, ...)
+{
+	char msg[4 * PCAP_ERRBUF_SIZE];
+	va_list ap;
+
+	va_start(ap, fmt);
+	(void)vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	if ((rf->error = strdup(msg)) == NULL)
+		error("malloc() failed in %s()", __func__);
+}
+
+/* Find the first and last packets of a file, the way tcpslice_open()
+ * does, without the report lock held.
+ */
+static void
+inspect(struct report_file *rf)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr hdr;
+	struct stat sb;
+	pcap_t *p;
+	int seekable;
+
+	/* The cache wants the stat() from before the file is read. */
+	rf->size = -1;
+	if (strcmp(rf->filename, "-") != 0 && stat(rf->filename, &sb) == 0 &&
+	    S_ISREG(sb.st_mode)) {
+		rf->size = (int64_t) sb.st_size;
+		if (cache_lookup(rf->filename, &rf->meta))
+			return;
+	}
+
+	if ((p = savefile_open(rf->filename, &seekable, errbuf)) == NULL) {
+		report_error(rf, "bad pcap file %s: %s", rf->filename, errbuf);
+		return;
+	}
+	if (! seekable) {
+		rf->streaming = 1;
+		if (pcap_next(p, &hdr) == NULL)
+			report_error(rf, "error reading packet in %s: %s",
+				     rf->filename, pcap_geterr(p));
+		else
+			TIMEVAL_FROM_PKTHDR_TS(rf->meta.start_time, hdr.ts);
+	} else if (! file_meta_read(p, &rf->meta))
+		report_error(rf, "problems finding end packet of file %s",
+			     rf->filename);
+	else if (rf->size >= 0)
+		cache_store(rf->filename, &sb, &rf->meta);
+	pcap_close(p);
+}
+
+/* Print a file that is done, with the report lock held, which also keeps
+ * the buffers of timestamp_to_string() to one thread at a time.
+ */
+static void
+print_file(struct report *r, struct report_file *rf)
+{
+	FILE *f = r->f;
+
+	if (rf->error == NULL && ! rf->streaming &&
+	    sf_timestamp_less_than(&rf->meta.stop_time, &rf->meta.start_time))
+		report_error(rf, "'%s' has the last timestamp before the first timestamp",
+			     rf->filename);
+
+	if (rf->error != NULL) {
+		++r->failed;
+		if (r->json) {
+			fputs("{\"file\": ", f);
+			json_string(f, rf->filename);
+			fputs(", \"error\": ", f);
+			json_string(f, rf->error);
+			fputs("}\n", f);
+		} else
+			warning("%s", rf->error);
+		free(rf->error);
+		rf->error = NULL;
+		return;
+	}
+
+	if (! r->json) {
+		fprintf(f, "%s\t%s\t%s\n", rf->filename,
+			timestamp_to_string(&rf->meta.start_time),
+			rf->streaming ?
+			    "unknown" : timestamp_to_string(&rf->meta.stop_time));
+		return;
+	}
+
+	fputs("{\"file\": ", f);
+	json_string(f, rf->filename);
+	fprintf(f, ", \"start\": %u.%06u", (uint32_t) rf->meta.start_time.tv_sec,
+		(uint32_t) rf->meta.start_time.tv_usec);
+	if (rf->streaming)
+		fputs(", \"stop\": null", f);
+	else
+		fprintf(f, ", \"stop\": %u.%06u",
+			(uint32_t) rf->meta.stop_time.tv_sec,
+			(uint32_t) rf->meta.stop_time.tv_usec);
+	if (rf->size >= 0)
+		fprintf(f, ", \"size\": %" PRId64, rf->size);
+	else
+		fputs(", \"size\": null", f);
+	if (rf->streaming)
+		fputs(", \"packets_estimate\": null}\n", f);
+	else
+		fprintf(f, ", \"packets_estimate\": %" PRId64 "}\n",
+			rf->meta.packets);
+}
+
+static void *
+report_worker(void *arg)
+{
+	struct report *r = (struct report *) arg;
+	struct report_file *rf;
+
+	report_lock(r);
+	while (r->next < r->numfiles) {
+		rf = &r->files[r->next++];
+		report_unlock(r);
+		inspect(rf);
+		report_lock(r);
+		rf->done = 1;
+		if (! r->ordered)
+			print_file(r, rf);
+		else
+			while (r->printed < r->numfiles &&
+			       r->files[r->printed].done)
+				print_file(r, &r->files[r->printed++]);
+		fflush(r->f);
+	}
+	report_unlock(r);
+	return NULL;
+}
+
+int
+report_files(FILE *f, const int json, char *const filenames[],
+	     const int numfiles, int nthreads, const int ordered)
+{
+	struct report r;
+#ifdef HAVE_PTHREADS
+	pthread_t *threads = NULL;
+	int started = 0;
+#endif
+	int i;
+
+	memset(&r, 0, sizeof(r));
+	r.f = f;
+	r.json = json;
+	r.ordered = ordered;
+	r.numfiles = numfiles;
+	r.files = (struct report_file *)
+		calloc(numfiles, sizeof(struct report_file));
+	if (r.files == NULL)
+		error("malloc() failed in %s()", __func__);
+	for (i = 0; i < numfiles; i++)
+		r.files[i].filename = filenames[i];
+
+	/* No more threads than files for them, the main one being one. */
+	if (nthreads > numfiles - 1)
+		nthreads = numfiles - 1;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_init(&r.lock, NULL);
+	if (nthreads > 0) {
+		threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+		for (; threads != NULL && started < nthreads; started++)
+			if (pthread_create(&threads[started], NULL,
+					   report_worker, &r) != 0)
+				break;	/* make do with fewer */
+	}
+#endif
+	report_worker(&r);
+#ifdef HAVE_PTHREADS
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&r.lock);
+#endif
+
+	free(r.files);
+	return r.failed;
+}
@@ -93,9 +93,9 @@ struct pcap_sf_pkthdr {
  */
 #define PACKET_HDR_LEN (sizeof( struct pcap_sf_pkthdr ))
 
-extern int snaplen;
-
-/* The maximum size of a packet, including its header. */
+/* The maximum size of a packet, including its header.  The functions using
+ * this get the largest snapshot length of the files at hand as "snaplen".
+ */
 #define MAX_PACKET_SIZE (PACKET_HDR_LEN + snaplen)
 
 /* Number of contiguous bytes from a dumpfile in which there's guaranteed
@@ -204,6 +204,8 @@ extract_header( pcap_t *p, const u_char *buf, struct pcap_pkthdr *hdr )
  * header.  last_time, if non-zero, is the last such timestamp.  If
  * zero, then up to MAX_REASONABLE_FILE_SPAN seconds after first_time
  * is acceptable.
+ *
+ * The number of buffer positions examined is added to *examined.
  */
 
 #define HEADER_NONE 0
@@ -214,7 +216,8 @@ extract_header( pcap_t *p, const u_char *buf, struct pcap_pkthdr *hdr )
 static int
 find_header( pcap_t *p, u_char *buf, const int buf_len,
 		const time_t first_time, const time_t last_time,
-		u_char **hdrpos_addr, struct pcap_pkthdr *return_hdr )
+		u_char **hdrpos_addr, struct pcap_pkthdr *return_hdr,
+		uint64_t *examined )
 {
 	u_char *bufptr, *bufend, *last_pos_to_try;
 	struct pcap_pkthdr hdr, hdr2;
@@ -231,6 +234,7 @@ find_header( pcap_t *p, u_char *buf, const int buf_len,
 
 	for ( bufptr = buf; bufptr < last_pos_to_try; ++bufptr )
 	{
+	    ++*examined;
 	    extract_header( p, bufptr, &hdr );
 
 	    if ( reasonable_header( &hdr, first_time, last_time ) )
@@ -262,8 +266,8 @@ find_header( pcap_t *p, u_char *buf, const int buf_len,
 			    case HEADER_DEFINITELY:
 				return HEADER_CLASH;
 
-			    default:
-				error( "bad status in %s()", __func__ );
+			    default:	/* can't happen */
+				return HEADER_CLASH;
 			}
 		    }
 
@@ -293,8 +297,8 @@ find_header( pcap_t *p, u_char *buf, const int buf_len,
 			    /* Keep the definite in preference to this one. */
 			    break;
 
-			default:
-			    error( "bad status in %s()", __func__ );
+			default:	/* can't happen */
+			    return HEADER_CLASH;
 		    }
 		}
 	    }
@@ -317,8 +321,8 @@ find_header( pcap_t *p, u_char *buf, const int buf_len,
  * present in the dump file.
  */
 int
-sf_find_end( pcap_t *p, const struct timeval *first_timestamp,
-		struct timeval *last_timestamp )
+sf_find_end( pcap_t *p, const int snaplen, const struct timeval *first_timestamp,
+		struct timeval *last_timestamp, struct tcpslice_file_stats *st )
 {
 	time_t first_time = first_timestamp->tv_sec;
 	int64_t len_file;
@@ -326,9 +330,17 @@ sf_find_end( pcap_t *p, const struct timeval *first_timestamp,
 	u_char *buf, *bufpos, *bufend;
 	u_char *hdrpos;
 	struct pcap_pkthdr hdr, successor_hdr;
+	struct tcpslice_file_stats unused;
 	int status;
 
+	if ( ! st )
+	{
+		memset( &unused, 0, sizeof( unused ) );
+		st = &unused;
+	}
+
 	/* Find the length of the file. */
+	++st->seeks;
 	if ( fseek64( pcap_file (p), (int64_t) 0, SEEK_END ) < 0 )
 		return 0;
 
@@ -346,6 +358,7 @@ sf_find_end( pcap_t *p, const struct timeval *first_timestamp,
 	 * finding a "definite" header and following its chain to the
 	 * end of the file.
 	 */
+	++st->seeks;
 	if ( fseek64( pcap_file( p ), -(int64_t) num_bytes, SEEK_END ) < 0 )
 		return 0;
 
@@ -359,9 +372,10 @@ sf_find_end( pcap_t *p, const struct timeval *first_timestamp,
 
 	if ( fread( (char *) bufpos, num_bytes, 1, pcap_file( p ) ) != 1 )
 		goto done;
+	st->bytes_read += num_bytes;
 
-	if ( find_header( p, bufpos, num_bytes,
-			  first_time, 0L, &hdrpos, &hdr ) != HEADER_DEFINITELY )
+	if ( find_header( p, bufpos, num_bytes, first_time, 0L,
+			  &hdrpos, &hdr, &st->headers ) != HEADER_DEFINITELY )
 		goto done;
 
 	/* Okay, we have a definite header in our hands.  Follow its
@@ -408,11 +422,11 @@ sf_find_end( pcap_t *p, const struct timeval *first_timestamp,
 
 	/* Success!  Last valid packet is at hdrpos. */
 	TIMEVAL_FROM_PKTHDR_TS(*last_timestamp, hdr.ts);
-	status = 1;
 
 	/* Seek so that the next read will start at last valid packet. */
-	if ( fseek64( pcap_file( p ), -(int64_t) (bufend - hdrpos), SEEK_END ) < 0 )
-		error( "final fseek64() failed in %s()", __func__ );
+	++st->seeks;
+	if ( fseek64( pcap_file( p ), -(int64_t) (bufend - hdrpos), SEEK_END ) == 0 )
+		status = 1;
 
     done:
 	free( (char *) buf );
@@ -461,16 +475,19 @@ interpolated_position( const struct timeval *min_time, const int64_t min_pos,
 
 /* Reads packets linearly until one with a time >= the given desired time
  * is found; positions the dump file so that the next read will start
- * at the given packet.  Returns non-zero on success, 0 if an EOF was
- * first encountered.
+ * at the given packet.  Returns 1 on success, 0 if an EOF was first
+ * encountered and -1 with a message in errbuf on error.
  */
 static int
-read_up_to( pcap_t *p, const struct timeval *desired_time )
+read_up_to( pcap_t *p, const struct timeval *desired_time, char *errbuf,
+		struct tcpslice_file_stats *st )
 {
 	struct pcap_pkthdr hdr;
+	struct stats_clock clock;
 	int64_t pos;
 	int status;
 
+	stats_clock_start( &clock );
 	for ( ; ; )
 	{
 		struct timeval tvbuf;
@@ -486,8 +503,11 @@ read_up_to( pcap_t *p, const struct timeval *desired_time )
 				break;
 				}
 
-			error( "bad status in %s()", __func__ );
+			snprintf( errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr( p ) );
+			return -1;
 		}
+		++st->packets_read;
+		st->bytes_read += PACKET_HDR_LEN + hdr.caplen;
 
 		TIMEVAL_FROM_PKTHDR_TS(tvbuf, hdr.ts);
 
@@ -498,8 +518,13 @@ read_up_to( pcap_t *p, const struct timeval *desired_time )
 		}
 	}
 
+	++st->seeks;
 	if ( fseek64( pcap_file( p ), pos, SEEK_SET ) < 0 )
-		error( "fseek64() failed in %s()", __func__ );
+	{
+		snprintf( errbuf, PCAP_ERRBUF_SIZE, "fseek64() failed in %s()", __func__ );
+		return -1;
+	}
+	stats_clock_stop( &clock, &st->read_up_to );
 
 	return (status);
 }
@@ -511,27 +536,40 @@ read_up_to( pcap_t *p, const struct timeval *desired_time )
  * file.  min_pos is the file position (byte offset) corresponding to
  * the min_time packet and max_pos is the same for the max_time packet.
  *
- * Returns non-zero on success, 0 if the given position is beyond max_pos.
+ * Returns 1 on success, 0 if the given position is beyond max_pos and -1
+ * with a message in errbuf (of PCAP_ERRBUF_SIZE bytes) on error.
+ * Each position it tries is counted as a probe in "st".
  *
  * NOTE: when calling this routine, the sf_readfile stream *must* be
  * already aligned so that the next call to sf_next_packet() will yield
  * a valid packet.
  */
 int
-sf_find_packet( pcap_t *p,
+sf_find_packet( pcap_t *p, const int snaplen,
 		struct timeval *min_time, int64_t min_pos,
 		struct timeval *max_time, int64_t max_pos,
-		const struct timeval *desired_time )
+		const struct timeval *desired_time, char *errbuf,
+		struct tcpslice_file_stats *st )
 {
 	int status = 1;
 	struct timeval min_time_copy, max_time_copy;
 	u_int num_bytes = MAX_BYTES_FOR_DEFINITE_HEADER;
 	u_char *buf, *hdrpos;
 	struct pcap_pkthdr hdr;
+	struct tcpslice_file_stats unused;
+
+	if ( ! st )
+	{
+		memset( &unused, 0, sizeof( unused ) );
+		st = &unused;
+	}
 
 	buf = (u_char *) malloc( num_bytes );
 	if ( ! buf )
-		error( "malloc() failed in %s()", __func__ );
+	{
+		snprintf( errbuf, PCAP_ERRBUF_SIZE, "malloc() failed in %s()", __func__ );
+		return -1;
+	}
 
 	min_time_copy = *min_time;
 	min_time = &min_time_copy;
@@ -555,12 +593,16 @@ sf_find_packet( pcap_t *p,
 
 		int64_t present_pos = ftell64( pcap_file( p ) );
 		if ( present_pos < 0 )
-			error ( "ftell64() failed in %s()", __func__ );
+		{
+			snprintf( errbuf, PCAP_ERRBUF_SIZE, "ftell64() failed in %s()", __func__ );
+			status = -1;
+			break;
+		}
 
 		if ( present_pos <= desired_pos &&
 		     (uint64_t) (desired_pos - present_pos) < STRAIGHT_SCAN_THRESHOLD )
 		{ /* we're close enough to just blindly read ahead */
-			status = read_up_to( p, desired_time );
+			status = read_up_to( p, desired_time, errbuf, st );
 			break;
 		}
 
@@ -571,31 +613,52 @@ sf_find_packet( pcap_t *p,
 		if ( desired_pos < min_pos )
 			desired_pos = min_pos;
 
+		++st->probes;
+		++st->seeks;
 		if ( fseek64( pcap_file( p ), desired_pos, SEEK_SET ) < 0 )
-			error( "fseek64() failed in %s()", __func__ );
+		{
+			snprintf( errbuf, PCAP_ERRBUF_SIZE, "fseek64() failed in %s()", __func__ );
+			status = -1;
+			break;
+		}
 
 		int num_bytes_read =
 			fread( (char *) buf, 1, num_bytes, pcap_file( p ) );
 
 		if ( num_bytes_read == 0 )
+		{
 			/* This shouldn't ever happen because we try to
 			 * undershoot, unless the dump file has only a
 			 * couple packets in it ...
 			 */
-			error( "fread() failed in %s()", __func__ );
+			snprintf( errbuf, PCAP_ERRBUF_SIZE, "fread() failed in %s()", __func__ );
+			status = -1;
+			break;
+		}
+		st->bytes_read += num_bytes_read;
 
 		if ( find_header( p, buf, num_bytes, min_time->tv_sec,
-				  max_time->tv_sec, &hdrpos, &hdr ) !=
-		     HEADER_DEFINITELY )
-			error( "can't find header at position %ld in dump file",
+				  max_time->tv_sec, &hdrpos, &hdr,
+				  &st->headers ) != HEADER_DEFINITELY )
+		{
+			snprintf( errbuf, PCAP_ERRBUF_SIZE,
+				"can't find header at position %" PRId64 " in dump file",
 				desired_pos );
+			status = -1;
+			break;
+		}
 
 		/* Correct desired_pos to reflect beginning of packet. */
 		desired_pos += (hdrpos - buf);
 
 		/* Seek to the beginning of the header. */
+		++st->seeks;
 		if ( fseek64( pcap_file( p ), desired_pos, SEEK_SET ) < 0 )
-			error( "fseek64() failed in %s()", __func__ );
+		{
+			snprintf( errbuf, PCAP_ERRBUF_SIZE, "fseek64() failed in %s()", __func__ );
+			status = -1;
+			break;
+		}
 
 		TIMEVAL_FROM_PKTHDR_TS(tvbuf, hdr.ts);
 		if ( sf_timestamp_less_than( &tvbuf, desired_time ) )
@@ -619,3 +682,122 @@ sf_find_packet( pcap_t *p,
 
 	return status;
 }
+
+/* Reads the header of the next packet record, and skips its data.  "nsec"
+ * tells that the file has nanosecond timestamps, turned into microseconds
+ * as libpcap does.  Returns 1 on success, 0 at the end of the file or of
+ * its last complete record and -1 with a message in errbuf on error.
+ */
+int
+sf_next_header( pcap_t *p, struct pcap_pkthdr *hdr, const int nsec,
+		char *errbuf )
+{
+	u_char buf[PACKET_HDR_LEN];
+
+	if ( fread( (char *) buf, sizeof( buf ), 1, pcap_file( p ) ) != 1 )
+	{
+		if ( ferror( pcap_file( p ) ) )
+		{
+			snprintf( errbuf, PCAP_ERRBUF_SIZE, "fread() failed in %s()", __func__ );
+			return -1;
+		}
+		return 0;
+	}
+
+	extract_header( p, buf, hdr );
+	if ( hdr->caplen > MAX_REASONABLE_PACKET_LENGTH )
+	{
+		snprintf( errbuf, PCAP_ERRBUF_SIZE,
+			"bogus packet length %u in %s()", hdr->caplen, __func__ );
+		return -1;
+	}
+	if ( nsec )
+		hdr->ts.tv_usec /= 1000;
+
+	/* Let stdio skip small records within its buffer, and seek over
+	 * the others.
+	 */
+	if ( fseek64( pcap_file( p ), (int64_t) hdr->caplen, SEEK_CUR ) < 0 )
+	{
+		snprintf( errbuf, PCAP_ERRBUF_SIZE, "fseek64() failed in %s()", __func__ );
+		return -1;
+	}
+
+	return 1;
+}
+
+/* Estimates the number of packets of a file from the mean size of the
+ * records found in a buffer's worth of it at each of "samples" positions
+ * spread between start_pos, that of its first packet, and stop_pos, that
+ * of its last packet.  A file that fits in the buffer is counted exactly.
+ * Returns the estimate, or -1 if no packet could be found.  The stream is
+ * left anywhere.
+ */
+int64_t
+sf_estimate_packets( pcap_t *p, const int snaplen,
+		const struct timeval *first_timestamp,
+		const int64_t start_pos, const int64_t stop_pos,
+		const int samples )
+{
+	time_t first_time = first_timestamp->tv_sec;
+	int64_t len_file, pos, packets = 0, bytes = 0;
+	int num_bytes, i;
+	u_char *buf, *bufpos, *bufend, *hdrpos;
+	struct pcap_pkthdr hdr;
+	uint64_t examined = 0;
+
+	if ( fseek64( pcap_file( p ), (int64_t) 0, SEEK_END ) < 0 )
+		return -1;
+	len_file = ftell64( pcap_file( p ) );
+	if ( len_file < 0 )
+		return -1;
+
+	buf = (u_char *) malloc( MAX_BYTES_FOR_DEFINITE_HEADER );
+	if ( ! buf )
+		return -1;
+
+	for ( i = 0; i < samples; ++i )
+	{
+		pos = start_pos + ( stop_pos - start_pos ) * i / samples;
+		num_bytes = MAX_BYTES_FOR_DEFINITE_HEADER;
+		if ( len_file - pos < num_bytes )
+			num_bytes = (int) ( len_file - pos );
+		if ( num_bytes <= (int) PACKET_HDR_LEN ||
+		     fseek64( pcap_file( p ), pos, SEEK_SET ) < 0 ||
+		     fread( (char *) buf, num_bytes, 1, pcap_file( p ) ) != 1 )
+			break;
+		bufend = buf + num_bytes;
+
+		if ( find_header( p, buf, num_bytes, first_time, 0L,
+				  &hdrpos, &hdr, &examined ) != HEADER_DEFINITELY )
+			continue;
+
+		/* Count the complete records chained from there. */
+		for ( bufpos = hdrpos;
+		      bufpos + PACKET_HDR_LEN + hdr.caplen <= bufend; )
+		{
+			++packets;
+			bytes += PACKET_HDR_LEN + hdr.caplen;
+			bufpos += PACKET_HDR_LEN + hdr.caplen;
+			if ( bufpos > bufend - PACKET_HDR_LEN )
+				break;
+			extract_header( p, bufpos, &hdr );
+			if ( ! reasonable_header( &hdr, first_time, 0L ) )
+				break;
+		}
+
+		/* The whole file was in the buffer. */
+		if ( i == 0 && pos == start_pos && bufpos == bufend &&
+		     pos + num_bytes == len_file )
+		{
+			free( (char *) buf );
+			return packets;
+		}
+	}
+
+	free( (char *) buf );
+
+	if ( packets == 0 )
+		return -1;
+	return 1 + ( stop_pos - start_pos ) * packets / bytes;
+}
@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * server.c - answer slicing requests over a Unix domain socket
+ *
+ * A request is the command line of an ordinary tcpslice invocation, sent
+ * by "tcpslice -U socket ..." along with the client's working directory
+ * and its standard output and standard error descriptors.  The server
+ * runs each request in a child process, which inherits the metadata cache
+ * of the server (see cache.c) and writes its output and its error messages
+ * straight to the client's descriptors.  The exit status of the child is
+ * then sent back to the client, which exits with it.
+ *
+ * The server refreshes the cache for the directories it was given every
+ * SERVER_RESCAN_INTERVAL seconds, so that requests for files in these
+ * directories do not have to look for the last packet of every file.
+ *
+ * The requests are received in the same poll() loop, without blocking, so
+ * that a client that is slow to send its request, or never does, holds up
+ * no one else; it has SERVER_REQUEST_TIMEOUT seconds to do so.  As the
+ * requests run as the user of the server, only that user may connect:
+ * the socket is only accessible to it and, where the system tells, the
+ * user of the client is checked too.
+ */
+
+#include <config.h>
+
+// For struct ucred.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_UN_H
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#endif
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+/* Non-zero in the child processes that run the requests. */
+int serving = 0;
+
+#ifndef HAVE_SYS_UN_H
+
+void
+serve(const char *socket_name _U_, char *dirs[] _U_, const int numdirs _U_,
+      int (*handler)(int, char **) _U_)
+{
+	error("Unix domain sockets are not supported on this platform");
+}
+
+int
+query(const char *socket_name _U_, int argc _U_, char **argv _U_)
+{
+	error("Unix domain sockets are not supported on this platform");
+	/* NOTREACHED */
+	return 1;
+}
+
+#else /* HAVE_SYS_UN_H */
+
+/* How often to look for new or modified files in the watched directories. */
+#define SERVER_RESCAN_INTERVAL 10	/* seconds */
+
+/* How long a client has to send its request once connected. */
+#define SERVER_REQUEST_TIMEOUT 10	/* seconds */
+
+/* Largest request accepted, i.e. the working directory and the arguments. */
+#define MAX_REQUEST_SIZE (1024 * 1024)
+
+/* Most descriptors received in a message, the ones not used being closed. */
+#define MAX_RECEIVED_FDS 16
+
+/* The connections whose request is still being received. */
+struct pending {
+	int	fd;
+	time_t	deadline;
+	int	client_fds[2];
+	uint32_t len;
+	size_t	got;		/* bytes of the length, then of the request */
+	char	*buf;		/* the request, once its length is known */
+};
+
+static struct pending *pendings = NULL;
+static int numpendings = 0, maxpendings = 0;
+
+/* The requests being run, and the connections to report their status to. */
+struct request {
+	pid_t	pid;
+	int	fd;
+};
+
+static struct request *requests = NULL;
+static int numrequests = 0, maxrequests = 0;
+
+/* The socket the requests come in on. */
+static int listen_fd = -1;
+
+/* Written to by the SIGCHLD handler so that poll() returns. */
+static int sigchld_pipe[2] = { -1, -1 };
+
+static void
+sigchld_handler(int sig _U_)
+{
+	int saved_errno = errno;
+
+	(void)write(sigchld_pipe[1], "", 1);
+	errno = saved_errno;
+}
+
+static int
+make_sockaddr(const char *socket_name, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(socket_name) >= sizeof(addr->sun_path))
+		return -1;
+	strcpy(addr->sun_path, socket_name);
+	return 0;
+}
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void
+refresh_cache(char *dirs[], const int numdirs)
+{
+	int i;
+
+	cache_prune();
+	for (i = 0; i < numdirs; i++)
+		if (cache_refresh_dir(dirs[i]) < 0)
+			warning("cannot read directory %s", dirs[i]);
+}
+
+/* Report the exit status of the finished requests to their clients. */
+static void
+reap_requests(void)
+{
+	pid_t pid;
+	int status, i;
+	int32_t result;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < numrequests; i++)
+			if (requests[i].pid == pid)
+				break;
+		if (i == numrequests)
+			continue;
+
+		if (WIFEXITED(status))
+			result = WEXITSTATUS(status);
+		else if (WIFSIGNALED(status))
+			result = 128 + WTERMSIG(status);
+		else
+			result = 1;
+		/* The client may be gone already, which is not our problem. */
+		(void)write_full(requests[i].fd, &result, sizeof(result));
+		close(requests[i].fd);
+		requests[i] = requests[--numrequests];
+	}
+}
+
+/* Keep the client's standard output and standard error, which come as two
+ * descriptors attached to the length of the request, and close any other
+ * descriptor that came along.
+ */
+static void
+take_fds(struct msghdr *msg, int client_fds[2])
+{
+	struct cmsghdr *cmsg;
+	int fds[MAX_RECEIVED_FDS];
+	size_t n, i;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS ||
+		    cmsg->cmsg_len < CMSG_LEN(0))
+			continue;
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (n > MAX_RECEIVED_FDS)
+			n = MAX_RECEIVED_FDS;
+		memcpy(fds, CMSG_DATA(cmsg), n * sizeof(int));
+		if (n == 2 && client_fds[0] < 0) {
+			client_fds[0] = fds[0];
+			client_fds[1] = fds[1];
+			(void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+			(void)fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			close(fds[i]);
+	}
+}
+
+/* Receive what has come of a request: its length, with the client's
+ * standard output and standard error attached, then the NUL-separated
+ * strings.  Return 1 once it is all there, 0 if there is more to come and
+ * -1 if the request is malformed or the client is gone.
+ */
+static int
+receive_request(struct pending *pr)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(MAX_RECEIVED_FDS * sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+
+	if (pr->buf == NULL) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = (char *) &pr->len + pr->got;
+		iov.iov_len = sizeof(pr->len) - pr->got;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		if ((n = recvmsg(pr->fd, &msg, 0)) < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == EINTR ? 0 : -1;
+		take_fds(&msg, pr->client_fds);
+		if (n == 0)
+			return -1;
+		if ((pr->got += n) < sizeof(pr->len))
+			return 0;
+		if (pr->client_fds[0] < 0 || pr->len == 0 ||
+		    pr->len > MAX_REQUEST_SIZE ||
+		    (pr->buf = malloc(pr->len + 1)) == NULL)
+			return -1;
+		pr->got = 0;
+	}
+
+	n = read(pr->fd, pr->buf + pr->got, pr->len - pr->got);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ||
+		    errno == EINTR ? 0 : -1;
+	if (n == 0)
+		return -1;
+	if ((pr->got += n) < pr->len)
+		return 0;
+	pr->buf[pr->len] = '\0';
+	return 1;
+}
+
+/* Run the request in the child process; never returns. */
+static void
+run_request(char *buf, const uint32_t len, int client_fds[2],
+	    int (*handler)(int, char **))
+{
+	char **argv, *p, *end = buf + len;
+	int argc = 0;
+
+	serving = 1;
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	if (dup2(client_fds[0], STDOUT_FILENO) < 0 ||
+	    dup2(client_fds[1], STDERR_FILENO) < 0)
+		exit(1);
+	if (client_fds[0] > STDERR_FILENO)
+		close(client_fds[0]);
+	if (client_fds[1] > STDERR_FILENO)
+		close(client_fds[1]);
+
+	/* The working directory, then the arguments. */
+	if (chdir(buf) < 0)
+		error("cannot change to directory %s: %s", buf, strerror(errno));
+	if ((argv = calloc(len + 1, sizeof(char *))) == NULL)
+		error("out of memory");
+	for (p = buf + strlen(buf) + 1; p < end; p += strlen(p) + 1)
+		argv[argc++] = p;
+	argv[argc] = NULL;
+	if (argc == 0)
+		error("empty request");
+
+	optind = 1;
+	exit(handler(argc, argv));
+}
+
+/* Whether the peer of a connection runs as the user of the server, as
+ * far as the system tells; otherwise the mode of the socket keeps the
+ * other users out.
+ */
+static int
+peer_allowed(int fd)
+{
+#if defined(__linux__) && defined(SO_PEERCRED)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return 0;
+	return cred.uid == geteuid();
+#else
+	(void)fd;
+	return 1;
+#endif
+}
+
+static void
+accept_request(void)
+{
+	struct pending *pr;
+	int fd;
+
+	if ((fd = accept(listen_fd, NULL, NULL)) < 0)
+		return;
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (! peer_allowed(fd)) {
+		warning("request from another user refused");
+		close(fd);
+		return;
+	}
+	(void)fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	if (numpendings == maxpendings) {
+		maxpendings = maxpendings ? 2 * maxpendings : 16;
+		pendings = realloc(pendings, maxpendings * sizeof(struct pending));
+		if (pendings == NULL)
+			error("out of memory");
+	}
+	pr = &pendings[numpendings++];
+	memset(pr, 0, sizeof(*pr));
+	pr->fd = fd;
+	pr->deadline = time(NULL) + SERVER_REQUEST_TIMEOUT;
+	pr->client_fds[0] = pr->client_fds[1] = -1;
+}
+
+/* Forget a request that is still being received, closing its connection
+ * unless it was handed over to a child.
+ */
+static void
+drop_pending(const int i, const int close_fd)
+{
+	struct pending *pr = &pendings[i];
+
+	if (close_fd)
+		close(pr->fd);
+	if (pr->client_fds[0] >= 0)
+		close(pr->client_fds[0]);
+	if (pr->client_fds[1] >= 0)
+		close(pr->client_fds[1]);
+	free(pr->buf);
+	pendings[i] = pendings[--numpendings];
+}
+
+/* In the child process of a request, close the descriptors of the server
+ * and of the other requests, which it never execs to lose, so that these
+ * go away when the server closes its own copy; only the output and error
+ * descriptors of the client of the request are kept.
+ */
+static void
+close_server_fds(const struct pending *own)
+{
+	int i;
+
+	close(listen_fd);
+	close(sigchld_pipe[0]);
+	close(sigchld_pipe[1]);
+	for (i = 0; i < numpendings; i++) {
+		close(pendings[i].fd);
+		if (&pendings[i] == own)
+			continue;
+		if (pendings[i].client_fds[0] >= 0)
+			close(pendings[i].client_fds[0]);
+		if (pendings[i].client_fds[1] >= 0)
+			close(pendings[i].client_fds[1]);
+	}
+	for (i = 0; i < numrequests; i++)
+		close(requests[i].fd);
+}
+
+/* Run a request that has been received in full. */
+static void
+start_request(struct pending *pr, int (*handler)(int, char **))
+{
+	pid_t pid;
+
+	if (numrequests == maxrequests) {
+		maxrequests = maxrequests ? 2 * maxrequests : 16;
+		requests = realloc(requests, maxrequests * sizeof(struct request));
+		if (requests == NULL)
+			error("out of memory");
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid == 0) {
+		close_server_fds(pr);
+		run_request(pr->buf, pr->len, pr->client_fds, handler);
+	}
+	if (pid < 0) {
+		int32_t result = 1;
+
+		warning("fork() failed: %s", strerror(errno));
+		(void)write_full(pr->fd, &result, sizeof(result));
+		close(pr->fd);
+		return;
+	}
+	requests[numrequests].pid = pid;
+	requests[numrequests].fd = pr->fd;
+	numrequests++;
+}
+
+/* Receive what has come of the pending requests, run the ones that are
+ * complete and drop the malformed and late ones.
+ */
+static void
+receive_requests(const struct pollfd *pfd, int (*handler)(int, char **))
+{
+	time_t now = time(NULL);
+	int i, ret;
+
+	/* Backwards, as dropping one moves the last one in its place. */
+	for (i = numpendings - 1; i >= 0; i--) {
+		ret = 0;
+		if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+			ret = receive_request(&pendings[i]);
+		if (ret > 0) {
+			start_request(&pendings[i], handler);
+			drop_pending(i, 0);
+		} else if (ret < 0) {
+			warning("malformed request");
+			drop_pending(i, 1);
+		} else if (now >= pendings[i].deadline) {
+			warning("request timed out");
+			drop_pending(i, 1);
+		}
+	}
+}
+
+/* Serve requests on the given socket until killed.  Every request is run
+ * by calling "handler" with its arguments in a child process.
+ */
+void
+serve(const char *socket_name, char *dirs[], const int numdirs,
+      int (*handler)(int, char **))
+{
+	struct sockaddr_un addr;
+	struct pollfd *pfd = NULL;
+	struct stat sb;
+	time_t last_rescan, now, timeout;
+	mode_t mask;
+	int maxpfd = 0, i, n;
+	char c;
+
+	if (make_sockaddr(socket_name, &addr) < 0)
+		error("socket name %s is too long", socket_name);
+
+	if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		error("socket() failed: %s", strerror(errno));
+	/* Replace a stale socket, but nothing else. */
+	if (lstat(socket_name, &sb) == 0 && S_ISSOCK(sb.st_mode))
+		(void)unlink(socket_name);
+	/* Only for the user of the server. */
+	mask = umask(0077);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		error("cannot bind to %s: %s", socket_name, strerror(errno));
+	umask(mask);
+	if (listen(listen_fd, SOMAXCONN) < 0)
+		error("listen() failed: %s", strerror(errno));
+	(void)fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+	if (pipe(sigchld_pipe) < 0)
+		error("pipe() failed: %s", strerror(errno));
+	(void)fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+	(void)fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+	(void)fcntl(sigchld_pipe[0], F_SETFD, FD_CLOEXEC);
+	(void)fcntl(sigchld_pipe[1], F_SETFD, FD_CLOEXEC);
+	signal(SIGCHLD, sigchld_handler);
+	/* Clients going away must not take the server down. */
+	signal(SIGPIPE, SIG_IGN);
+
+	refresh_cache(dirs, numdirs);
+	last_rescan = time(NULL);
+
+	for (;;) {
+		if (maxpfd < 2 + numpendings) {
+			maxpfd = 2 + maxpendings;
+			pfd = realloc(pfd, maxpfd * sizeof(struct pollfd));
+			if (pfd == NULL)
+				error("out of memory");
+		}
+		pfd[0].fd = listen_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = sigchld_pipe[0];
+		pfd[1].events = POLLIN;
+		/* Wake up for the next rescan, or the next request due. */
+		now = time(NULL);
+		timeout = last_rescan + SERVER_RESCAN_INTERVAL - now;
+		for (i = 0; i < numpendings; i++) {
+			pfd[2 + i].fd = pendings[i].fd;
+			pfd[2 + i].events = POLLIN;
+			pfd[2 + i].revents = 0;
+			if (pendings[i].deadline - now < timeout)
+				timeout = pendings[i].deadline - now;
+		}
+		if (timeout < 0)
+			timeout = 0;
+
+		n = poll(pfd, 2 + numpendings, (int) timeout * 1000);
+		if (n < 0 && errno != EINTR)
+			error("poll() failed: %s", strerror(errno));
+		if (n < 0)
+			for (i = 0; i < 2 + numpendings; i++)
+				pfd[i].revents = 0;
+
+		if (n > 0 && (pfd[1].revents & POLLIN))
+			while (read(sigchld_pipe[0], &c, 1) == 1)
+				continue;
+		reap_requests();
+
+		if (time(NULL) - last_rescan >= SERVER_RESCAN_INTERVAL) {
+			refresh_cache(dirs, numdirs);
+			last_rescan = time(NULL);
+		}
+
+		receive_requests(pfd + 2, handler);
+		if (n > 0 && (pfd[0].revents & POLLIN))
+			accept_request();
+	}
+}
+
+/* Send our command line to the server listening on the given socket and
+ * return the exit status of the request.
+ */
+int
+query(const char *socket_name, int argc, char **argv)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char cwd[PATH_MAX], *buf, *p;
+	int fd, fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+	uint32_t len;
+	int32_t result;
+	int i;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		error("getcwd() failed: %s", strerror(errno));
+
+	len = strlen(cwd) + 1;
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	if (len > MAX_REQUEST_SIZE)
+		error("too many arguments");
+	if ((p = buf = malloc(len)) == NULL)
+		error("out of memory");
+	strcpy(p, cwd);
+	p += strlen(p) + 1;
+	for (i = 0; i < argc; i++) {
+		strcpy(p, argv[i]);
+		p += strlen(p) + 1;
+	}
+
+	if (make_sockaddr(socket_name, &addr) < 0)
+		error("socket name %s is too long", socket_name);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		error("socket() failed: %s", strerror(errno));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		error("cannot connect to %s: %s", socket_name, strerror(errno));
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = &len;
+	iov.iov_len = sizeof(len);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(fd, &msg, 0) != (ssize_t) sizeof(len) ||
+	    write_full(fd, buf, len) < 0)
+		error("cannot send request to %s: %s", socket_name, strerror(errno));
+	free(buf);
+
+	if (read_full(fd, &result, sizeof(result)) < 0)
+		error("connection to %s closed before the request completed",
+		      socket_name);
+	close(fd);
+	return result;
+}
+
+#endif /* HAVE_SYS_UN_H */
@@ -37,16 +37,19 @@
  * This file contains code for tracking TCP and VoIP (SIP & H.323) sessions.
  *
  * IMPORTANT: None of these features are available if libnids >= 1.21 wasn't
- * found by ./configure; SIP session tracking is available only if Libosip was
- * found by ./configure and H.323 session tracking is available only if
- * Libooh323c was found by ./configure. These libraries can be downloaded from:
+ * found by ./configure, in which case TCP and UDP sessions are tracked by
+ * the built-in tracker of flows.c instead; SIP session tracking is available
+ * only if Libosip was found by ./configure and H.323 session tracking is
+ * available only if Libooh323c was found by ./configure. These libraries can
+ * be downloaded from:
  *  - http://libnids.sourceforge.net/
  *  - https://www.gnu.org/software/osip/
  *  - https://sourceforge.net/projects/ooh323c/
  *
  * There are several entry points (from tcpslice.c) to this file:
  *  - sessions_init() has to be called once before any tracking can be done
- *  - sessions_nids_init() has to be called each time we change PCAP file
+ *  - sessions_pcap_init() has to be called each time we change PCAP file
+ *  - sessions_packet() has to be called for each packet
  *  - sessions_exit() is used to clean up and report after we're done
  *  - ip_callback() is called for defragmented IPv4 packets, including UDP & TCP
  *  - udp_callback() is called upon reception of correct UDP data
@@ -80,6 +83,11 @@
  * we are past the end-time, in which case we continue to track
  * the existing sessions but ignore new sessions.
  *
+ * `lookback_time' equals 1 before the start-time, while looking back
+ * (-b) for the sessions that are already open at the start-time, in
+ * which case their frames are kept in memory and dropped with the
+ * sessions that close before the start-time.
+ *
  * `track_sessions' is a flag set by sessions_init() and
  * sessions_exit() but it is mostly used in tcpslice.c to know
  * whether or not to pass each PCAP frame to libnids in order to
@@ -106,34 +114,84 @@
  * to be closed. This is useful to deal with faulty implementations
  * of some protocols or packet loss, which otherwise would keep
  * resources allocated until the call to sessions_exit().
+ *
+ * `sessions_max_open_files' can be set by the user to the number of
+ * PCAP files of sessions that may be open at a time; the least recently
+ * written ones are closed, and reopened for appending when needed, in
+ * order to stay below it (default: 0 = as many as the system allows).
+ *
+ * `sessions_buffer_size' can be set by the user to a number of bytes
+ * of packets of sessions to keep in memory before writing them to the
+ * PCAP files of the sessions, so that they are written in big chunks
+ * rather than one packet at a time (default: 0 = do not buffer).
+ *
+ * `sessions_native' can be set by the user to track sessions with the
+ * built-in tracker of flows.c rather than with libnids, which is what
+ * happens anyway without libnids.
+ *
+ * `sessions_threads' can be set by the user to the number of threads
+ * the built-in tracker splits the sessions between (default: 0 = track
+ * them in the main thread); libnids only tracks them in the main thread.
  */
 int				verbose = 0;
 int				bonus_time = 0;
+int				lookback_time = 0;
 int				track_sessions = 0;
 uint32_t			sessions_count = 0;
 char				*sessions_file_format = NULL;
 time_t				sessions_expiration_delay = 0;
+unsigned int			sessions_max_open_files = 0;
+size_t				sessions_buffer_size = 0;
+int				sessions_native = 0;
+unsigned int			sessions_threads = 0;
+struct sessions_stats		sessions_stats = { 0, 0, 0 };
+
+/*
+ * The start-time has come: the sessions still open are the ones to keep.
+ */
+void				sessions_lookback_end(void)
+{
+  sessions_flush();
+  lookback_time = 0;
+  dumpers_lookback_end();
+}
 
 #ifndef HAVE_LIBNIDS
 
 void
-sessions_init(const char *types _U_)
+sessions_init(const char *types)
 {
-  error("libnids required for session tracking support, sorry.");
+  sessions_native = 1;
+  flows_init(types);
 }
 
 void				sessions_exit(void)
 {
+  flows_exit();
+}
+
+void				sessions_pcap_init(pcap_t *p)
+{
+  dumpers_init(p);
+}
+
+void				sessions_packet(pcap_t *p, struct pcap_pkthdr *h, const u_char *data)
+{
+  flows_packet(p, h, data);
 }
 
-void				sessions_nids_init(pcap_t *p _U_)
+void				sessions_flush(void)
 {
+  flows_flush();
 }
 
 #else /* HAVE_LIBNIDS */
 
 # include <string.h>
 # include <nids.h>
+# ifdef HAVE_PTHREADS
+#  include <pthread.h>
+# endif /* HAVE_PTHREADS */
 # ifdef HAVE_LIBOSIPPARSER2
 #  include <osip2/osip.h>
 #  include <osipparser2/sdp_message.h>
@@ -172,18 +230,6 @@ enum type
   CLASS_H323			= TYPE_H225_RAS | TYPE_H225_CS | TYPE_RTP | TYPE_RTCP
 };
 
-/*
- * Structure used by sessions and subsessions to safely share
- * the same file descriptor, when they have to be saved in the
- * same PCAP file and can be closed in a different order than
- * they were opened.
- */
-struct shared_dumper
-{
-  char				*filename;
-  pcap_dumper_t			*filedesc;
-  uint32_t			references;
-};
 
 /*
  * (Almost) generic session description object containing
@@ -196,12 +242,15 @@ struct shared_dumper
  *               that can be used to search for children of a specific session
  *  - parent_id: 0 for primary sessions, parent's ID for subsessions
  *  - timeout: when the session has to be forcefully closed
+ *  - heap_index: where the session is in `timeout_heap', 1-based, 0 if not there
  *  - callback: method to call in order to process session data
  *  - dumper: file to which this session's packets will be extracted
  *  - lastseen: timestamp of the last packet in this session
  *  - bytes: total amount of data captured for this session
  *  - next: pointer to the next session in the list of all sessions
  *  - prev: pointer to the previous session in the list of all sessions
+ *  - addr_next, addr_prev: links in the chain of sessions indexed by address
+ *  - parent_next, parent_prev: links in the chain of sessions indexed by parent_id
  *  - u: union containing extra properties that are needed for some session types
  */
 struct session
@@ -211,12 +260,17 @@ struct session
   uint32_t			id;
   uint32_t			parent_id;
   time_t			timeout;
+  uint32_t			heap_index;
   struct session		*(*callback)(struct session *elt, u_char *data, uint32_t len);
   struct shared_dumper		*dumper;
   struct timeval		lastseen;
   uint64_t			bytes;
   struct session		*next;
   struct session		*prev;
+  struct session		*addr_next;
+  struct session		**addr_prev;
+  struct session		*parent_next;
+  struct session		**parent_prev;
 # if defined(HAVE_LIBOSIPPARSER2) || defined(HAVE_LIBOOH323C)
   union
   {
@@ -245,17 +299,60 @@ struct session
  */
 static struct session		*first_session = NULL;
 
+/*
+ * Indexes of the same sessions, so that sessions_find() does not have
+ * to walk the whole list for every packet:
+ *  - `addr_table' chains the sessions with a complete address by the
+ *    hash of that address, which is the same in both directions, and
+ *    the sessions with wildcards in their address (e.g. RTP sessions
+ *    with an unknown source port) by the hash of one of its complete
+ *    endpoints, if any
+ *  - `wild_sessions' chains the sessions without a complete endpoint
+ *  - `parent_table' chains the subsessions by hash of their parent_id
+ * Both tables have `table_size' buckets, a power of 2 that grows with
+ * sessions_count.
+ */
+static struct session		**addr_table = NULL;
+static struct session		**parent_table = NULL;
+static struct session		*wild_sessions = NULL;
+static uint32_t			table_size = 0;
+
+/*
+ * Binary min-heap of the sessions that have a timeout, by timeout, so
+ * that only the sessions that are due have to be visited to expire them.
+ */
+static struct session		**timeout_heap = NULL;
+static uint32_t			timeout_heap_count = 0;
+static uint32_t			timeout_heap_size = 0;
+
 /*
  * Bitmask of the session types the user asked to track
  */
 static enum type		sessions_track_types = TYPE_NONE;
 
 /*
- * Count how many PCAP savefiles were opened, to cope with the
- * "Too many open files" errors and work around them by closing
- * the oldest 10% of the file descriptors.
+ * Sessions come from a slab, see slab_alloc().
+ */
+static struct slab		session_slab = { sizeof(struct session), NULL, NULL, 0, 0, 0, 0 };
+
+/*
+ * The packet being passed to libnids, which wants to be able to modify it.
  */
-static unsigned int		dumper_fd_count = 0;
+static u_char			*packet_copy = NULL;
+static bpf_u_int32		packet_copy_size = 0;
+
+/*
+ * The payloads handed to the callbacks of each type of signalling session
+ * and, of these, the ones that looked like signalling and were parsed.
+ */
+struct signalling_stats
+{
+  uint64_t			payloads;
+  uint64_t			parsed;
+};
+static struct signalling_stats	sip_stats = { 0, 0 };
+static struct signalling_stats	h225_ras_stats = { 0, 0 };
+static struct signalling_stats	h225_cs_stats = { 0, 0 };
 
 /*
  * The static functions declared below have the following purposes:
@@ -271,15 +368,18 @@ static unsigned int		dumper_fd_count = 0;
  * can search starting from the beginning of the list or from the element
  * pointed by the `start' parameter, it can search for sessions with specific
  * types described by the `t' parameter, or by parent ID, or most of the time
- * by source and destination IP address & port.
+ * by source and destination IP address & port. It looks the sessions up in
+ * the indexes but finds what walking the list would find.
+ *
+ * `index_add' and `index_del' insert a session in and remove it from the
+ * indexes, which `index_grow' rebuilds with more buckets.
  *
- * `dumper_open' and `dumper_close' manage multiple references to the same
- * PCAP file used for saving packets when the user asked for extraction of
- * sessions into separate files. `dumper_too_many_open_files' tries to cope
- * with the "Too many open files" error that can happen when dealing with
- * large PCAP files containing many simultaneous sessions.
+ * `sessions_set_timeout' changes the timeout of a session, which must not
+ * be set directly since it keeps `timeout_heap' in order, and
+ * `sessions_expire' deletes the sessions whose timeout is up.
  *
- * `dump_frame' actually saves the current packet to a PCAP file.
+ * `dump_frame' actually saves the current packet to a PCAP file, with the
+ * help of dumpers.c.
  *
  * `parse_type' simply converts a type from string to numerical form.
  *
@@ -293,13 +393,20 @@ static unsigned int		dumper_fd_count = 0;
  * in order to process respectively IETF's Session Initialization Protocol,
  * ITU's H.225 Registration Admission Status and H.225 Call Signaling (both
  * part of H.323) data.
+ *
+ * `signalling_callback' calls them for the payloads that pass the cheap
+ * check of `sip_signature', `h225_ras_signature' or `h225_cs_signature'
+ * respectively, so that data that cannot be signalling (RTP, keep-alives,
+ * partial messages...) never reaches the parsers.
  */
 static struct session		*sessions_add(const uint8_t t, const struct tuple4 *addr, const struct session *parent);
 static void			sessions_del(struct session *elt);
 static struct session		*sessions_find(struct session *start, const uint8_t t, const uint32_t parent_id, const struct tuple4 *addr);
-static struct shared_dumper	*dumper_open(const enum type t, const uint32_t id);
-static void			dumper_too_many_open_files(struct shared_dumper **d);
-static void			dumper_close(struct shared_dumper *d);
+static void			index_add(struct session *elt);
+static void			index_del(struct session *elt);
+static void			index_grow(void);
+static void			sessions_set_timeout(struct session *elt, const time_t timeout);
+static void			sessions_expire(const time_t now);
 static void			dump_frame(const u_char *data, const int len, struct shared_dumper *output);
 static enum type		parse_type(const char *str);
 static const char		*type2string(const enum type t, const int upper);
@@ -309,6 +416,10 @@ static void			udp_callback(struct tuple4 *addr, u_char *data, int len, struct ip
 static struct session		*sip_callback(struct session *elt, u_char *data, uint32_t len);
 static struct session		*h225_ras_callback(struct session *elt, u_char *data, uint32_t len);
 static struct session		*h225_cs_callback(struct session *elt, u_char *data, uint32_t len);
+static struct session		*signalling_callback(struct session *elt, u_char *data, uint32_t len);
+static int			sip_signature(const u_char *data, const uint32_t len);
+static int			h225_ras_signature(const u_char *data, const uint32_t len);
+static int			h225_cs_signature(const u_char *data, const uint32_t len);
 
 static enum type		parse_type(const char *str)
 {
@@ -332,6 +443,10 @@ sessions_init(const char *types)
 {
   char				*comma;
 
+  if (sessions_native) {
+    flows_init(types);
+    return;
+  }
   bonus_time = 0;
   sessions_track_types = TYPE_NONE;
   while (NULL != (comma = strchr(types, ','))) {
@@ -345,8 +460,16 @@ sessions_init(const char *types)
     first_session = first_session->next;
     --sessions_count;
     dumper_close(elt->dumper);
-    free(elt);
+    slab_free(&session_slab, elt);
   }
+  free(addr_table);
+  free(parent_table);
+  addr_table = parent_table = NULL;
+  wild_sessions = NULL;
+  table_size = 0;
+  free(timeout_heap);
+  timeout_heap = NULL;
+  timeout_heap_count = timeout_heap_size = 0;
 # ifdef HAVE_LIBOOH323C
   ooH323EpInitialize(OO_CALLMODE_AUDIOCALL, "/dev/null");
   ooH323EpDisableAutoAnswer();
@@ -356,10 +479,16 @@ sessions_init(const char *types)
 
 void				sessions_exit(void)
 {
+# ifdef HAVE_LIBOSIPPARSER2
   struct session		*elt;
   struct session		*elt_next;
+# endif /* HAVE_LIBOSIPPARSER2 */
   time_t			one_minute_later = 0;
 
+  if (sessions_native) {
+    flows_exit();
+    return;
+  }
   /*
    * Last pass to close timeout'd session... It is needed
    * because the last packet of a session marked for
@@ -377,17 +506,14 @@ void				sessions_exit(void)
    */
   if (NULL != nids_last_pcap_header)
     one_minute_later = nids_last_pcap_header->ts.tv_sec + 60;
+  sessions_expire(one_minute_later);
+# ifdef HAVE_LIBOSIPPARSER2
   for (elt = first_session; NULL != elt; elt = elt_next) {
     elt_next = elt->next;
-    if (elt->timeout && (one_minute_later >= elt->timeout)) {
-      sessions_del(elt);
-      continue;
-    }
-# ifdef HAVE_LIBOSIPPARSER2
     if ((elt->type & TYPE_SIP) && !elt->u.sip_params.picked_up)
       sessions_del(elt);
-# endif /* HAVE_LIBOSIPPARSER2 */
   }
+# endif /* HAVE_LIBOSIPPARSER2 */
 
   /*
    * Print a report about unclosed sessions.
@@ -410,21 +536,51 @@ void				sessions_exit(void)
       dumper_close(first_session->dumper);
       if (NULL != first_session->next) {
 	first_session = first_session->next;
-	free(first_session->prev);
+	slab_free(&session_slab, first_session->prev);
 	first_session->prev = NULL;
       } else {
-	free(first_session);
+	slab_free(&session_slab, first_session);
 	first_session = NULL;
       }
       --sessions_count;
     }
   }
+  dumpers_exit();
+  if (verbose)
+    printf("Session objects: %" PRIu64 " sessions (%" PRIu64 " at most at a time) in %u slabs\n",
+	session_slab.allocs, session_slab.max_in_use, session_slab.chunk_count);
+  sessions_stats.sessions = session_slab.allocs;
+  sessions_stats.peak = session_slab.max_in_use;
+  sessions_stats.buckets = table_size;
+  if (verbose && (sip_stats.payloads || h225_ras_stats.payloads || h225_cs_stats.payloads))
+    printf("Signalling payloads: %" PRIu64 " SIP (%" PRIu64 " parsed), %" PRIu64 " H.225 RAS (%" PRIu64 " parsed), %" PRIu64 " H.225 CS (%" PRIu64 " parsed)\n",
+	sip_stats.payloads, sip_stats.parsed,
+	h225_ras_stats.payloads, h225_ras_stats.parsed,
+	h225_cs_stats.payloads, h225_cs_stats.parsed);
+  memset(&sip_stats, 0, sizeof(sip_stats));
+  memset(&h225_ras_stats, 0, sizeof(h225_ras_stats));
+  memset(&h225_cs_stats, 0, sizeof(h225_cs_stats));
+  slab_destroy(&session_slab);
+  free(packet_copy);
+  packet_copy = NULL;
+  packet_copy_size = 0;
+  free(addr_table);
+  free(parent_table);
+  addr_table = parent_table = NULL;
+  wild_sessions = NULL;
+  table_size = 0;
+  free(timeout_heap);
+  timeout_heap = NULL;
+  timeout_heap_count = timeout_heap_size = 0;
   track_sessions = 0;
   nids_exit();
 }
 
-void				sessions_nids_init(pcap_t *p)
+void				sessions_pcap_init(pcap_t *p)
 {
+  dumpers_init(p);
+  if (sessions_native)
+    return;
   nids_params.pcap_desc = p;
   nids_params.tcp_workarounds = 1;
   if (!nids_init()) {
@@ -442,6 +598,37 @@ void				sessions_nids_init(pcap_t *p)
   DIAG_ON_PEDANTIC
 }
 
+void				sessions_packet(pcap_t *p, struct pcap_pkthdr *h, const u_char *data)
+{
+  if (sessions_native) {
+    flows_packet(p, h, data);
+    return;
+  }
+  /*
+   * Copy the packet buffer to deconstify it for libnids, into a buffer
+   * kept for the next packets.
+   */
+  if (h->caplen > packet_copy_size) {
+    free(packet_copy);
+    packet_copy_size = h->caplen;
+    if (packet_copy_size < (bpf_u_int32)pcap_snapshot(p))
+      packet_copy_size = pcap_snapshot(p);
+    if (NULL == (packet_copy = malloc(packet_copy_size)))
+      error("malloc() failed in %s()", __func__);
+  }
+  memcpy(packet_copy, data, h->caplen);
+  nids_pcap_handler((u_char *)p, h, packet_copy);
+}
+
+/*
+ * libnids is done with every packet it was given as soon as it returns.
+ */
+void				sessions_flush(void)
+{
+  if (sessions_native)
+    flows_flush();
+}
+
 static struct session *
 sessions_add(const uint8_t t, const struct tuple4 *addr, const struct session *parent)
 {
@@ -450,12 +637,12 @@ sessions_add(const uint8_t t, const struct tuple4 *addr, const struct session *p
 
   if (!(t & sessions_track_types))
     return NULL;
-  elt = (struct session *) calloc(1, sizeof(struct session));
+  elt = (struct session *) slab_alloc(&session_slab);
   elt->addr = *addr;
   elt->type = t;
   elt->id = ++counter;
   if (sessions_expiration_delay)
-    elt->timeout = nids_last_pcap_header->ts.tv_sec + sessions_expiration_delay;
+    sessions_set_timeout(elt, nids_last_pcap_header->ts.tv_sec + sessions_expiration_delay);
   if (t & TYPE_SIP)
     elt->callback = sip_callback;
   else
@@ -468,10 +655,12 @@ sessions_add(const uint8_t t, const struct tuple4 *addr, const struct session *p
 	elt->callback = NULL;
   if (NULL != parent) {
     elt->parent_id = parent->id;
-    elt->dumper = parent->dumper;
-    elt->dumper->references++;
+    elt->dumper = dumper_share(parent->dumper);
   } else
-    elt->dumper = sessions_file_format ? dumper_open(t, elt->id) : NULL;
+    elt->dumper = sessions_file_format ? dumper_open(type2string(t, 0), elt->id, 0) : NULL;
+  if (sessions_count >= table_size)
+    index_grow();
+  index_add(elt);
   elt->next = first_session;
   if (NULL != elt->next)
     elt->next->prev = elt;
@@ -506,6 +695,8 @@ static void			sessions_del(struct session *elt)
     elt->prev->next = elt->next;
   else
     first_session = elt->next;
+  index_del(elt);
+  sessions_set_timeout(elt, 0);
 
   /*
    * If this is a TCP connection, tell libnids we do not
@@ -532,92 +723,268 @@ static void			sessions_del(struct session *elt)
 # endif /* HAVE_LIBOSIPPARSER2 */
 
   dumper_close(elt->dumper);
-  free(elt);
+  slab_free(&session_slab, elt);
+}
+
+static uint32_t
+hash_endpoint(const u_int addr, const u_short port)
+{
+  uint32_t			h = addr ^ ((uint32_t)port << 16 | port);
+
+  h *= 0x9e3779b1U;
+  return h ^ (h >> 16);
+}
+
+/*
+ * Where a session goes in `addr_table', or NULL if it has no complete
+ * endpoint and goes in `wild_sessions' instead.
+ */
+static struct session **
+addr_bucket(const struct tuple4 *addr)
+{
+  uint32_t			h;
+
+  if (addr->saddr && addr->source && addr->daddr && addr->dest)
+    h = hash_endpoint(addr->saddr, addr->source) + hash_endpoint(addr->daddr, addr->dest);
+  else if (addr->daddr && addr->dest)
+    h = hash_endpoint(addr->daddr, addr->dest);
+  else if (addr->saddr && addr->source)
+    h = hash_endpoint(addr->saddr, addr->source);
+  else
+    return NULL;
+  return &addr_table[h & (table_size - 1)];
+}
+
+static void
+index_add(struct session *elt)
+{
+  struct session		**head;
+
+  if (NULL == (head = addr_bucket(&elt->addr)))
+    head = &wild_sessions;
+  elt->addr_next = *head;
+  if (NULL != elt->addr_next)
+    elt->addr_next->addr_prev = &elt->addr_next;
+  elt->addr_prev = head;
+  *head = elt;
+  if (elt->parent_id) {
+    head = &parent_table[elt->parent_id & (table_size - 1)];
+    elt->parent_next = *head;
+    if (NULL != elt->parent_next)
+      elt->parent_next->parent_prev = &elt->parent_next;
+    elt->parent_prev = head;
+    *head = elt;
+  }
+}
+
+static void
+index_del(struct session *elt)
+{
+  if (NULL != elt->addr_next)
+    elt->addr_next->addr_prev = elt->addr_prev;
+  *elt->addr_prev = elt->addr_next;
+  if (elt->parent_id) {
+    if (NULL != elt->parent_next)
+      elt->parent_next->parent_prev = elt->parent_prev;
+    *elt->parent_prev = elt->parent_next;
+  }
+}
+
+static void
+index_grow(void)
+{
+  struct session		*elt;
+
+  free(addr_table);
+  free(parent_table);
+  table_size = table_size ? table_size * 2 : 1024;
+  addr_table = (struct session **) calloc(table_size, sizeof(struct session *));
+  parent_table = (struct session **) calloc(table_size, sizeof(struct session *));
+  if (NULL == addr_table || NULL == parent_table)
+    error("calloc() failed in %s()", __func__);
+  wild_sessions = NULL;
+  for (elt = first_session; NULL != elt; elt = elt->next)
+    index_add(elt);
+}
+
+static int
+addr_match(const struct tuple4 *elt_addr, const struct tuple4 *addr)
+{
+  if ((!elt_addr->source || elt_addr->source == addr->source) &&
+      (!elt_addr->dest || elt_addr->dest == addr->dest) &&
+      (!elt_addr->saddr || elt_addr->saddr == addr->saddr) &&
+      (!elt_addr->daddr || elt_addr->daddr == addr->daddr))
+    return 1;
+  if ((!elt_addr->source || elt_addr->source == addr->dest) &&
+      (!elt_addr->dest || elt_addr->dest == addr->source) &&
+      (!elt_addr->saddr || elt_addr->saddr == addr->daddr) &&
+      (!elt_addr->daddr || elt_addr->daddr == addr->saddr))
+    return 1;
+  return 0;
+}
+
+/*
+ * The list of all sessions is in decreasing order of ID, since new
+ * sessions are inserted at its head, so the first match from `start'
+ * onwards in the list is the match with the highest ID up to start->id.
+ */
+static struct session *
+addr_chain_find(struct session *chain, struct session *found, const uint32_t max_id,
+		const uint8_t t, const struct tuple4 *addr)
+{
+  struct session		*elt;
+
+  for (elt = chain; NULL != elt; elt = elt->addr_next)
+    if ((elt->type & t) && elt->id <= max_id &&
+	(NULL == found || elt->id > found->id) &&
+	addr_match(&elt->addr, addr))
+      found = elt;
+  return found;
 }
 
 static struct session *
 sessions_find(struct session *start, const uint8_t t, const uint32_t parent_id, const struct tuple4 *addr)
 {
+  struct session		*found = NULL;
   struct session		*elt;
+  struct session		**head;
 
-  for (elt = start; NULL != elt; elt = elt->next) {
-    if (!(elt->type & t))
-      continue;
-    if (parent_id && (elt->parent_id != parent_id))
-      continue;
-    if (NULL != addr) {
-      if ((!elt->addr.source || elt->addr.source == addr->source) &&
-	  (!elt->addr.dest || elt->addr.dest == addr->dest) &&
-	  (!elt->addr.saddr || elt->addr.saddr == addr->saddr) &&
-	  (!elt->addr.daddr || elt->addr.daddr == addr->daddr))
-	return elt;
-      if ((!elt->addr.source || elt->addr.source == addr->dest) &&
-	  (!elt->addr.dest || elt->addr.dest == addr->source) &&
-	  (!elt->addr.saddr || elt->addr.saddr == addr->daddr) &&
-	  (!elt->addr.daddr || elt->addr.daddr == addr->saddr))
-	return elt;
-    }
-    if (parent_id)
-      return elt;
+  if (NULL == start)
+    return NULL;
+  if (parent_id) {
+    for (elt = parent_table[parent_id & (table_size - 1)]; NULL != elt; elt = elt->parent_next)
+      if (elt->parent_id == parent_id && (elt->type & t) && elt->id <= start->id &&
+	  (NULL == found || elt->id > found->id))
+	found = elt;
+    return found;
+  }
+  if (NULL == addr)
+    return NULL;
+
+  /*
+   * A session with a complete address can only be found in the bucket
+   * of that address; one with wildcards, in the bucket of one of the
+   * endpoints of the address searched for, or among `wild_sessions'.
+   */
+  found = addr_chain_find(wild_sessions, found, start->id, t, addr);
+  if (NULL != (head = addr_bucket(addr)))
+    found = addr_chain_find(*head, found, start->id, t, addr);
+  if (addr->saddr && addr->source) {
+    head = &addr_table[hash_endpoint(addr->saddr, addr->source) & (table_size - 1)];
+    found = addr_chain_find(*head, found, start->id, t, addr);
+  }
+  if (addr->daddr && addr->dest) {
+    head = &addr_table[hash_endpoint(addr->daddr, addr->dest) & (table_size - 1)];
+    found = addr_chain_find(*head, found, start->id, t, addr);
   }
-  return NULL;
+  return found;
 }
 
-static struct shared_dumper *
-dumper_open(const enum type t, const uint32_t id)
+static void
+heap_place(struct session *elt, uint32_t i)
 {
-  struct shared_dumper		*d;
-
-  d = malloc(sizeof (struct shared_dumper));
-  d->filename = malloc(strlen(sessions_file_format) + strlen(type2string(t, 0)) + 16);
-  sprintf(d->filename, sessions_file_format, type2string(t, 0), id);
-  d->filedesc = pcap_dump_open(nids_params.pcap_desc, d->filename);
-  if (NULL == d->filedesc)
-    dumper_too_many_open_files(&d);
-  ++dumper_fd_count;
-  d->references = 1;
-  return d;
+  timeout_heap[i - 1] = elt;
+  elt->heap_index = i;
 }
 
-static void			dumper_too_many_open_files(struct shared_dumper **d)
+/*
+ * Move the session at 1-based position `i' up or down the heap to
+ * where its timeout belongs.
+ */
+static void
+heap_fix(uint32_t i)
 {
-  struct session		*elt;
-  unsigned int			oldest_ten_percent;
-
-  oldest_ten_percent = sessions_count / 10;
-  if (EMFILE == errno && oldest_ten_percent) {
-    for (elt = first_session; NULL != elt; elt = elt->next) {
-      if (NULL != elt->dumper->filedesc) {
-	pcap_dump_close(elt->dumper->filedesc);
-	elt->dumper->filedesc = NULL;
-	--dumper_fd_count;
-	if (!--oldest_ten_percent)
-	  break;
-      }
-    }
-    (*d)->filedesc = pcap_dump_open(nids_params.pcap_desc, (*d)->filename);
+  struct session		*elt = timeout_heap[i - 1];
+  uint32_t			child;
+
+  while (i > 1 && timeout_heap[i / 2 - 1]->timeout > elt->timeout) {
+    heap_place(timeout_heap[i / 2 - 1], i);
+    i /= 2;
   }
-  if (NULL == (*d)->filedesc) {
-    error("%s(): %s: %s", __func__,
-	(*d)->filename,
-	pcap_geterr(nids_params.pcap_desc));
+  while ((child = 2 * i) <= timeout_heap_count) {
+    if (child < timeout_heap_count &&
+	timeout_heap[child]->timeout < timeout_heap[child - 1]->timeout)
+      ++child;
+    if (timeout_heap[child - 1]->timeout >= elt->timeout)
+      break;
+    heap_place(timeout_heap[child - 1], i);
+    i = child;
   }
+  heap_place(elt, i);
 }
 
-static void			dumper_close(struct shared_dumper *d)
+static void
+sessions_set_timeout(struct session *elt, const time_t timeout)
 {
-  if (NULL == d)
+  uint32_t			i = elt->heap_index;
+  struct session		**heap;
+
+  elt->timeout = timeout;
+  if (!timeout) {
+    if (!i)
+      return;
+    elt->heap_index = 0;
+    if (i != timeout_heap_count--) {
+      heap_place(timeout_heap[timeout_heap_count], i);
+      heap_fix(i);
+    }
     return;
-  --d->references;
-  if (!d->references) {
-    free(d->filename);
-    if (NULL != d->filedesc) {
-      pcap_dump_close(d->filedesc);
-      --dumper_fd_count;
+  }
+  if (!i) {
+    if (timeout_heap_count == timeout_heap_size) {
+      timeout_heap_size = timeout_heap_size ? timeout_heap_size * 2 : 1024;
+      heap = (struct session **) realloc(timeout_heap, timeout_heap_size * sizeof(struct session *));
+      if (NULL == heap)
+	error("realloc() failed in %s()", __func__);
+      timeout_heap = heap;
+    }
+    i = ++timeout_heap_count;
+    heap_place(elt, i);
+  }
+  heap_fix(i);
+}
+
+static int
+session_id_cmp(const void *a, const void *b)
+{
+  uint32_t			id_a = (*(struct session *const *)a)->id;
+  uint32_t			id_b = (*(struct session *const *)b)->id;
+
+  return id_a < id_b ? 1 : id_a > id_b ? -1 : 0;
+}
+
+static void
+sessions_expire(const time_t now)
+{
+  static struct session		**due = NULL;
+  static uint32_t		due_size = 0;
+  struct session		**p;
+  uint32_t			count = 0;
+  uint32_t			i;
+
+  while (timeout_heap_count && now >= timeout_heap[0]->timeout) {
+    if (count == due_size) {
+      due_size = due_size ? due_size * 2 : 64;
+      p = (struct session **) realloc(due, due_size * sizeof(struct session *));
+      if (NULL == p)
+	error("realloc() failed in %s()", __func__);
+      due = p;
     }
+    due[count++] = timeout_heap[0];
+    sessions_set_timeout(timeout_heap[0], 0);
   }
+  if (!count)
+    return;
+  /*
+   * Delete them in the order of the list of all sessions, as it used
+   * to be walked to find them.
+   */
+  qsort(due, count, sizeof(struct session *), session_id_cmp);
+  for (i = 0; i < count; ++i)
+    sessions_del(due[i]);
 }
 
+
 static const char *
 type2string(const enum type t, const int upper)
 {
@@ -635,28 +1002,43 @@ type2string(const enum type t, const int upper)
 static void
 dump_frame(const u_char *data, const int len, struct shared_dumper *output)
 {
-  u_char			*frame;
+  static u_char			*frame = NULL;
+  static size_t			frame_size = 0;
+  const u_char			*p;
   struct pcap_pkthdr		ph;
 
   if (!bonus_time && NULL == output)
     return;
-  frame = malloc(len + nids_linkoffset);
-  memcpy(frame, nids_last_pcap_data, nids_linkoffset);
-  memcpy(frame + nids_linkoffset, data, len);
   ph.ts = nids_last_pcap_header->ts;
   ph.caplen = ph.len = len + nids_linkoffset;
-  if (NULL != output) {
-    if (NULL == output->filedesc) {
-      output->filedesc = pcap_dump_open(nids_params.pcap_desc, output->filename);
-      if (NULL == output->filedesc)
-	dumper_too_many_open_files(&output);
-      ++dumper_fd_count;
+  if (NULL != output && (sessions_buffer_size || lookback_time)) {
+    dumper_buffer(output, &ph, nids_last_pcap_data, nids_linkoffset, data);
+    if (!bonus_time)
+      return;
+  }
+
+  /*
+   * Unless libnids had to reassemble the IP packet, it is still right
+   * after its link-layer header; otherwise put the two back together in
+   * a buffer kept from one frame to the next.
+   */
+  if (data == nids_last_pcap_data + nids_linkoffset)
+    p = nids_last_pcap_data;
+  else {
+    if (ph.caplen > frame_size) {
+      free(frame);
+      frame_size = ph.caplen;
+      if (NULL == (frame = malloc(frame_size)))
+	error("malloc() failed in %s()", __func__);
     }
-    pcap_dump((u_char *)output->filedesc, &ph, frame);
+    memcpy(frame, nids_last_pcap_data, nids_linkoffset);
+    memcpy(frame + nids_linkoffset, data, len);
+    p = frame;
   }
+  if (NULL != output && !sessions_buffer_size && !lookback_time)
+    pcap_dump((u_char *)dumper_get(output), &ph, p);
   if (bonus_time)
-    pcap_dump((u_char *)global_dumper, &ph, frame);
-  free(frame);
+    output_dump(global_output, &ph, p);
 }
 
 /*
@@ -675,17 +1057,12 @@ static void			ip_callback(struct ip *ip, int len)
   struct tuple4			addr;
   struct tcphdr			*tcp;
   struct session		*elt;
-  struct session		*elt_next;
   unsigned int			ip_data_offset = IPHDRLEN;
 
   if (len < 0)
     error("%s(): len < 0", __func__);
 
-  for (elt = first_session; NULL != elt; elt = elt_next) {
-    elt_next = elt->next;
-    if (elt->timeout && (nids_last_pcap_header->ts.tv_sec >= elt->timeout))
-      sessions_del(elt);
-  }
+  sessions_expire(nids_last_pcap_header->ts.tv_sec);
   if ((ip->ip_hl > 5) && ((ip->ip_hl * 4) <= len))
     ip_data_offset = ip->ip_hl * 4;
   if ((ip->ip_p != 6) || ((unsigned)len < (ip_data_offset + TCPHDRLEN)))
@@ -698,7 +1075,7 @@ static void			ip_callback(struct ip *ip, int len)
   if (NULL != (elt = sessions_find(first_session, TYPE_TCP, 0, &addr))) {
     dump_frame((u_char *)ip, len, elt->dumper);
     if (sessions_expiration_delay)
-      elt->timeout = nids_last_pcap_header->ts.tv_sec + sessions_expiration_delay;
+      sessions_set_timeout(elt, nids_last_pcap_header->ts.tv_sec + sessions_expiration_delay);
     elt->lastseen = nids_last_pcap_header->ts;
     return;
   }
@@ -711,7 +1088,7 @@ static void			ip_callback(struct ip *ip, int len)
   if (NULL == elt)
     return;
   dump_frame((u_char *)ip, len, elt->dumper);
-  elt->timeout = nids_last_pcap_header->ts.tv_sec + 60;
+  sessions_set_timeout(elt, nids_last_pcap_header->ts.tv_sec + 60);
   /* 60 seconds to complete TCP handshake */
 }
 
@@ -734,7 +1111,7 @@ static void			udp_callback(struct tuple4 *addr, u_char *udp_data, int udp_data_l
   elt->bytes += udp_data_len;
   elt->lastseen = nids_last_pcap_header->ts;
   if (NULL != elt->callback)
-    elt = elt->callback(elt, udp_data, udp_data_len);
+    elt = signalling_callback(elt, udp_data, udp_data_len);
 
   /*
    * We can dump the frame only after the data is processed because
@@ -750,7 +1127,6 @@ static void			tcp_callback(struct tcp_stream *tcp, void **user)
 {
   struct session		*elt;
   struct session		*rtp;
-  struct session		*start;
 
   switch (tcp->nids_state) {
     case NIDS_JUST_EST:
@@ -760,12 +1136,14 @@ static void			tcp_callback(struct tcp_stream *tcp, void **user)
       if (NULL == elt)
 	return;
       if (elt->type & TYPE_H225_CS) {
+	index_del(elt);
 	elt->addr.saddr = tcp->addr.saddr;
 	elt->addr.source = tcp->addr.source;
+	index_add(elt);
       }
       *user = elt;
       if (!sessions_expiration_delay)
-	elt->timeout = 0;
+	sessions_set_timeout(elt, 0);
       tcp->client.collect++;
       tcp->server.collect++;
       return;
@@ -774,9 +1152,9 @@ static void			tcp_callback(struct tcp_stream *tcp, void **user)
       elt->bytes += tcp->client.count_new + tcp->server.count_new;
       if (NULL != elt->callback) {
 	if (tcp->client.count_new)
-	  elt->callback(elt, (u_char *)tcp->client.data, tcp->client.count_new);
+	  signalling_callback(elt, (u_char *)tcp->client.data, tcp->client.count_new);
 	if (tcp->server.count_new)
-	  elt->callback(elt, (u_char *)tcp->server.data, tcp->server.count_new);
+	  signalling_callback(elt, (u_char *)tcp->server.data, tcp->server.count_new);
       }
       return;
     case NIDS_CLOSE:
@@ -784,12 +1162,89 @@ static void			tcp_callback(struct tcp_stream *tcp, void **user)
     case NIDS_TIMED_OUT:
       elt = (struct session *)*user;
       if (elt->type & TYPE_H225_CS)
-	for (start = first_session; NULL != (rtp = sessions_find(start, TYPE_RTP | TYPE_RTCP, elt->id, NULL)); start = rtp->next)
+	while (NULL != (rtp = sessions_find(first_session, TYPE_RTP | TYPE_RTCP, elt->id, NULL)))
 	  sessions_del(rtp);
       sessions_del((struct session *)*user);
   }
 }
 
+static struct session		*signalling_callback(struct session *elt, u_char *data, uint32_t len)
+{
+  struct signalling_stats	*stats;
+  int				(*signature)(const u_char *data, const uint32_t len);
+
+  if (elt->type & TYPE_SIP) {
+    stats = &sip_stats;
+    signature = sip_signature;
+  } else
+    if (elt->type & TYPE_H225_RAS) {
+      stats = &h225_ras_stats;
+      signature = h225_ras_signature;
+    } else {
+      stats = &h225_cs_stats;
+      signature = h225_cs_signature;
+    }
+  ++stats->payloads;
+  if (!signature(data, len))
+    return elt;
+  ++stats->parsed;
+  return elt->callback(elt, data, len);
+}
+
+/*
+ * A SIP message starts with a status line ("SIP/2.0 200 OK") or with a
+ * request line made of an upper case method, the Request-URI and the
+ * version ("INVITE sip:bob@example.com SIP/2.0"), which ends the line.
+ */
+static int			sip_signature(const u_char *data, const uint32_t len)
+{
+  uint32_t			method_len;
+  uint32_t			i;
+
+  if (len >= 8 && !memcmp(data, "SIP/2.0 ", 8))
+    return 1;
+  for (method_len = 0; method_len < len && data[method_len] >= 'A' && data[method_len] <= 'Z'; ++method_len)
+    ;
+  if (!method_len || method_len >= len || ' ' != data[method_len])
+    return 0;
+  for (i = method_len; i < len && '\r' != data[i] && '\n' != data[i]; ++i)
+    ;
+  return i < len && i >= method_len + 3 + 7 && !memcmp(data + i - 7, "SIP/2.0", 7);
+}
+
+/*
+ * A RAS message is a PER-encoded RasMessage CHOICE: its first bit tells
+ * whether the alternative is an extension, and the next 5 bits are the
+ * index of the alternative, of which there are 25 in the root, or else
+ * start the normally small number of the extension, whose first bit is 0.
+ */
+static int			h225_ras_signature(const u_char *data, const uint32_t len)
+{
+  if (len < 2)
+    return 0;
+  if (data[0] & 0x80)
+    return !(data[0] & 0x40);
+  return (data[0] >> 2) < 25;
+}
+
+/*
+ * Call Signaling messages come in a TPKT (version 3, reserved 0 and the
+ * length of the whole packet) with a Q.931 header: protocol discriminator
+ * 0x08, length and value of the call reference and the message type.
+ * A message that does not fit in the data is not decoded either.
+ */
+static int			h225_cs_signature(const u_char *data, const uint32_t len)
+{
+  uint32_t			tpkt_len;
+
+  if (len < 7 || 3 != data[0] || 0 != data[1])
+    return 0;
+  tpkt_len = (uint32_t)data[2] << 8 | data[3];
+  if (tpkt_len > len || 0x08 != data[4] || (data[5] & 0xf0))
+    return 0;
+  return tpkt_len >= 4 + 2 + (data[5] & 0x0fU) + 1U;
+}
+
 # ifndef HAVE_LIBOSIPPARSER2
 static struct session			*sip_callback(struct session *sip, u_char *data _U_, uint32_t len _U_)
 {
@@ -915,17 +1370,14 @@ static struct session			*sip_callback(struct session *sip, u_char *data, uint32_
 	} else
 	  if (MSG_IS_RESPONSE_FOR(msg, "BYE") ||
 	      MSG_IS_RESPONSE_FOR(msg, "CANCEL")) {
-	    start = first_session;
-	    while (NULL != (rtp = sessions_find(start, TYPE_RTP, sip->id, NULL))) {
+	    while (NULL != (rtp = sessions_find(first_session, TYPE_RTP, sip->id, NULL)))
 	      sessions_del(rtp);
-	      start = rtp->next;
-	    }
 	    /*
 	     * Mark for deletion in 2 seconds, in order to give some
 	     * time to the extra ACK packets that might be exchanged
 	     */
 	    if (sip->type & TYPE_UDP)
-	      sip->timeout = nids_last_pcap_header->ts.tv_sec + 2;
+	      sessions_set_timeout(sip, nids_last_pcap_header->ts.tv_sec + 2);
 	  }
       }
   }
@@ -966,7 +1418,7 @@ static struct session			*h225_ras_callback(struct session *ras, u_char *data, ui
 	  ras = sessions_add(TYPE_UDP | TYPE_H225_RAS, &ras->addr, NULL);
 	memcpy(ras->u.ras_params.call_id, pRasMsg->u.admissionRequest->conferenceID.data, 16);
 	ras->u.ras_params.seqnum = pRasMsg->u.admissionRequest->requestSeqNum;
-	ras->timeout = nids_last_pcap_header->ts.tv_sec + 60;
+	sessions_set_timeout(ras, nids_last_pcap_header->ts.tv_sec + 60);
 	/* 60 seconds for the gatekeeper to confirm admission */
 	break;
       case T_H225RasMessage_admissionConfirm:
@@ -985,7 +1437,7 @@ static struct session			*h225_ras_callback(struct session *ras, u_char *data, ui
 	ras->u.ras_params.cs_addr.dest = pRasMsg->u.admissionConfirm->destCallSignalAddress.u.ipAddress->port;
 	ras->u.ras_params.cs_addr.daddr = *((u_int *)pRasMsg->u.admissionConfirm->destCallSignalAddress.u.ipAddress->ip.data);
 	if (NULL != (cs = sessions_add(TYPE_TCP | TYPE_H225_CS, &ras->u.ras_params.cs_addr, ras)))
-	  cs->timeout = nids_last_pcap_header->ts.tv_sec + 60;
+	  sessions_set_timeout(cs, nids_last_pcap_header->ts.tv_sec + 60);
 	/* 60 seconds to establish the Call Signaling stream */
 	break;
       case T_H225RasMessage_admissionReject:
@@ -995,7 +1447,7 @@ static struct session			*h225_ras_callback(struct session *ras, u_char *data, ui
 	  ras = rasbkp;
 	  break;
 	}
-	ras->timeout = nids_last_pcap_header->ts.tv_sec; /* delete after dumping frame */
+	sessions_set_timeout(ras, nids_last_pcap_header->ts.tv_sec); /* delete after dumping frame */
 	break;
       case T_H225RasMessage_disengageRequest:
 	while ((NULL != ras) && memcmp(ras->u.ras_params.call_id, pRasMsg->u.disengageRequest->conferenceID.data, 16))
@@ -1013,7 +1465,7 @@ static struct session			*h225_ras_callback(struct session *ras, u_char *data, ui
 	  ras = rasbkp;
 	  break;
 	}
-	ras->timeout = nids_last_pcap_header->ts.tv_sec; /* delete after dumping frame */
+	sessions_set_timeout(ras, nids_last_pcap_header->ts.tv_sec); /* delete after dumping frame */
     }
   memFreePtr(&ctxt, pRasMsg);
   freeContext(&ctxt);
@@ -44,13 +44,60 @@
 
 extern int			verbose;
 extern int			bonus_time;
+extern int			lookback_time;
 extern int			track_sessions;
 extern uint32_t			sessions_count;
 extern char			*sessions_file_format;
 extern time_t			sessions_expiration_delay;
+extern unsigned int		sessions_max_open_files;
+extern size_t			sessions_buffer_size;
+extern int			sessions_native;
+extern unsigned int		sessions_threads;
+
+/*
+ * What sessions_exit() leaves behind for the -S report.
+ */
+struct sessions_stats
+{
+  uint64_t			sessions;	/* tracked in all */
+  uint64_t			peak;		/* tracked at a time, at most */
+  uint64_t			buckets;	/* of the lookup tables */
+};
+extern struct sessions_stats	sessions_stats;
 
 void				sessions_init(const char *types);
 void				sessions_exit(void);
-void				sessions_nids_init(pcap_t *p);
+void				sessions_pcap_init(pcap_t *p);
+void				sessions_packet(pcap_t *p, struct pcap_pkthdr *h, const u_char *data);
+void				sessions_flush(void);
+void				sessions_lookback_end(void);
+
+/*
+ * The built-in tracker of TCP and UDP sessions (flows.c), which the
+ * functions above hand over to when libnids is not used.
+ */
+void				flows_init(const char *types);
+void				flows_exit(void);
+void				flows_packet(pcap_t *p, const struct pcap_pkthdr *h, const u_char *data);
+void				flows_flush(void);
+u_int				flows_shard(const int dlt, const struct pcap_pkthdr *h,
+					    const u_char *data, const u_int n);
+
+/*
+ * The PCAP files sessions are extracted to (dumpers.c), in sets that each
+ * belong to one thread.
+ */
+struct shared_dumper;
+
+void				dumpers_init(pcap_t *p);
+void				dumpers_split(const unsigned int n);
+void				dumpers_lookback_end(void);
+void				dumpers_exit(void);
+struct shared_dumper		*dumper_open(const char *type, const uint32_t id, const unsigned int set);
+struct shared_dumper		*dumper_share(struct shared_dumper *d);
+void				dumper_close(struct shared_dumper *d);
+pcap_dumper_t			*dumper_get(struct shared_dumper *d);
+void				dumper_buffer(struct shared_dumper *d, const struct pcap_pkthdr *ph,
+				      const u_char *head, const u_int head_len, const u_char *data);
 
 #endif /* TCPSLICE_SESSIONS_H */
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2026
+ *	The Tcpdump Group and contributors.  All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * stats.c - the report of the -S option
+ *
+ * The work of each phase is timed where it is done: opening the files and
+ * finding their end, finding the start of the window in them and reading
+ * up to it in libtcpslice.c and search.c, the merge and the removal of
+ * duplicates in libtcpslice.c and the writing of the output and the
+ * tracking of sessions in tcpslice.c.  Phases nest: the time of find_end
+ * is part of that of open, read_up_to of find_packet and dedup of merge.
+ * This file only adds them up over the files and prints them, as text or
+ * as JSON.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#ifdef HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_OS_PROTO_H
+#include "os-proto.h"
+#endif
+
+#include "tcpslice.h"
+#include "sessions.h"
+
+enum {
+	PHASE_OPEN,
+	PHASE_FIND_END,
+	PHASE_FIND_PACKET,
+	PHASE_READ_UP_TO,
+	PHASE_MERGE,
+	PHASE_DEDUP,
+	PHASE_DUMP,
+	PHASE_SESSIONS,
+	PHASE_TOTAL,
+	PHASES
+};
+
+static const char *phase_names[PHASES] = {
+	"open",
+	"find_end",
+	"find_packet",
+	"read_up_to",
+	"merge",
+	"dedup",
+	"dump",
+	"sessions",
+	"total"
+};
+
+static void
+time_add(struct tcpslice_time *sum, const struct tcpslice_time *t)
+{
+	sum->wall += t->wall;
+	sum->cpu += t->cpu;
+	sum->count += t->count;
+}
+
+/* The most memory the process ever used, in KiB, or 0 if unknown. */
+static uint64_t
+peak_rss(void)
+{
+#ifdef HAVE_GETRUSAGE
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+#ifdef __APPLE__
+	return (uint64_t) ru.ru_maxrss / 1024;	/* in bytes there */
+#else
+	return (uint64_t) ru.ru_maxrss;
+#endif
+#else
+	return 0;
+#endif
+}
+
+void
+json_string(FILE *f, const char *str)
+{
+	const unsigned char *c;
+
+	fputc('"', f);
+	for (c = (const unsigned char *) str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(f, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(f, "\\u%04x", *c);
+		else
+			fputc(*c, f);
+	}
+	fputc('"', f);
+}
+
+static void
+json_time(FILE *f, const char *name, const struct tcpslice_time *t)
+{
+	fprintf(f, "\"%s\": {\"wall\": %.6f, \"cpu\": %.6f, \"count\": %" PRIu64 "}",
+		name, t->wall, t->cpu, t->count);
+}
+
+void
+stats_report(FILE *f, const enum stats_format format, const tcpslice_t *t,
+	     const struct slice_stats *s)
+{
+	struct tcpslice_time phases[PHASES];
+	struct tcpslice_file_stats fst, total;
+	struct tcpslice_stats st;
+	int i, numfiles = tcpslice_numfiles(t);
+
+	memset(phases, 0, sizeof(phases));
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < numfiles; i++) {
+		tcpslice_get_file_stats(t, i, &fst);
+		time_add(&phases[PHASE_OPEN], &fst.open);
+		time_add(&phases[PHASE_FIND_END], &fst.find_end);
+		time_add(&phases[PHASE_FIND_PACKET], &fst.find_packet);
+		time_add(&phases[PHASE_READ_UP_TO], &fst.read_up_to);
+		total.bytes_read += fst.bytes_read;
+		total.packets_read += fst.packets_read;
+		total.dropped += fst.dropped;
+	}
+	tcpslice_get_stats(t, &st);
+	phases[PHASE_MERGE] = st.merge;
+	phases[PHASE_DEDUP] = st.dedup;
+	phases[PHASE_DUMP] = s->dump;
+	phases[PHASE_SESSIONS] = s->sessions;
+	phases[PHASE_TOTAL] = s->total;
+
+	if (format == STATS_TEXT) {
+		fprintf(f, "%-12s %12s %12s %12s\n",
+			"phase", "wall (s)", "cpu (s)", "count");
+		for (i = 0; i < PHASES; i++)
+			fprintf(f, "%-12s %12.6f %12.6f %12" PRIu64 "\n",
+				phase_names[i], phases[i].wall, phases[i].cpu,
+				phases[i].count);
+		for (i = 0; i < numfiles; i++) {
+			tcpslice_get_file_stats(t, i, &fst);
+			fprintf(f, "file %s: %" PRIu64 " bytes read, %" PRIu64
+				" packets read, %" PRIu64 " dropped, %" PRIu64
+				" seeks, %" PRIu64 " probes, %" PRIu64
+				" header offsets examined\n",
+				tcpslice_filename(t, i), fst.bytes_read,
+				fst.packets_read, fst.dropped, fst.seeks,
+				fst.probes, fst.headers);
+		}
+		fprintf(f, "packets: %" PRIu64 " read, %" PRIu64 " written, %"
+			PRIu64 " duplicates, %" PRIu64 " reordered, %" PRIu64
+			" dropped, %" PRIu64 " filtered out\n",
+			total.packets_read, s->packets_written, st.duplicates,
+			st.reordered, total.dropped, st.filtered);
+		fprintf(f, "bytes: %" PRIu64 " read, %" PRIu64 " written\n",
+			total.bytes_read, s->bytes_written);
+		fprintf(f, "sessions: %" PRIu64 " tracked, %" PRIu64
+			" at most at a time, %" PRIu64 " buckets\n",
+			sessions_stats.sessions, sessions_stats.peak,
+			sessions_stats.buckets);
+		fprintf(f, "peak RSS: %" PRIu64 " KiB\n", peak_rss());
+		return;
+	}
+
+	fprintf(f, "{\n\"phases\": {");
+	for (i = 0; i < PHASES; i++) {
+		if (i)
+			fputs(", ", f);
+		json_time(f, phase_names[i], &phases[i]);
+	}
+	fprintf(f, "},\n\"files\": [");
+	for (i = 0; i < numfiles; i++) {
+		tcpslice_get_file_stats(t, i, &fst);
+		fprintf(f, "%s{\"name\": ", i ? ",\n  " : "\n  ");
+		json_string(f, tcpslice_filename(t, i));
+		fprintf(f, ", ");
+		json_time(f, "open", &fst.open);
+		fprintf(f, ", ");
+		json_time(f, "find_end", &fst.find_end);
+		fprintf(f, ", ");
+		json_time(f, "find_packet", &fst.find_packet);
+		fprintf(f, ", ");
+		json_time(f, "read_up_to", &fst.read_up_to);
+		fprintf(f, ", \"bytes_read\": %" PRIu64 ", \"packets_read\": %"
+			PRIu64 ", \"dropped\": %" PRIu64 ", \"seeks\": %" PRIu64
+			", \"probes\": %" PRIu64 ", \"headers\": %" PRIu64 "}",
+			fst.bytes_read, fst.packets_read, fst.dropped,
+			fst.seeks, fst.probes, fst.headers);
+	}
+	fprintf(f, "],\n\"packets\": {\"read\": %" PRIu64 ", \"written\": %"
+		PRIu64 ", \"duplicates\": %" PRIu64 ", \"reordered\": %" PRIu64
+		", \"dropped\": %" PRIu64 ", \"filtered\": %" PRIu64 "},\n",
+		total.packets_read, s->packets_written, st.duplicates,
+		st.reordered, total.dropped, st.filtered);
+	fprintf(f, "\"bytes\": {\"read\": %" PRIu64 ", \"written\": %" PRIu64
+		"},\n", total.bytes_read, s->bytes_written);
+	fprintf(f, "\"sessions\": {\"tracked\": %" PRIu64 ", \"peak\": %"
+		PRIu64 ", \"buckets\": %" PRIu64 "},\n",
+		sessions_stats.sessions, sessions_stats.peak,
+		sessions_stats.buckets);
+	fprintf(f, "\"peak_rss_kib\": %" PRIu64 "\n}\n", peak_rss());
+}
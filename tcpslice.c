@@ -50,6 +50,7 @@
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <memory.h>
 #include <pcap.h>
 #include <stdio.h>
@@ -70,49 +71,14 @@
 # endif /* HAVE_LIBOOH323C */
 #endif /* HAVE_LIBNIDS */
 
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+#include <zlib.h>
+#endif
+
 #include "tcpslice.h"
+#include "libtcpslice.h"
 #include "sessions.h"
 
-/* For Solaris before 11. */
-/* compute a + b, store in c */
-#ifndef timeradd
-#define timeradd(a, b, c) { \
-	(c)->tv_sec = (a)->tv_sec + (b)->tv_sec; \
-	(c)->tv_usec = (a)->tv_usec + (b)->tv_usec; \
-	if ((c)->tv_usec > 1000000) { \
-		(c)->tv_usec -= 1000000; \
-		(c)->tv_sec += 1; \
-	} \
-}
-#endif /* timeradd */
-/* compute a - b, store in c */
-#ifndef timersub
-#define timersub(a, b, c) { \
-	(c)->tv_sec = (a)->tv_sec - (b)->tv_sec; \
-	if ((a)->tv_usec < (b)->tv_usec) { \
-		(c)->tv_sec -= 1;		/* need to borrow */ \
-		(c)->tv_usec = ((a)->tv_usec + 1000000) - (b)->tv_usec; \
-	} else { \
-		(c)->tv_usec = (a)->tv_usec - (b)->tv_usec; \
-	} \
-}
-#endif /* timersub */
-
-/* The structure used to keep track of files being merged. */
-struct state {
-	int64_t	start_pos,	/* seek position corresponding to start time */
-		stop_pos;	/* seek position corresponding to stop time */
-	struct timeval
-		file_start_time,	/* time of first pkt in file */
-		file_stop_time,		/* time of last pkt in file */
-		last_pkt_time;		/* time of most recently read pkt */
-	pcap_t	*p;
-	struct pcap_pkthdr hdr;
-	const u_char *pkt;
-	char	*filename;
-	int	done;
-};
-
 /* Style in which to print timestamps; RAW is "secs.usecs"; READABLE is
  * ala the Unix "date" tool; and PARSEABLE is tcpslice's custom format,
  * designed to be easy to parse.  The default is RAW.
@@ -120,6 +86,32 @@ struct state {
 enum stamp_styles { TIMESTAMP_RAW, TIMESTAMP_READABLE, TIMESTAMP_PARSEABLE };
 static enum stamp_styles timestamp_style = TIMESTAMP_RAW;
 
+/* How far to read past the end of the window for the tracked sessions to
+ * complete, in seconds and in bytes of packets (0 = to the end).
+ */
+static time_t lookahead_time = 0;
+static size_t lookahead_size = 0;
+
+/* How far to look back before the window for the tracked sessions that
+ * are already open when it starts, in seconds.
+ */
+static time_t lookback = 0;
+
+/* What to report with -S, see stats.c. */
+static enum stats_format stats_format = STATS_NONE;
+static struct slice_stats slice_stats;
+
+/* What to count with -H instead of slicing, see histogram.c. */
+static enum stats_format histogram_format = STATS_NONE;
+static time_t histogram_interval = 1;
+
+/* When to move on to another output file, and how many shards to split
+ * the output into, see output.c.
+ */
+static uint64_t output_max_size = 0;
+static time_t output_interval = 0;
+static unsigned int output_shards = 0;
+
 /* Let's for now define that as far as tcpslice command-line argument parsing
  * of raw timestamps goes, valid Unix time is the non-negative range of a
  * 32-bit signed integer.  This way it is possible to validate input without
@@ -130,6 +122,9 @@ static enum stamp_styles timestamp_style = TIMESTAMP_RAW;
 #define TS_RAW_US_MAX_DIGITS    6 /* 000000~999999 */
 #define TS_PARSEABLE_MAX_TOKENS 7 /* ymdhmsu */
 
+#define MAX_SHARDS	1024	/* of -P, each a thread and an open file */
+#define MAX_THREADS	1024	/* of -j */
+
 struct parseable_token_t {
 	unsigned amount;
 	/* Bigger units must have bigger integer values for validation. */
@@ -148,47 +143,89 @@ struct parseable_token_t {
 static unsigned char timestamp_input_format_correct(const char *str);
 static struct timeval parse_time(const char *time_string, struct timeval base_time);
 static void fill_tm(const char *time_string, const int is_delta, struct tm *t, time_t *usecs_addr);
-static struct timeval lowest_start_time(const struct state *states, int numfiles);
-static struct timeval latest_end_time(const struct state *states, int numfiles);
-static struct state *open_files(char *filenames[], const int numfiles);
-static u_char validate_files(struct state[], const int);
-static void close_files(struct state[], const int);
-static void extract_slice(struct state *states, const int numfiles,
-			const char *write_file_name,
+static size_t parse_size(const char *str);
+static enum stats_format parse_format(const char *str);
+static time_t parse_interval(const char *str, const int zero_ok);
+static unsigned int parse_count(const char *str, const unsigned int min,
+				const unsigned int max, const char *what);
+static u_char validate_files(const tcpslice_t *);
+static void extract_slice(tcpslice_t *t, const char *write_file_name,
 			const struct timeval *start_time, struct timeval *stop_time,
 			const int keep_dups, const int relative_time_merge,
-			const struct timeval *base_time);
-static void dump_times(const struct state *states, int numfiles);
+			const int compress, const int nthreads);
+static void dump_times(const tcpslice_t *t);
 static void print_usage(FILE *);
+static int run(int argc, char **argv);
 
 
-pcap_dumper_t *global_dumper = 0;
+struct output *global_output = NULL;
 
 extern  char *optarg;
 extern  int optind, opterr;
 
-extern int snaplen;	/* needed by search.c, extract_slice() */
-int snaplen = 0;
-
 int
 main(int argc, char **argv)
+{
+	return run(argc, argv);
+}
+
+/* The whole program, except that when serving requests over a socket, each
+ * request is a run of its own in a child process of the server.
+ */
+static int
+run(int argc, char **argv)
 {
 	int op;
 	int dump_flag = 0;
 	int keep_dups = 0;
 	int report_times = 0;
+	int report_json = 0;
+	int report_ordered = 1;	/* unless -O */
 	int relative_time_merge = 0;
+	int compress = 0;
+	int nthreads = -1;		/* one per CPU */
 	int numfiles;
 	char *start_time_string = NULL;
 	char *stop_time_string = NULL;
+	const char *session_types = NULL;
 	const char *write_file_name = "-";	/* default is stdout */
+	const char *server_socket_name = NULL;
+	const char *client_socket_name = NULL;
+	const char *cache_file_name = NULL;
+	const char *filter = NULL;
 	struct timeval first_time, start_time, stop_time;
-	struct state *states;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	tcpslice_t *t;
+	struct stats_clock run_clock;
+	int i, failed;
 
+	stats_clock_start(&run_clock);
 	opterr = 0;
-	while ((op = getopt(argc, argv, "dDe:f:hlRrs:tvw:")) != EOF)
+	while ((op = getopt(argc, argv, "A:a:b:C:c:dDe:F:f:G:H:hi:Jj:lM:m:nOP:RrS:s:tU:u:vw:z")) != EOF)
 		switch (op) {
 
+		case 'A':
+			lookahead_size = parse_size(optarg);
+			break;
+
+		case 'a':
+			lookahead_time = parse_interval(optarg, 1);
+			break;
+
+		case 'b':
+			lookback = parse_interval(optarg, 1);
+			break;
+
+		case 'C':
+			output_max_size = parse_size(optarg);
+			if (output_max_size == 0)
+				error("invalid size '%s'", optarg);
+			break;
+
+		case 'c':
+			cache_file_name = optarg;
+			break;
+
 		case 'd':
 			dump_flag = 1;
 			break;
@@ -198,22 +235,70 @@ main(int argc, char **argv)
 			break;
 
 		case 'e':
-			sessions_expiration_delay = atoi(optarg);
+			sessions_expiration_delay = parse_interval(optarg, 1);
+			break;
+
+		case 'F':
+			filter = optarg;
 			break;
 
 		case 'f':
 			sessions_file_format = optarg;
 			break;
 
+		case 'G':
+			output_interval = parse_interval(optarg, 0);
+			break;
+
+		case 'H':
+			histogram_format = parse_format(optarg);
+			break;
+
 		case 'h':
 			print_usage(stdout);
 			exit(0);
 			/* NOTREACHED */
 
+		case 'i':
+			histogram_interval = parse_interval(optarg, 0);
+			break;
+
+		case 'J':
+			++report_times;
+			report_json = 1;
+			break;
+
+		case 'j':
+			nthreads = (int) parse_count(optarg, 0, MAX_THREADS,
+						     "number of threads");
+			break;
+
 		case 'l':
 			relative_time_merge = 1;
 			break;
 
+		case 'M':
+			sessions_buffer_size = parse_size(optarg);
+			break;
+
+		case 'm':
+			sessions_max_open_files = parse_count(optarg, 0, INT32_MAX,
+							      "number of files");
+			break;
+
+		case 'n':
+			sessions_native = 1;
+			break;
+
+		case 'O':
+			report_ordered = 0;
+			break;
+
+		case 'P':
+			output_shards = parse_count(optarg, 1, MAX_SHARDS,
+						    "number of shards");
+			break;
+
 		case 'R':
 			++report_times;
 			timestamp_style = TIMESTAMP_RAW;
@@ -224,9 +309,13 @@ main(int argc, char **argv)
 			timestamp_style = TIMESTAMP_READABLE;
 			break;
 
+		case 'S':
+			stats_format = parse_format(optarg);
+			break;
+
 		case 's':
 			timestamp_style = TIMESTAMP_PARSEABLE;
-			sessions_init(optarg);
+			session_types = optarg;
 			break;
 
 		case 't':
@@ -234,6 +323,14 @@ main(int argc, char **argv)
 			timestamp_style = TIMESTAMP_PARSEABLE;
 			break;
 
+		case 'U':
+			client_socket_name = optarg;
+			break;
+
+		case 'u':
+			server_socket_name = optarg;
+			break;
+
 		case 'v':
 			++verbose;
 			break;
@@ -242,6 +339,10 @@ main(int argc, char **argv)
 			write_file_name = optarg;
 			break;
 
+		case 'z':
+			compress = 1;
+			break;
+
 		default:
 			(void)fprintf(stderr, "Error: invalid command-line option and/or argument!\n");
 			print_usage(stderr);
@@ -250,7 +351,30 @@ main(int argc, char **argv)
 		}
 
 	if ( report_times > 1 )
-		error( "only one of -R, -r, or -t can be specified" );
+		error( "only one of -J, -R, -r, or -t can be specified" );
+
+	if (report_json && (dump_flag || stats_format != STATS_NONE))
+		error("-J cannot be used with -d or -S");
+
+	if (histogram_format != STATS_NONE && session_types)
+		error("-H cannot track sessions");
+
+	/* After all the options, -n and -e in particular. */
+	if (session_types)
+		sessions_init(session_types);
+
+	/* A request run by the server has nothing more to ask the server. */
+	if (client_socket_name && ! serving)
+		exit(query(client_socket_name, argc, argv));
+
+	if (server_socket_name) {
+		/* Not from a request, which would serve in its child process. */
+		if (serving)
+			error("-u cannot be given in a request to the server");
+		/* The remaining arguments are directories to keep warm. */
+		serve(server_socket_name, &argv[optind], argc - optind, run);
+		/* NOTREACHED */
+	}
 
 	/* As far as command-line argument parsing is concerned, iff a string
 	 * conforms to a timestamp format, it is a time argument no matter
@@ -277,11 +401,42 @@ main(int argc, char **argv)
 	if ( numfiles == 1 )
 		keep_dups = 1;	/* no dups can occur, so don't do the work */
 
-	states = open_files(&argv[optind], numfiles);
+	if (cache_file_name && cache_load(cache_file_name) < 0)
+		error("cannot read %s: %s", cache_file_name, strerror(errno));
+
+	if ((report_times || compress || track_sessions) && nthreads < 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nthreads = ncpus > 0 ? (int) ncpus : 1;
+	}
+
+	/* Reporting on the files needs no merge, so they are looked at in
+	 * parallel rather than all opened first, unless -d or -S wants them
+	 * opened.
+	 */
+	if (report_times && ! dump_flag && stats_format == STATS_NONE) {
+		failed = report_files(stdout, report_json, &argv[optind],
+				      numfiles, nthreads, report_ordered);
+		if (cache_file_name && cache_save(cache_file_name) < 0)
+			error("cannot write %s: %s", cache_file_name,
+			      strerror(errno));
+		return failed ? 1 : 0;
+	}
+
+	t = tcpslice_open(&argv[optind], numfiles, errbuf);
+	if (! t)
+		error("%s", errbuf);
+	if (stats_format != STATS_NONE)
+		tcpslice_set_timing(t, 1);
+	if (track_sessions)
+		for (i = 0; i < numfiles; ++i)
+			sessions_pcap_init(tcpslice_pcap(t, i));
 	/* validate_files() might identify multiple issues before returning. */
-	if (validate_files(states, numfiles))
+	if (validate_files(t))
 		exit(1);
-	first_time = lowest_start_time(states, numfiles);
+	if (filter && tcpslice_setfilter(t, filter) < 0)
+		error("invalid filter '%s': %s", filter, tcpslice_geterr(t));
+	first_time = tcpslice_first_time(t);
 
 	if (start_time_string)
 		start_time = parse_time(start_time_string, first_time);
@@ -291,10 +446,10 @@ main(int argc, char **argv)
 	if (stop_time_string)
 		stop_time = parse_time(stop_time_string, start_time);
 	else
-		stop_time = latest_end_time(states, numfiles);
+		stop_time = tcpslice_last_time(t);
 
 	if (report_times) {
-		dump_times(states, numfiles);
+		dump_times(t);
 	}
 
 	if (dump_flag) {
@@ -303,20 +458,136 @@ main(int argc, char **argv)
 			timestamp_to_string( &stop_time ) );
 	}
 
-	if (! report_times && ! dump_flag) {
+	if (! report_times && ! dump_flag && histogram_format != STATS_NONE)
+		histogram(stdout, histogram_format, t, &start_time, &stop_time,
+			  histogram_interval);
+	else if (! report_times && ! dump_flag) {
 		if ( ! strcmp( write_file_name, "-" ) &&
 		     isatty( fileno(stdout) ) )
 			error("stdout is a terminal; redirect or use -w");
 
-		extract_slice(states, numfiles, write_file_name,
-		    &start_time, &stop_time, keep_dups, relative_time_merge,
-		    &first_time);
+		if (track_sessions)
+			sessions_threads = nthreads;
+		extract_slice(t, write_file_name, &start_time, &stop_time,
+		    keep_dups, relative_time_merge, compress, nthreads);
 	}
 
-	close_files (states, numfiles);
+	if (stats_format != STATS_NONE) {
+		stats_clock_stop(&run_clock, &slice_stats.total);
+		stats_report(stderr, stats_format, t, &slice_stats);
+	}
+	tcpslice_close(t);
 	return 0;
 }
 
+/* Parse a number of bytes, optionally followed by "k", "m" or "g" for
+ * KiB, MiB or GiB.
+ */
+static size_t
+parse_size(const char *str)
+{
+	unsigned long long size;
+	unsigned int shift = 0;
+	char *end;
+
+	/* strtoull() would take a sign, and negate the number. */
+	if (! isdigit((u_char)*str))
+		error("invalid size '%s'", str);
+	errno = 0;
+	size = strtoull(str, &end, 10);
+	if (errno)
+		error("invalid size '%s'", str);
+	switch (*end) {
+	case 'g':
+	case 'G':
+		shift = 30;
+		++end;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		++end;
+		break;
+	case 'k':
+	case 'K':
+		shift = 10;
+		++end;
+		break;
+	}
+	if (*end != '\0' || size > SIZE_MAX >> shift)
+		error("invalid size '%s'", str);
+	return (size_t)size << shift;
+}
+
+/* Parse the format of a report, "text" or "json". */
+static enum stats_format
+parse_format(const char *str)
+{
+	if (strcmp(str, "text") == 0)
+		return STATS_TEXT;
+	if (strcmp(str, "json") == 0)
+		return STATS_JSON;
+	error("invalid report format '%s'", str);
+	/* NOTREACHED */
+	return STATS_NONE;
+}
+
+/* Parse a positive number of seconds, or zero too if "zero_ok", optionally
+ * followed by "s", "m", "h" or "d" for seconds, minutes, hours or days.
+ */
+static time_t
+parse_interval(const char *str, const int zero_ok)
+{
+	unsigned long interval, unit = 1;
+	char *end;
+
+	/* strtoul() would take a sign, and negate the number. */
+	if (! isdigit((u_char)*str))
+		error("invalid interval '%s'", str);
+	errno = 0;
+	interval = strtoul(str, &end, 10);
+	if (errno || (interval == 0 && ! zero_ok))
+		error("invalid interval '%s'", str);
+	switch (*end) {
+	case 'd':
+		unit = 24 * 60 * 60;
+		++end;
+		break;
+	case 'h':
+		unit = 60 * 60;
+		++end;
+		break;
+	case 'm':
+		unit = 60;
+		++end;
+		break;
+	case 's':
+		++end;
+		break;
+	}
+	if (*end != '\0' || interval > INT32_MAX / unit)
+		error("invalid interval '%s'", str);
+	return (time_t)(interval * unit);
+}
+
+/* Parse a number from "min" to "max", the "what" of an option. */
+static unsigned int
+parse_count(const char *str, const unsigned int min, const unsigned int max,
+	    const char *what)
+{
+	unsigned long count;
+	char *end;
+
+	/* strtoul() would take a sign, and negate the number. */
+	if (! isdigit((u_char)*str))
+		error("invalid %s '%s'", what, str);
+	errno = 0;
+	count = strtoul(str, &end, 10);
+	if (errno || *end != '\0' || count < min || count > max)
+		error("invalid %s '%s'", what, str);
+	return (unsigned int)count;
+}
+
 /* Test if the string has a form of "sssssssss" or "sssssssss.uuuuuu" (as
  * discussed in the man page) and the integer part does not exceed the upper
  * limit and the fractional part (if any) does not try to specify more
@@ -650,7 +921,12 @@ fill_tm(const char *time_string, const int is_delta, struct tm *t, time_t *usecs
 			error("bad date format %s, problem starting at %s",
 			      time_string, t_start);
 
-		int val = atoi(t_start);
+		errno = 0;
+		long lval = strtol(t_start, NULL, 10);
+		if (errno || lval > INT_MAX)
+			error("bad date format %s, problem starting at %s",
+			      time_string, t_start);
+		int val = (int) lval;
 
 		char format_ch = *t_stop;
 		if (isupper((u_char)format_ch))
@@ -698,350 +974,151 @@ fill_tm(const char *time_string, const int is_delta, struct tm *t, time_t *usecs
 	}
 }
 
-/* Of all the files, what is the lowest start time. */
-static struct timeval
-lowest_start_time(const struct state *states, int numfiles)
-{
-	struct timeval min_time = states->file_start_time;
-
-	while (numfiles--) {
-		if (sf_timestamp_less_than(&states->file_start_time, &min_time)) {
-			min_time = states->file_start_time;
-		}
-		++states;
-	}
-	return min_time;
-}
-
-/* Of all the files, what is the latest end time. */
-static struct timeval
-latest_end_time(const struct state *states, int numfiles)
-{
-	struct timeval max_time = states->file_stop_time;
-
-	while (numfiles--) {
-		if (sf_timestamp_less_than(&max_time, &states->file_stop_time)) {
-			max_time = states->file_stop_time;
-		}
-		++states;
-	}
-	return max_time;
-}
-
-/* Get the next record in a file.  Deal with end of file.
- *
- * This routine also prevents time from going "backwards"
- * within a single file.
- */
-static void
-get_next_packet(struct state *s)
-{
-	struct timeval tvbuf;
-
-	do {
-		s->pkt = pcap_next(s->p, &s->hdr);
-		if (! s->pkt) {
-			s->done = 1;
-			if (track_sessions)
-				sessions_exit();
-			pcap_close(s->p);
-		}
-		TIMEVAL_FROM_PKTHDR_TS(tvbuf, s->hdr.ts);
-	} while ((! s->done) &&
-		 sf_timestamp_less_than(&tvbuf, &s->last_pkt_time));
-
-	s->last_pkt_time = tvbuf;
-}
-
-static struct state *
-open_files(char *filenames[], const int numfiles)
-{
-	struct state *states;
-	struct state *s;
-	char errbuf[PCAP_ERRBUF_SIZE];
-	int i;
-
-	if (numfiles == 0)
-		error("no input files specified");
-
-	/* allocate memory for all the files */
-	states = (struct state *) calloc(numfiles, sizeof(struct state));
-	if (! states)
-		error("unable to allocate memory for %d input files", numfiles);
-
-	for (i = 0; i < numfiles; ++i) {
-		s = &states[i];
-		s->filename = filenames[i];
-		s->p = pcap_open_offline(s->filename, errbuf);
-		if (! s->p)
-			error( "bad pcap file %s: %s", s->filename, errbuf );
-
-#ifdef HAVE_POSIX_FADVISE
-		FILE *pf = pcap_file(s->p);
-		if (pf == NULL)
-			error("pcap_file() failed");
-		int fd = fileno(pf);
-		if (fd == -1)
-			error("fileno() failed: %s", strerror(errno));
-		int padv_err;
-		if (0 != (padv_err = posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM)))
-			warning("warning: posix_fadvise() failed: %s", strerror(padv_err));
-		if (0 != (padv_err = posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE)))
-			warning("warning: posix_fadvise() failed: %s", strerror(padv_err));
-#endif
-
-		if (track_sessions)
-			sessions_nids_init(s->p);
-
-		int this_snap = pcap_snapshot( s->p );
-		if (this_snap > snaplen) {
-			snaplen = this_snap;
-		}
-
-		s->start_pos = ftell64( pcap_file( s->p ) );
-
-		if (pcap_next(s->p, &s->hdr) == NULL)
-			error( "error reading packet in %s: %s",
-				s->filename, pcap_geterr( s->p ) );
-
-		TIMEVAL_FROM_PKTHDR_TS(s->file_start_time, s->hdr.ts);
-
-		if ( ! sf_find_end( s->p, &s->file_start_time,
-					  &s->file_stop_time ) )
-			error( "problems finding end packet of file %s",
-				s->filename );
-
-		s->stop_pos = ftell64( pcap_file( s->p ) );
-	}
-
-	return states;
-}
-
 /* Return 0 on no errors. */
 static u_char
-validate_files(struct state states[], const int numfiles)
+validate_files(const tcpslice_t *t)
 {
 	u_char ret = 0;
 	int i, first_dlt, this_dlt;
+	struct timeval start, stop;
 
-	for (i = 0; i < numfiles; i++) {
-		this_dlt = pcap_datalink(states[i].p);
+	for (i = 0; i < tcpslice_numfiles(t); i++) {
+		this_dlt = pcap_datalink(tcpslice_pcap(t, i));
 		if (i == 0)
 			first_dlt = this_dlt;
 		else if (first_dlt != this_dlt) {
 			warning("file '%s' uses DLT %d, and the first file '%s' uses DLT %d",
-			        states[i].filename, this_dlt, states[0].filename, first_dlt);
+			        tcpslice_filename(t, i), this_dlt,
+			        tcpslice_filename(t, 0), first_dlt);
 			ret = 1;
 		}
 
 		/* Do a minimal sanity check of the timestamps. */
-		if (sf_timestamp_less_than(&states[i].file_stop_time,
-		                           &states[i].file_start_time)) {
+		tcpslice_file_times(t, i, &start, &stop);
+		if (sf_timestamp_less_than(&stop, &start)) {
 			warning("'%s' has the last timestamp before the first timestamp",
-			        states[i].filename);
+			        tcpslice_filename(t, i));
 			ret = 1;
 		}
 	}
 	return ret;
 }
 
-static void
-close_files(struct state states[], const int numfiles)
-{
-	int i;
-
-	for (i = 0; i < numfiles; i++)
-		if (!states[i].done)
-			pcap_close(states[i].p);
-	free(states);
-}
-
 /*
  * Extract from a given set of files all packets with timestamps between
  * the two time values given (inclusive).  These packets are written
- * to the save file given by write_file_name.
- *
- * Upon return, start_time is adjusted to reflect a time just after
- * that of the last packet written to the output.
+ * to the save file given by write_file_name, BGZF-compressed by
+ * "nthreads" threads if "compress" is set, or to several of them if
+ * rotated with -C or -G or split with -P.
  */
 static void
-extract_slice(struct state *states, const int numfiles, const char *write_file_name,
+extract_slice(tcpslice_t *t, const char *write_file_name,
 		const struct timeval *start_time, struct timeval *stop_time,
 		const int keep_dups, const int relative_time_merge,
-		const struct timeval *base_time)
+		const int compress, const int nthreads)
 {
-	struct state *s, *min_state;
-	struct timeval temp1, temp2, relative_start, relative_stop;
-	int i;
-
-	struct state *last_state;	/* remember the last packet */
-	struct pcap_pkthdr last_hdr;	/* in order to remove duplicates */
-	u_char* last_pkt;
-
-	if (numfiles == 0)
-		error("no input files specified");
-
-	last_state = 0;
-	last_hdr.ts.tv_sec = last_hdr.ts.tv_usec = 0;
-	last_hdr.caplen = last_hdr.len = 0;
-	last_pkt = (u_char *) calloc(1, snaplen);
-
-	if (! last_pkt)
-		error("out of memory");
-
-	timersub(start_time, base_time, &relative_start);
-	timersub(stop_time, base_time, &relative_stop);
-
-	/* Always write the output file, use the first input file's DLT. */
-	global_dumper = pcap_dump_open(states[0].p, write_file_name);
-	if (!global_dumper) {
-		error("error creating output file '%s': %s",
-		      write_file_name, pcap_geterr(states[0].p));
-	}
-
-	for (i = 0; i < numfiles; ++i) {
-		s = &states[i];
-
-		/* compute the first packet time within *this* file */
-		if (relative_time_merge) {
-			/* relative time within this file */
-			timeradd(&s->file_start_time, &relative_start, &temp1);
-		} else {
-			/* absolute time */
-			temp1 = *start_time;
-		}
-
-		/* check if this file has *anything* for us ... */
-		if (sf_timestamp_less_than(&s->file_stop_time, &temp1)) {
-			/* there aren't any packets of interest in this file */
-			s->done = 1;
-			pcap_close(s->p);
-			continue;
-		}
-
-		/*
-		 * sf_find_packet() requires that the time it's passed as
-		 * its last argument be in the range [min_time, max_time],
-		 * so we enforce that constraint here.
-		 */
-
-		if (sf_timestamp_less_than(&temp1, &s->file_start_time)){
-			temp1 = s->file_start_time;
-		}
-
-		sf_find_packet(s->p, &s->file_start_time, s->start_pos,
-				&s->file_stop_time, s->stop_pos,
-				&temp1);
-
-		/* get first packet for this file */
-		get_next_packet(s);
-	}
-
-
-	/*
-	 * Now, loop through all the packets in all the files,
-	 * putting packets out in timestamp order.
-	 *
-	 * Quite often, the files will not have overlapping
-	 * timestamps, so it would be nice to try to deal
-	 * efficiently with that situation. (XXX)
+	struct pcap_pkthdr *hdr;
+	const u_char *pkt;
+	int status;
+	unsigned int files;
+	struct timeval window_start = *start_time;
+	struct timeval lookahead_end;
+	struct timeval ts;
+	struct stats_clock clock;
+	size_t lookahead_read = 0;
+
+	tcpslice_set_keep_dups(t, keep_dups);
+	tcpslice_set_relative_time(t, relative_time_merge);
+
+	/* Use the first input file's DLT. */
+	global_output = output_open(tcpslice_pcap(t, 0), write_file_name,
+				    output_max_size, output_interval,
+				    compress, nthreads, output_shards);
+
+	/* Start reading early enough to see the sessions that are open
+	 * at start_time begin, but write none of these packets out except
+	 * to the files of these sessions.
 	 */
-
-	while (1) {
-		struct timeval tvbuf;
-
-		min_state = 0;
-		for (i = 0; i < numfiles; ++i) {
-			s = &states[i];
-			if (! s->done) {
-				if (! min_state)
-					min_state = s;
-
-				if (relative_time_merge) {
-					/* compare *relative* times */
-					timersub(&s->hdr.ts,
-						&s->file_start_time, &temp1);
-					timersub(&min_state->hdr.ts,
-						&min_state->file_start_time, &temp2);
-				} else {
-					/* compare *absolute* times */
-					TIMEVAL_FROM_PKTHDR_TS(temp1, s->hdr.ts);
-					TIMEVAL_FROM_PKTHDR_TS(temp2, min_state->hdr.ts);
-				}
-				if (sf_timestamp_less_than( &temp1, &temp2))
-					min_state = s;
-			}
-		}
-
-		if (! min_state)
-			break;	/* didn't find any !done files */
-
-		if (relative_time_merge) {
-			/* relative time w/in this file */
-			timeradd(&min_state->file_start_time, &relative_stop, &temp1);
-		} else
-			/* take absolute times */
-			temp1 = *stop_time;
-
-		TIMEVAL_FROM_PKTHDR_TS(tvbuf, min_state->hdr.ts);
-		if (sf_timestamp_less_than(&temp1, &tvbuf)) {
-			if (!sessions_count) {
-				/* We've gone beyond the end of the region
-				 * of interest ... We're done with this file.
-				 */
-				if (track_sessions)
-					sessions_exit();
-				min_state->done = 1;
-				pcap_close(min_state->p);
+	if (track_sessions && lookback) {
+		window_start.tv_sec = window_start.tv_sec > lookback ?
+		    window_start.tv_sec - lookback : 0;
+		lookback_time = 1;
+	}
+	if (tcpslice_setwindow(t, &window_start, stop_time) < 0)
+		error("%s", tcpslice_geterr(t));
+
+	while ((status = tcpslice_next(t, &hdr, &pkt)) != -2) {
+		if (status == -1)
+			error("%s", tcpslice_geterr(t));
+
+		if (status == 0) {
+			/* We've gone beyond the end of the region of
+			 * interest ... We're done, unless we need to
+			 * wait for the sessions to close, for at most
+			 * lookahead_time more seconds.  The sessions
+			 * still open after that are reported unclosed.
+			 */
+			if (lookback_time)
+				sessions_lookback_end();
+			if (track_sessions)
+				sessions_flush();
+			if (!sessions_count || bonus_time)
 				break;
-			} else {
-				/* We need to wait for the sessions to close */
-				bonus_time = 1;
-				*stop_time = min_state->file_stop_time;
+			bonus_time = 1;
+			lookahead_end = *stop_time;
+			*stop_time = tcpslice_last_time(t);
+			if (lookahead_time) {
+				lookahead_end.tv_sec += lookahead_time;
+				if (sf_timestamp_less_than(&lookahead_end, stop_time))
+					*stop_time = lookahead_end;
 			}
+			tcpslice_set_stop(t, stop_time);
+			continue;
 		}
 
-		if (relative_time_merge) {
-			timersub(&min_state->hdr.ts, &min_state->file_start_time, &temp1);
-			timeradd(&temp1, base_time, &min_state->hdr.ts);
+		if (lookback_time) {
+			TIMEVAL_FROM_PKTHDR_TS(ts, hdr->ts);
+			if (!sf_timestamp_less_than(&ts, start_time))
+				sessions_lookback_end();
 		}
 
-#ifdef HAVE_LIBNIDS
 		/* Keep track of sessions, if specified by the user */
-		if (track_sessions && min_state->hdr.caplen) {
-			/*
-			 * Copy the packet buffer to deconstify it for the function.
-			 */
-			u_char *pkt_copy = malloc(min_state->hdr.caplen);
-
-			if (!pkt_copy)
-				error("malloc() failed in %s()", __func__);
-			memcpy(pkt_copy, min_state->pkt, min_state->hdr.caplen);
-			nids_pcap_handler((u_char *)min_state->p, &min_state->hdr, pkt_copy);
-			free(pkt_copy);
+		if (track_sessions && hdr->caplen) {
+			if (stats_format != STATS_NONE)
+				stats_clock_start(&clock);
+			sessions_packet(tcpslice_current(t), hdr, pkt);
+			if (stats_format != STATS_NONE)
+				stats_clock_stop(&clock, &slice_stats.sessions);
 		}
-#endif
-
-		/* Dump it, unless it's a duplicate. */
-		if (!bonus_time)
-			if ( keep_dups ||
-			     min_state == last_state ||
-			     memcmp(&last_hdr, &min_state->hdr, sizeof(last_hdr)) ||
-			     memcmp(last_pkt, min_state->pkt, last_hdr.caplen) ) {
-				pcap_dump((u_char *) global_dumper, &min_state->hdr, min_state->pkt);
-
-				if ( ! keep_dups ) {
-					last_state = min_state;
-					last_hdr = min_state->hdr;
-					memcpy(last_pkt, min_state->pkt, min_state->hdr.caplen);
-				}
-			}
 
-		get_next_packet(min_state);
+		if (lookback_time)
+			continue;
+		if (!bonus_time) {
+			if (stats_format != STATS_NONE)
+				stats_clock_start(&clock);
+			output_dump(global_output, hdr, pkt);
+			if (stats_format != STATS_NONE)
+				stats_clock_stop(&clock, &slice_stats.dump);
+			++slice_stats.packets_written;
+			slice_stats.bytes_written +=
+			    PCAP_RECORD_HDR_LEN + hdr->caplen;
+		} else {
+			/* No more session starts after the window, so
+			 * there is nothing left to read once they are
+			 * all over, or once lookahead_size is read.
+			 */
+			lookahead_read += hdr->caplen;
+			if (!sessions_count ||
+			    (lookahead_size && lookahead_read >= lookahead_size))
+				break;
+		}
 	}
 
-	pcap_dump_close(global_dumper);
-	free(last_pkt);
+	if (track_sessions)
+		sessions_exit();
+	files = output_close(global_output, start_time);
+	global_output = NULL;
+	slice_stats.bytes_written += (uint64_t) files * PCAP_FILE_HDR_LEN;
 }
 
 /* Translates a timestamp to the time format specified by the user.
@@ -1095,13 +1172,18 @@ timestamp_to_string(const struct timeval *timestamp)
  * and last packets in the file.
  */
 static void
-dump_times(const struct state *states, int numfiles)
+dump_times(const tcpslice_t *t)
 {
-	for (; numfiles--; states++) {
+	struct timeval start, stop;
+	int i;
+
+	for (i = 0; i < tcpslice_numfiles(t); i++) {
+		tcpslice_file_times(t, i, &start, &stop);
 		printf( "%s\t%s\t%s\n",
-			states->filename,
-			timestamp_to_string( &states->file_start_time ),
-			timestamp_to_string( &states->file_stop_time ) );
+			tcpslice_filename(t, i),
+			timestamp_to_string( &start ),
+			tcpslice_seekable(t, i) ?
+			    timestamp_to_string( &stop ) : "unknown" );
 	}
 }
 
@@ -1136,13 +1218,22 @@ print_usage(FILE *f)
 
 #endif /* HAVE_LIBNIDS */
 
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+	(void)fprintf(f, "zlib version %s\n", zlibVersion());
+#endif
+
 #if defined(SIZEOF_VOID_P) && defined(SIZEOF_TIME_T)
 	(void)fprintf (f, "%u-bit build, %u-bit time_t\n",
 		       SIZEOF_VOID_P * 8, SIZEOF_TIME_T * 8);
 #endif
 
 	(void)fprintf(f,
-	              "Usage: tcpslice [-DdhlRrtv] [-w file]\n"
-	              "                [ -s types [ -e seconds ] [ -f format ] ]\n"
-	              "                [start-time [end-time]] file ... \n");
+	              "Usage: tcpslice [-DdhJlnORrtvz] [-C size] [-c file] [-F expression]\n"
+	              "                [-G seconds] [-j threads] [-P shards] [-S format]\n"
+	              "                [-w file] [-U socket]\n"
+	              "                [ -H format [ -i interval ] ]\n"
+	              "                [ -s types [ -e seconds ] [ -a seconds ] [ -A size ]\n"
+	              "                  [ -b seconds ] [ -f format [ -m files ] [ -M size ] ] ]\n"
+	              "                [start-time [end-time]] file ... \n"
+	              "       tcpslice [-v] -u socket [directory ...]\n");
 }
@@ -114,6 +114,37 @@
 #include <stdint.h>
 #include <pcap.h>
 
+#include "libtcpslice.h"
+
+/*
+ * The functions of libtcpslice.a that are not part of its interface in
+ * libtcpslice.h, which tcpslice uses too, get the prefix of the interface
+ * under the hood so as not to clash with the names of the programs that
+ * link with the library.
+ */
+#define cache_load		tcpslice_cache_load
+#define cache_lookup		tcpslice_cache_lookup
+#define cache_prune		tcpslice_cache_prune
+#define cache_refresh_dir	tcpslice_cache_refresh_dir
+#define cache_refresh_file	tcpslice_cache_refresh_file
+#define cache_save		tcpslice_cache_save
+#define cache_store		tcpslice_cache_store
+#define file_meta_read		tcpslice_file_meta_read
+#define fseek64			tcpslice_fseek64
+#define ftell64			tcpslice_ftell64
+#define gzfile_open		tcpslice_gzfile_open
+#define gzout_close		tcpslice_gzout_close
+#define gzout_open		tcpslice_gzout_open
+#define gzout_packet_end	tcpslice_gzout_packet_end
+#define savefile_open		tcpslice_savefile_open
+#define sf_estimate_packets	tcpslice_sf_estimate_packets
+#define sf_find_end		tcpslice_sf_find_end
+#define sf_find_packet		tcpslice_sf_find_packet
+#define sf_next_header		tcpslice_sf_next_header
+#define sf_timestamp_less_than	tcpslice_sf_timestamp_less_than
+#define stats_clock_start	tcpslice_stats_clock_start
+#define stats_clock_stop	tcpslice_stats_clock_stop
+
 #define IS_LEAP_YEAR(year)	\
 	((year) % 4 == 0 && ((year) % 100 != 0 || (year) % 400 == 0))
 
@@ -128,17 +159,103 @@
 	(dst).tv_usec = (src).tv_usec; \
 }
 
+/* For Solaris before 11. */
+/* compute a + b, store in c */
+#ifndef timeradd
+#define timeradd(a, b, c) { \
+	(c)->tv_sec = (a)->tv_sec + (b)->tv_sec; \
+	(c)->tv_usec = (a)->tv_usec + (b)->tv_usec; \
+	if ((c)->tv_usec > 1000000) { \
+		(c)->tv_usec -= 1000000; \
+		(c)->tv_sec += 1; \
+	} \
+}
+#endif /* timeradd */
+/* compute a - b, store in c */
+#ifndef timersub
+#define timersub(a, b, c) { \
+	(c)->tv_sec = (a)->tv_sec - (b)->tv_sec; \
+	if ((a)->tv_usec < (b)->tv_usec) { \
+		(c)->tv_sec -= 1;		/* need to borrow */ \
+		(c)->tv_usec = ((a)->tv_usec + 1000000) - (b)->tv_usec; \
+	} else { \
+		(c)->tv_usec = (a)->tv_usec - (b)->tv_usec; \
+	} \
+}
+#endif /* timersub */
+
 extern const int days_in_month[];
 time_t			gwtm2secs( const struct tm *tm );
 int32_t			gmt2local(time_t);
 
-int			sf_find_end( struct pcap *p, const struct timeval *first_timestamp,
-					struct timeval *last_timestamp );
+/* The sizes of the header of a savefile and of that of a packet record. */
+#define PCAP_FILE_HDR_LEN	24
+#define PCAP_RECORD_HDR_LEN	16
+
+/* The searches count their work in "st" unless it is NULL. */
+int			sf_find_end( struct pcap *p, const int snaplen,
+					const struct timeval *first_timestamp,
+					struct timeval *last_timestamp,
+					struct tcpslice_file_stats *st );
 int			sf_timestamp_less_than( const struct timeval *t1, const struct timeval *t2 );
-int			sf_find_packet( struct pcap *p,
+int			sf_find_packet( struct pcap *p, const int snaplen,
 				struct timeval *min_time, int64_t min_pos,
 				struct timeval *max_time, int64_t max_pos,
-				const struct timeval *desired_time );
+				const struct timeval *desired_time, char *errbuf,
+				struct tcpslice_file_stats *st );
+int			sf_next_header( struct pcap *p, struct pcap_pkthdr *hdr,
+				const int nsec, char *errbuf );
+int64_t			sf_estimate_packets( struct pcap *p, const int snaplen,
+				const struct timeval *first_timestamp,
+				const int64_t start_pos, const int64_t stop_pos,
+				const int samples );
+
+/* The time a phase started, to add what it took to a struct tcpslice_time
+ * when it ends.
+ */
+struct stats_clock {
+	double		wall;
+	double		cpu;
+};
+
+void			stats_clock_start(struct stats_clock *c);
+void			stats_clock_stop(const struct stats_clock *c,
+					struct tcpslice_time *t);
+
+/* What open_files() needs to know about a file before slicing it. */
+struct file_meta {
+	struct timeval	start_time,	/* time of first pkt in file */
+			stop_time;	/* time of last pkt in file */
+	int64_t		start_pos,	/* seek position of first pkt */
+			stop_pos;	/* seek position of last pkt */
+	int64_t		packets;	/* estimated number of pkts */
+};
+
+struct stat;
+int			cache_lookup(const char *filename, struct file_meta *meta);
+void			cache_store(const char *filename, const struct stat *sb,
+					const struct file_meta *meta);
+int			cache_refresh_file(const char *filename);
+int			cache_refresh_dir(const char *dirname);
+void			cache_prune(void);
+int			cache_load(const char *filename);
+int			cache_save(const char *filename);
+int			file_meta_read(pcap_t *p, struct file_meta *meta);
+
+extern int		serving;
+void			serve(const char *socket_name, char *dirs[], const int numdirs,
+				int (*handler)(int, char **));
+int			query(const char *socket_name, int argc, char **argv);
+
+pcap_t			*savefile_open(const char *filename, int *seekable,
+					char *errbuf);
+FILE			*gzfile_open(FILE *fp, const char *filename,
+					int *seekable, char *errbuf);
+
+struct gzout		*gzout_open(const char *filename, int nthreads,
+					FILE **fpp, char *errbuf);
+void			gzout_packet_end(struct gzout *gzo);
+int			gzout_close(struct gzout *gzo);
 
 int			fseek64(FILE *p, const int64_t offset, const int whence);
 int64_t			ftell64(FILE *p);
@@ -147,5 +264,73 @@ extern char *timestamp_to_string(const struct timeval *timestamp);
 void			error(const char *fmt, ...);
 void			warning(const char *fmt, ...);
 
-extern pcap_dumper_t	*global_dumper;
+/*
+ * Objects of the same size that are allocated and freed often come from
+ * slabs, and go back to a free list rather than to malloc(), so that they
+ * do not churn the heap and stay close together in memory.  The objects
+ * are only given back to the system by slab_destroy().
+ */
+struct slab {
+	size_t		size;		/* of each object */
+	void		*free_list;	/* linked through their first bytes */
+	void		*chunks;	/* linked through their first bytes */
+	uint32_t	chunk_count;
+	uint64_t	allocs;
+	uint64_t	in_use;
+	uint64_t	max_in_use;
+};
+
+void			*slab_alloc(struct slab *s);
+void			slab_free(struct slab *s, void *obj);
+void			slab_destroy(struct slab *s);
+
+struct output		*output_open(pcap_t *p, const char *name,
+					const uint64_t max_size,
+					const time_t interval, const int compress,
+					const int nthreads,
+					const unsigned int nshards);
+void			output_dump(struct output *o,
+					const struct pcap_pkthdr *hdr,
+					const u_char *pkt);
+unsigned int		output_close(struct output *o,
+					const struct timeval *start_time);
+
+extern struct output	*global_output;
+
+/* What the -S option reports on besides the work of libtcpslice, and how
+ * (see stats.c).
+ */
+enum stats_format {
+	STATS_NONE,
+	STATS_TEXT,
+	STATS_JSON
+};
+
+struct slice_stats {
+	struct tcpslice_time	total;
+	struct tcpslice_time	dump;		/* to the output file */
+	struct tcpslice_time	sessions;	/* tracking them */
+	uint64_t		packets_written;
+	uint64_t		bytes_written;
+};
+
+void			stats_report(FILE *f, const enum stats_format format,
+					const tcpslice_t *t,
+					const struct slice_stats *s);
+void			json_string(FILE *f, const char *str);
+
+/* The counts of the -H option, in the same formats (see histogram.c). */
+void			histogram(FILE *f, const enum stats_format format,
+				tcpslice_t *t, const struct timeval *start_time,
+				const struct timeval *stop_time,
+				const time_t interval);
+
+/* The times of the files for -J, -R, -r and -t, found by "nthreads" more
+ * threads than the main one and printed as they are found, or in the order
+ * of the files if "ordered" (see report.c).  Returns the number of files
+ * that could not be reported on.
+ */
+int			report_files(FILE *f, const int json,
+				char *const filenames[], const int numfiles,
+				int nthreads, const int ordered);
 #endif /* TCPSLICE_H */
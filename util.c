@@ -80,3 +80,66 @@ error(const char *fmt, ...)
 	exit(1);
 	/* NOTREACHED */
 }
+
+/*
+ * Take an object from a slab; objects are zeroed, as by calloc().
+ */
+void *
+slab_alloc(struct slab *s)
+{
+	void *obj;
+	u_char *chunk;
+	size_t per_chunk;
+	size_t i;
+
+	if (s->free_list == NULL) {
+		/*
+		 * A chunk is a pointer to the next chunk followed by the
+		 * objects, as many as fit in 64 KiB.
+		 */
+		per_chunk = (65536 - sizeof(void *)) / s->size;
+		chunk = malloc(sizeof(void *) + per_chunk * s->size);
+		if (chunk == NULL)
+			error("malloc() failed in %s()", __func__);
+		memcpy(chunk, &s->chunks, sizeof(void *));
+		s->chunks = chunk;
+		++s->chunk_count;
+		for (i = per_chunk; i > 0; --i) {
+			obj = chunk + sizeof(void *) + (i - 1) * s->size;
+			memcpy(obj, &s->free_list, sizeof(void *));
+			s->free_list = obj;
+		}
+	}
+	obj = s->free_list;
+	memcpy(&s->free_list, obj, sizeof(void *));
+	memset(obj, 0, s->size);
+	++s->allocs;
+	if (++s->in_use > s->max_in_use)
+		s->max_in_use = s->in_use;
+	return obj;
+}
+
+void
+slab_free(struct slab *s, void *obj)
+{
+	memcpy(obj, &s->free_list, sizeof(void *));
+	s->free_list = obj;
+	--s->in_use;
+}
+
+/*
+ * Give all the objects back to the system, whether they are in use or not.
+ */
+void
+slab_destroy(struct slab *s)
+{
+	void *chunk;
+
+	while ((chunk = s->chunks) != NULL) {
+		memcpy(&s->chunks, chunk, sizeof(void *));
+		free(chunk);
+	}
+	s->free_list = NULL;
+	s->chunk_count = 0;
+	s->allocs = s->in_use = s->max_in_use = 0;
+}